@@ -0,0 +1,224 @@
+#include <llvm-c/Analysis.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "compile.h"
+#include "profile.h"
+
+// the runtime the executables are linked against, see the Makefile
+#ifndef RUNTIME_OBJ
+#define RUNTIME_OBJ "runtime.o"
+#endif
+#ifndef PARALLEL_OBJ
+#define PARALLEL_OBJ "parallel.o"
+#endif
+
+struct aot_compiler *aot_create(const struct jit_options *opts)
+{
+  // the counters of --profile-gen live in the jit, only a profile can be used
+  if (opts->profile_use != NULL) {
+    if (profile_load(opts->profile_use))
+      return NULL;
+    profile_mode = PROFILE_USE;
+  }
+
+  LLVMInitializeNativeTarget();
+  LLVMInitializeNativeAsmPrinter();
+
+  char *triple = LLVMGetDefaultTargetTriple();
+  char *error;
+  LLVMTargetRef target;
+  if (LLVMGetTargetFromTriple(triple, &target, &error)) {
+    fprintf(stderr, "%s\n", error);
+    LLVMDisposeMessage(error);
+    LLVMDisposeMessage(triple);
+    return NULL;
+  }
+
+  static const LLVMCodeGenOptLevel levels[] = {
+    LLVMCodeGenLevelNone, LLVMCodeGenLevelLess, LLVMCodeGenLevelDefault, LLVMCodeGenLevelAggressive
+  };
+  char *cpu = LLVMGetHostCPUName();
+  char *features = LLVMGetHostCPUFeatures();
+
+  struct aot_compiler *aot = malloc(sizeof(struct aot_compiler));
+  aot->opts = *opts;
+  bounds_checks = opts->checked;
+  // position independent, to link into PIE executables
+  aot->target = LLVMCreateTargetMachine(target, triple, cpu, features, levels[opts->opt_level],
+                                        LLVMRelocPIC, LLVMCodeModelDefault);
+  LLVMDisposeMessage(cpu);
+  LLVMDisposeMessage(features);
+  LLVMDisposeMessage(triple);
+
+  aot->module = LLVMModuleCreateWithName("program");
+  prepare_module(aot->module, aot->target);
+  declare_runtime(aot->module);
+
+  aot->env = env_create();
+  aot->entries = NULL;
+  aot->n_exprs = 0;
+  aot->cap = 0;
+
+  return aot;
+}
+
+void aot_dispose(struct aot_compiler *aot)
+{
+  LLVMDisposeModule(aot->module);
+  LLVMDisposeTargetMachine(aot->target);
+  env_dispose(aot->env);
+  free(aot->entries);
+  free(aot);
+}
+
+void aot_add(struct aot_compiler *aot, struct expr *e)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "expr_%u", aot->n_exprs);
+
+  LLVMValueRef f = compile_expr(e, aot->env, name, aot->module);
+  if (f == NULL) {
+    fprintf(stderr, "expression discarded\n");
+    return;
+  }
+  // only main is visible outside: the expressions can be inlined in it
+  LLVMSetLinkage(f, LLVMInternalLinkage);
+
+  if (aot->n_exprs == aot->cap) {
+    aot->cap = aot->cap ? aot->cap * 2 : 16;
+    aot->entries = realloc(aot->entries, aot->cap * sizeof(struct aot_entry));
+  }
+  struct aot_entry *entry = &aot->entries[aot->n_exprs++];
+  entry->fn = f;
+  entry->vtype = e->vtype;
+  entry->elem_vtype = e->elem_vtype;
+  entry->cols = e->cols;
+}
+
+// main calls every expression in source order and prints its result with
+// the same runtime functions the jit uses
+static void build_main(struct aot_compiler *aot)
+{
+  LLVMModuleRef module = aot->module;
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8Type(), 0);
+
+  LLVMTypeRef i32_arg[] = { LLVMInt32Type() };
+  LLVMTypeRef vect_args[] = { i8_ptr, LLVMInt32Type(), LLVMInt32Type() };
+  LLVMValueRef print_i32 = LLVMAddFunction(module, "print_result_i32",
+                                           LLVMFunctionType(LLVMVoidType(), i32_arg, 1, 0));
+  LLVMValueRef print_unit = LLVMAddFunction(module, "print_result_unit",
+                                            LLVMFunctionType(LLVMVoidType(), NULL, 0, 0));
+  LLVMValueRef print_vect = LLVMAddFunction(module, "print_result_vect",
+                                            LLVMFunctionType(LLVMVoidType(), vect_args, 3, 0));
+  LLVMValueRef vect_reset = LLVMAddFunction(module, "vect_reset",
+                                            LLVMFunctionType(LLVMVoidType(), NULL, 0, 0));
+  LLVMValueRef rt_flush = LLVMAddFunction(module, "rt_flush",
+                                          LLVMFunctionType(LLVMVoidType(), NULL, 0, 0));
+
+  LLVMValueRef main = LLVMAddFunction(module, "main", LLVMFunctionType(LLVMInt32Type(), NULL, 0, 0));
+  LLVMBuilderRef builder = LLVMCreateBuilder();
+  LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(main, "entry"));
+
+  // --threads is built in, LCI_THREADS is read when the executable runs
+  if (aot->opts.threads > 0) {
+    LLVMValueRef set_threads = LLVMAddFunction(module, "par_set_threads",
+                                               LLVMFunctionType(LLVMVoidType(), i32_arg, 1, 0));
+    LLVMValueRef args[] = { LLVMConstInt(LLVMInt32Type(), aot->opts.threads, 0) };
+    LLVMBuildCall(builder, set_threads, args, 1, "");
+  }
+
+  for (unsigned i = 0; i < aot->n_exprs; ++i) {
+    struct aot_entry *entry = &aot->entries[i];
+    LLVMValueRef result = LLVMBuildCall(builder, entry->fn, NULL, 0, "");
+
+    switch (entry->vtype) {
+    case INTEGER: {
+      LLVMValueRef args[] = { result };
+      LLVMBuildCall(builder, print_i32, args, 1, "");
+      break;
+    }
+    case BOOLEAN: {
+      LLVMValueRef args[] = { LLVMBuildZExt(builder, result, LLVMInt32Type(), "") };
+      LLVMBuildCall(builder, print_i32, args, 1, "");
+      break;
+    }
+    case VECT: {
+      LLVMValueRef args[] = {
+        LLVMBuildBitCast(builder, result, i8_ptr, ""),
+        LLVMConstInt(LLVMInt32Type(), entry->elem_vtype == INTEGER ? 4 : 1, 0),
+        LLVMConstInt(LLVMInt32Type(), entry->cols, 0),
+      };
+      LLVMBuildCall(builder, print_vect, args, 3, "");
+      break;
+    }
+    default:
+      LLVMBuildCall(builder, print_unit, NULL, 0, "");
+      break;
+    }
+    LLVMBuildCall(builder, vect_reset, NULL, 0, "");
+  }
+  // the output is buffered by the runtime
+  LLVMBuildCall(builder, rt_flush, NULL, 0, "");
+  LLVMBuildRet(builder, LLVMConstInt(LLVMInt32Type(), 0, 0));
+  LLVMDisposeBuilder(builder);
+}
+
+// cc -o output object runtime.o parallel.o -pthread
+static int link_executable(const char *object, const char *output)
+{
+  const char *cc = getenv("CC") ? getenv("CC") : "cc";
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp(cc, cc, "-o", output, object, RUNTIME_OBJ, PARALLEL_OBJ, "-pthread", (char *)NULL);
+    perror(cc);
+    _exit(127);
+  }
+
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    return 1;
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int aot_finish(struct aot_compiler *aot, const char *output, int object_only)
+{
+  build_main(aot);
+
+  char *error;
+  LLVMVerifyModule(aot->module, LLVMAbortProcessAction, &error);
+  LLVMDisposeMessage(error);
+
+  optimise_module(aot->module, aot->opts.opt_level, aot->target);
+
+  // the object goes next to the executable, and is removed once linked
+  size_t len = strlen(output);
+  char *object = malloc(len + 3);
+  memcpy(object, output, len + 1);
+  if (!object_only)
+    strcat(object, ".o");
+
+  if (LLVMTargetMachineEmitToFile(aot->target, aot->module, object, LLVMObjectFile, &error)) {
+    fprintf(stderr, "%s\n", error);
+    LLVMDisposeMessage(error);
+    free(object);
+    return 1;
+  }
+
+  int failed = 0;
+  if (!object_only) {
+    failed = link_executable(object, output);
+    if (failed)
+      fprintf(stderr, "linking %s failed\n", output);
+    remove(object);
+  }
+
+  free(object);
+  return failed;
+}
@@ -0,0 +1,38 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <llvm-c/TargetMachine.h>
+#include "jit.h"
+
+// Ahead-of-time compilation: every top-level expression of the program is
+// compiled in the same module, whose main evaluates them in order and prints
+// their results just as jit_eval would. The module is then emitted as an
+// object file for the native target and, unless only the object is asked
+// for, linked with the runtime into an executable.
+struct aot_entry {
+  LLVMValueRef fn;
+  // the type of its result, to know how to print it
+  enum value_type vtype;
+  enum value_type elem_vtype;
+  int cols;
+};
+
+struct aot_compiler {
+  struct jit_options opts;
+
+  LLVMModuleRef module;
+  LLVMTargetMachineRef target;
+  struct env *env;
+
+  struct aot_entry *entries;   // compiled expressions, in source order
+  unsigned n_exprs;
+  unsigned cap;
+};
+
+struct aot_compiler *aot_create(const struct jit_options *opts);
+void aot_add(struct aot_compiler *aot, struct expr *e);
+// write the program to output; returns 0 on success
+int aot_finish(struct aot_compiler *aot, const char *output, int object_only);
+void aot_dispose(struct aot_compiler *aot);
+
+#endif
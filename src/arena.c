@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN      (sizeof(void *))
+
+static struct arena_chunk *new_chunk(struct arena *a, size_t size)
+{
+  if (size < ARENA_CHUNK_SIZE)
+    size = ARENA_CHUNK_SIZE;
+
+  struct arena_chunk *c = malloc(sizeof(struct arena_chunk) + size);
+  if (c == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+
+  ++a->n_chunks;
+  return c;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if (a->current == NULL) {
+    a->first = a->current = new_chunk(a, size);
+  }
+
+  // move on to the next chunk, reusing the ones kept from before a reset
+  // when they are big enough
+  while (a->current->used + size > a->current->size) {
+    struct arena_chunk *next = a->current->next;
+    if (next == NULL || next->size < size) {
+      struct arena_chunk *c = new_chunk(a, size);
+      c->next = next;
+      a->current->next = c;
+      next = c;
+    }
+    next->used = 0;
+    a->current = next;
+  }
+
+  void *p = a->current->data + a->current->used;
+  a->current->used += size;
+
+  ++a->n_allocs;
+  a->n_bytes += size;
+  return p;
+}
+
+void arena_reset(struct arena *a)
+{
+  if (a->first != NULL)
+    a->first->used = 0;
+  a->current = a->first;
+  ++a->n_resets;
+}
+
+void arena_release(struct arena *a)
+{
+  struct arena_chunk *c = a->first;
+  while (c != NULL) {
+    struct arena_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  a->first = a->current = NULL;
+}
+
+void arena_print_stats(const char *name, struct arena *a)
+{
+  fprintf(stderr, "%s arena: %lu allocations (%lu bytes), %lu chunk mallocs, %lu resets\n",
+          name, a->n_allocs, a->n_bytes, a->n_chunks, a->n_resets);
+}
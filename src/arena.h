@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+// A bump allocator: objects are carved out of big chunks and are never
+// freed one by one, the whole arena is reset at once instead. Chunks are
+// kept across resets, so that a warmed up arena does not call malloc.
+struct arena {
+  struct arena_chunk *first;
+  struct arena_chunk *current;
+
+  // counters, since the creation of the arena
+  unsigned long n_allocs;   // objects handed out
+  unsigned long n_bytes;    // bytes handed out
+  unsigned long n_chunks;   // chunks obtained from malloc
+  unsigned long n_resets;
+};
+
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+void arena_release(struct arena *a);
+
+void arena_print_stats(const char *name, struct arena *a);
+
+#endif
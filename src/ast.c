@@ -1,845 +1,1954 @@
-#include <llvm-c/Analysis.h>
-#include <llvm-c/ExecutionEngine.h>
-#include <llvm-c/IRReader.h>
-#include <llvm-c/Transforms/Scalar.h>
-#if LLVM_VERSION_MAJOR >= 7
-#include <llvm-c/Transforms/Utils.h>
-#endif
-
-#include <stdio.h>
-#include <stdlib.h>
-
-#include "ast.h"
-#include "y.tab.h"
-
-struct expr *make_val(int value) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = LITERAL;
-  e->value = value;
-
-  return e;
-}
-
-struct expr *make_bool(int value)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = LIT_BOOL;
-  e->value = value;
-
-  return e;
-}
-
-struct expr *make_identifier(char *ident) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = IDENT;
-  e->ident = ident;
-
-  return e;
-}
-
-struct expr *make_call( char *ident
-                      , struct expr *expr) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = CALL;
-  e->call.ident = ident;
-  e->call.expr = expr;
-
-  return e;
-}
-
-struct expr *make_let( char *ident
-                     , struct expr *expr
-                     , struct expr *body)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = LET;
-  e->let.ident = ident;
-  e->let.expr = expr;
-  e->let.body = body;
-
-  return e;
-}
-
-struct expr *make_var( char *ident
-                     , struct expr *expr
-                     , struct expr *body)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = VAR;
-  e->var.ident = ident;
-  e->var.expr = expr;
-  e->var.body = body;
-
-  return e;
-}
-
-struct expr *make_assign( char *ident
-                        , struct expr *expr)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = ASSIGN;
-  e->assign.ident = ident;
-  e->assign.expr = expr;
-
-  return e;
-}
-
-struct expr *make_if( struct expr *cond
-                    , struct expr *e_true
-                    , struct expr *e_false)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = IF;
-  e->if_expr.cond = cond;
-  e->if_expr.e_true = e_true;
-  e->if_expr.e_false = e_false;
-
-  return e;
-}
-
-struct expr *make_while( struct expr *cond
-                       , struct expr *body) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = WHILE;
-  e->while_expr.cond = cond;
-  e->while_expr.body = body;
-
-  return e;
-}
-
-struct expr *make_un_op( int op
-                       , struct expr *expr) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = UN_OP;
-  e->unop.op = op;
-  e->unop.expr = expr;
-
-  return e;
-}
-
-struct expr *make_bin_op(struct expr *lhs
-                        , int op
-                        , struct expr *rhs) 
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = BIN_OP;
-  e->binop.lhs = lhs;
-  e->binop.op = op;
-  e->binop.rhs = rhs;
-
-  return e;
-}
-
-// -----------------------------------------------------------
-
-struct expr_vect *make_expr_vect( struct expr *curr
-                                , struct expr_vect *next)
-{
-  struct expr_vect *ve = malloc(sizeof(struct expr_vect));
-
-  ve->curr_expr = curr;
-  ve->next_expr = next;
-
-  return ve;
-}
-
-struct expr *make_vect(struct expr_vect *vect)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-  e->type = VECTOR;
-  e->vect = vect;
-
-  return e;
-}
-
-struct expr *make_vect_access_op( struct expr *base
-                                , struct expr *offset)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = VECTOR_ACCESS_OP;
-  e->vect_access.base = base;
-  e->vect_access.offset = offset;
-
-  return e;
-}
-
-struct expr *make_vect_update_op( struct expr *base
-                                , struct expr *offset
-                                , struct expr *new_rhs)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = VECTOR_UPDATE_OP;
-  e->vect_update.base  = base;
-  e->vect_update.offset = offset;
-  e->vect_update.rhs   = new_rhs;
-
-  return e;
-}
-
-struct expr *make_seq(struct expr_vect *new_seq)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type = SEQ;
-  e->vect = new_seq;
-
-  return e;
-}
-
-struct expr *make_vect_sugared( struct expr_vect *new_vect
-                              , struct expr      *len)
-{
-  struct expr *e = malloc(sizeof(struct expr));
-
-  e->type              = SUGARED_VECTOR_BUILD_OP;
-  e->vect_build.sample = new_vect;
-  e->vect_build.len    = len;
-  return e;  
-}
-
-
-void free_vect(struct expr_vect *ve)
-{
-  free_expr(ve->curr_expr);
-  if(ve->next_expr != NULL)
-    free_vect(ve->next_expr);
-  free(ve);
-}
-
-// -----------------------------------------------------------
-
-void free_expr(struct expr *e) {
-  switch (e->type)
-  {
-    case LITERAL:
-    case LIT_BOOL:
-      break;
-
-    case IDENT:
-      free(e->ident);
-      break;
-
-    case CALL:
-      free(e->let.ident);
-      free_expr(e->let.expr);
-      break;
-
-    case LET:
-      free(e->let.ident);
-      free_expr(e->let.expr);
-      free_expr(e->let.body);
-      break;
-
-    case VAR:
-      free(e->var.ident);
-      free_expr(e->var.expr);
-      free_expr(e->var.body);
-      break;
-
-    case ASSIGN:
-      free(e->assign.ident);
-      free_expr(e->assign.expr);
-      break;
-
-    case IF:
-      free_expr(e->if_expr.cond);
-      free_expr(e->if_expr.e_true);
-      free_expr(e->if_expr.e_false);
-      break;
-
-    case WHILE:
-      free_expr(e->while_expr.cond);
-      free_expr(e->while_expr.body);
-      break;
-    
-    case UN_OP:
-      free_expr(e->unop.expr);
-      break;
-
-    case BIN_OP:
-      free_expr(e->binop.lhs);
-      free_expr(e->binop.rhs);
-      break;
-
-    case VECTOR:
-    case SEQ:
-      free_vect(e->vect);
-      break;
-
-    case VECTOR_ACCESS_OP:
-      free_expr(e->vect_access.base);
-      free_expr(e->vect_access.offset);
-      break;
-  
-    case VECTOR_UPDATE_OP:
-      free_expr(e->vect_update.base);
-      free_expr(e->vect_update.offset);
-      free_expr(e->vect_update.rhs);
-      break;
-    
-    case SUGARED_VECTOR_BUILD_OP:
-      free_vect(e->vect_build.sample);
-      free_expr(e->vect_build.len);
-      break;
-  }
-  free(e);
-}
-
-// auxiliary function to count the number of expressions in a list
-int vect_len(struct expr_vect *vect) {
-  int len = 0;
-  while(vect != NULL) {
-    ++len;
-    vect = vect->next_expr;
-  }
-  return len;
-}
-
-LLVMValueRef codegen_expr(
-  struct expr *e,
-  struct env *env,
-  LLVMModuleRef module,
-  LLVMBuilderRef builder
-)
-{
-  switch (e->type) {
-  case LITERAL: {
-    return LLVMConstInt(LLVMInt32Type(), e->value, 0);
-  }
-
-  case LIT_BOOL: {
-    return LLVMConstInt(LLVMInt1Type(), e->value, 0);
-  }
-
-  case CALL: {
-    LLVMValueRef expr = codegen_expr(e->call.expr, env, module, builder);
-    LLVMValueRef args[] = { expr };
-    LLVMValueRef fn = LLVMGetNamedFunction(module, e->call.ident);
-    if (!fn) {
-      fprintf(stderr, "Undefined function: %s\n", e->call.ident);
-      return expr;
-    }
-    return LLVMBuildCall(builder, fn, args, 1, "");
-  }
-
-  case LET: {
-    LLVMValueRef expr = codegen_expr(e->let.expr, env, module, builder);
-    struct env *new_env = push(env, e->let.ident, expr);
-    LLVMValueRef body = codegen_expr(e->let.body, new_env, module, builder);
-    pop(new_env);
-    return body;
-  }
-
-  case VAR: {
-    LLVMValueRef expr = codegen_expr(e->var.expr, env, module, builder);
-
-    LLVMBasicBlockRef current_bb = LLVMGetInsertBlock(builder);
-    LLVMValueRef f = LLVMGetBasicBlockParent(current_bb);
-    LLVMBasicBlockRef entry_bb = LLVMGetEntryBasicBlock(f);
-
-    // create the cell in the entry basic block of the function
-    LLVMPositionBuilder(builder, entry_bb, LLVMGetFirstInstruction(entry_bb));
-    LLVMValueRef pointer = LLVMBuildAlloca(builder, LLVMTypeOf(expr), e->var.ident);
-
-    // return to the old builder position and continue from there
-    LLVMPositionBuilderAtEnd(builder, current_bb);
-    LLVMBuildStore(builder, expr, pointer);
-
-    struct env *new_env = push(env, e->var.ident, pointer);
-    LLVMValueRef body = codegen_expr(e->var.body, new_env, module, builder);
-    pop(new_env);
-    return body;
-  }
-
-  case ASSIGN: {
-    // first evaluate the expression on rhs so that it is not valid the pointer is not resolved in the environment needless
-    LLVMValueRef expr = codegen_expr(e->var.expr, env, module, builder);
-    // 
-    LLVMValueRef pointer = resolve(env, e->assign.ident);
-    return LLVMBuildStore(builder, expr, pointer);
-  }
-
-  case IDENT: {
-    // evaluate the ID in the given environment
-    LLVMValueRef val       = resolve(env, e->ident);
-    LLVMTypeRef  val_type  = LLVMTypeOf(val);
-    LLVMTypeKind val_kind  = LLVMGetTypeKind(val_type);
-    
-    // act on val depending on its kind: literal or pointer
-    if (val_kind == LLVMPointerTypeKind) {
-
-      LLVMTypeRef  elem_type = LLVMGetElementType(val_type);
-      LLVMTypeKind elem_kind = LLVMGetTypeKind(elem_type);
-      // in the case of val being a LLVMPointerTypeKind, evaluate it according to its kind ("simple" or LLVMArrayTypeKind)    
-      if(elem_kind == LLVMArrayTypeKind) {
-        // val is a vector => we return it as it is to evaluate it further in the following recursions
-        return val;
-      } else {
-        return LLVMBuildLoad(builder, val, "");
-      }
-    } else {
-      return val;
-    }
-  }
-
-  case IF: {
-    LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
-    LLVMBasicBlockRef then_bb = LLVMAppendBasicBlock(f, "then");
-    LLVMBasicBlockRef else_bb = LLVMAppendBasicBlock(f, "else");
-    LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlock(f, "cont");
-
-    LLVMValueRef cond = codegen_expr(e->if_expr.cond, env, module, builder);
-    LLVMBuildCondBr(builder, cond, then_bb, else_bb);
-
-    LLVMPositionBuilderAtEnd(builder, then_bb);
-    LLVMValueRef then_val = codegen_expr(e->if_expr.e_true, env, module, builder);
-    LLVMBuildBr(builder, cont_bb);
-    then_bb = LLVMGetInsertBlock(builder);
-
-    LLVMPositionBuilderAtEnd(builder, else_bb);
-    LLVMValueRef else_val = codegen_expr(e->if_expr.e_false, env, module, builder);
-    LLVMBuildBr(builder, cont_bb);
-    else_bb = LLVMGetInsertBlock(builder);
-
-    LLVMPositionBuilderAtEnd(builder, cont_bb);
-
-    LLVMTypeRef type = LLVMTypeOf(then_val);
-
-    if (LLVMGetTypeKind(type) == LLVMVoidTypeKind) {
-      return then_val; // void value, just return any expr of the appropriate type
-    } 
-    else {
-      LLVMValueRef phi = LLVMBuildPhi(builder, type, "");
-      LLVMValueRef values[] = {then_val, else_val};
-      LLVMBasicBlockRef blocks[] = {then_bb, else_bb};
-      LLVMAddIncoming(phi, values, blocks, 2);
-      return phi;
-    }
-  }
-
-  case WHILE: {
-    LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
-    LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlock(f, "cond");
-    LLVMBasicBlockRef body_bb = LLVMAppendBasicBlock(f, "body");
-    LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlock(f, "cont");
-
-    LLVMValueRef ret = LLVMBuildBr(builder, cond_bb);
-
-    LLVMPositionBuilderAtEnd(builder, cond_bb);
-    LLVMValueRef cond = codegen_expr(e->while_expr.cond, env, module, builder);
-    LLVMBuildCondBr(builder, cond, body_bb, cont_bb);
-
-    LLVMPositionBuilderAtEnd(builder, body_bb);
-    codegen_expr(e->while_expr.body, env, module, builder);
-    LLVMBuildBr(builder, cond_bb);
-
-    LLVMPositionBuilderAtEnd(builder, cont_bb);
-    return ret; // return a void expression
-  }
-
-  case UN_OP: {
-    LLVMValueRef expr = codegen_expr(e->unop.expr, env, module, builder);
-    return LLVMBuildNot(builder, expr, "");
-  }
-
-  case BIN_OP: {
-    // the idea is to not generate code for righthand side if lefthand side is false
-    if(e->binop.op == AND_SC)
-    {
-      LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
-      LLVMBasicBlockRef left_true_bb  = LLVMAppendBasicBlock(f, "left_true");
-      LLVMBasicBlockRef left_false_bb = LLVMAppendBasicBlock(f, "left_false");
-      LLVMBasicBlockRef cont_bb       = LLVMAppendBasicBlock(f, "cont");
-
-      LLVMValueRef left_val = codegen_expr(e->binop.lhs, env, module, builder);
-      // generate a branching point with condition left_val as condition and
-      // left_true and left_false as possible successors blocks
-      LLVMBuildCondBr(builder, left_val, left_true_bb, left_false_bb);
-
-      // in the case left is true we need to evaluate the right hand side
-      LLVMPositionBuilderAtEnd(builder, left_true_bb);
-      LLVMValueRef right_val = LLVMBuildAnd(builder, left_val, codegen_expr(e->binop.rhs, env, module, builder), "");
-      LLVMBuildBr(builder, cont_bb);
-      left_true_bb = LLVMGetInsertBlock(builder);
-
-      // in the case left is flase we can skip the codegeneration for the right hand side
-      LLVMPositionBuilderAtEnd(builder, left_false_bb);
-      // skip code generation for right hand side of the expression
-      LLVMBuildBr(builder, cont_bb);
-      left_false_bb = LLVMGetInsertBlock(builder);
-      
-      LLVMPositionBuilderAtEnd(builder, cont_bb);
-
-      // create a phi block to let the two previous block sink in a phi block
-      LLVMValueRef phi = LLVMBuildPhi(builder, LLVMInt1Type(), "");
-
-      // set edges to the newly created block
-      LLVMValueRef partial_results[] = {left_val, right_val};
-      LLVMBasicBlockRef blocks[]     = {left_true_bb, left_false_bb};
-      LLVMAddIncoming(phi, partial_results, blocks, 2);
-      return phi;
-    }
-    // the idea is to not generate code for righthand side if lefthand side is false
-      else if(e->binop.op == OR_SC)
-    {
-      LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
-      LLVMBasicBlockRef left_true_bb  = LLVMAppendBasicBlock(f, "left_true");
-      LLVMBasicBlockRef left_false_bb = LLVMAppendBasicBlock(f, "left_false");
-      LLVMBasicBlockRef cont_bb       = LLVMAppendBasicBlock(f, "cont");
-
-      LLVMValueRef left_val = codegen_expr(e->binop.lhs, env, module, builder);
-      LLVMBuildCondBr(builder, left_val, left_true_bb, left_false_bb);
-  
-      LLVMPositionBuilderAtEnd(builder, left_false_bb);
-      LLVMValueRef right_val = LLVMBuildOr(builder, left_val, codegen_expr(e->binop.rhs, env, module, builder), "");
-      LLVMBuildBr(builder, cont_bb);
-      left_false_bb = LLVMGetInsertBlock(builder);
-
-      LLVMPositionBuilderAtEnd(builder, left_true_bb);
-      // skip codegen
-      LLVMBuildBr(builder, cont_bb);
-      left_true_bb = LLVMGetInsertBlock(builder);
-  
-      LLVMPositionBuilderAtEnd(builder, cont_bb);
-
-      LLVMValueRef phi = LLVMBuildPhi(builder, LLVMInt1Type(), "");
-      LLVMValueRef partial_results[] = {left_val, right_val};
-      LLVMBasicBlockRef blocks[] = {left_true_bb, left_false_bb};
-      LLVMAddIncoming(phi, partial_results, blocks, 2);
-
-      return phi;
-    }
-    else if(e->binop.op == CONCAT_KW)
-    {
-      LLVMValueRef lhs = codegen_expr(e->binop.lhs, env, module, builder);
-      LLVMValueRef rhs = codegen_expr(e->binop.rhs, env, module, builder);
-
-      LLVMTypeRef array_type_lhs = LLVMGetElementType(LLVMTypeOf(lhs));
-      unsigned size_lhs = LLVMGetArrayLength(array_type_lhs);
-
-      LLVMTypeRef array_type_rhs = LLVMGetElementType(LLVMTypeOf(rhs));
-      unsigned size_rhs = LLVMGetArrayLength(array_type_rhs);
-
-      unsigned size_conc = size_lhs + size_rhs;
-
-      LLVMTypeRef conc_elem_type    = LLVMGetElementType(array_type_lhs);
-      LLVMTypeRef conc_vector_type  = LLVMArrayType(conc_elem_type, size_conc);
-
-      LLVMValueRef conc_vector_base_address = LLVMBuildAlloca(builder, conc_vector_type, "");
-
-      unsigned i = 0;
-      unsigned index_load = 0;
-      // copy from lhs to the concatenated vector
-      while(i < size_lhs) 
-      {
-        // setup the load from one of the old vector
-        LLVMValueRef offset_load = LLVMBuildStructGEP(builder, lhs, index_load, "");
-        LLVMValueRef val_to_store = LLVMBuildLoad(builder, offset_load, "");
-        
-        // compute the offset to store
-        LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), i, 0) };
-        // compute the offset where the i-th value has to be stored
-        LLVMValueRef offset_store = LLVMBuildInBoundsGEP2(builder, conc_elem_type, conc_vector_base_address, idxs, 1, "");
-        // store element i at address: vector_base_address + offset
-        LLVMBuildStore(builder, val_to_store, offset_store);
-        ++index_load;
-        ++i;
-      }
-      index_load = 0;
-      // copy from rhs to the concatenated vector
-      while(i < size_conc) 
-      {
-        // setup the load from one of the old vector
-        LLVMValueRef offset_load = LLVMBuildStructGEP(builder, rhs, index_load, "");
-        LLVMValueRef val_to_store = LLVMBuildLoad(builder, offset_load, "");
-        
-        // compute the offset to store
-        LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), i, 0) };
-        // compute the offset where the i-th value has to be stored
-        LLVMValueRef offset_store = LLVMBuildInBoundsGEP2(builder, conc_elem_type, conc_vector_base_address, idxs, 1, "");
-        // store element i at address: vector_base_address + offset
-        LLVMBuildStore(builder, val_to_store, offset_store);
-        ++index_load;
-        ++i;
-      }
-      return conc_vector_base_address;
-    }
-
-    else // "standard" binary operation
-    {
-      LLVMValueRef lhs = codegen_expr(e->binop.lhs, env, module, builder);
-      LLVMValueRef rhs = codegen_expr(e->binop.rhs, env, module, builder);
-      switch (e->binop.op)
-      {
-      case '+': return LLVMBuildAdd(builder, lhs, rhs, "");
-      case '-': return LLVMBuildSub(builder, lhs, rhs, "");
-      case '*': return LLVMBuildMul(builder, lhs, rhs, "");
-      case '/': return LLVMBuildSDiv(builder, lhs, rhs, "");
-      case MOD: return LLVMBuildURem(builder, lhs, rhs, "");
-      case '<': return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "");
-      case '>': return LLVMBuildICmp(builder, LLVMIntSGT, lhs, rhs, "");
-      case LE : return LLVMBuildICmp(builder, LLVMIntSLE, lhs, rhs, "");
-      case GE : return LLVMBuildICmp(builder, LLVMIntSGE, lhs, rhs, "");
-      case '=': return LLVMBuildICmp(builder, LLVMIntEQ, lhs, rhs, "");
-      case NE : return LLVMBuildICmp(builder, LLVMIntNE, lhs, rhs, "");
-      case AND: return LLVMBuildAnd(builder, lhs, rhs, "");
-      case OR : return LLVMBuildOr(builder, lhs, rhs, "");
-      default: return NULL;
-      }
-    }
-  }
-
-  case VECTOR: {
-    struct expr_vect *ve = e->vect;
-    int i = 0;
-
-    int size = vect_len(ve);
-    
-    // create a C array to hold the result of the evaluation of of every expr in the list of expressions ve
-    LLVMValueRef* expressions = malloc(sizeof(LLVMValueRef) * size);
-
-    // generate code for every expression in the vector
-    while(ve != NULL) {
-      expressions[i] = codegen_expr(ve->curr_expr, env, module, builder);
-      ve = ve->next_expr;
-      ++i;
-    }
-
-    // Now we evaluated every expression in the vector. It is left to store each results in memory
-
-    // compute the type of the vector of expressions 
-    // implementation choice: the type must be the same for every expression in the list
-    LLVMTypeRef element_type = LLVMTypeOf(expressions[0]);
-    LLVMTypeRef vector_type  = LLVMArrayType(element_type, size);
-
-    // emit LLVM IR code to allocate space for this type of vector and get the base address of it
-    LLVMValueRef vector_base_address = LLVMBuildAlloca(builder, vector_type, "");
-    // put each vector elements in its place computing offsets starting from vector_base_address
-    i = 0;
-    while(i < size) 
-    {
-      LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), i, 0) };
-      // compute the offset where the i-th value has to be stored
-      LLVMValueRef offset = LLVMBuildInBoundsGEP2(builder, element_type, vector_base_address, idxs, 1, "");
-      // store element i at address: vector_base_address + offset
-      LLVMBuildStore(builder, expressions[i], offset);
-      ++i;
-    }
-    return vector_base_address;
-  }
-
-  case VECTOR_ACCESS_OP: {
-    LLVMValueRef vect_id = codegen_expr(e->vect_access.base, env, module, builder);
-    // idxs is needed to hold the result of the evaluation of expressions yielding an offset to access the given vector
-    LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), 0, 0), codegen_expr(e->vect_access.offset, env, module, builder) };
-    // compute the type of the vector. Needed for LLVMBuildInBoundsGEP2
-    LLVMTypeRef vect_type = LLVMGetElementType(LLVMTypeOf(vect_id));
-    
-    // LLVMBuildInBoundsGEP2 requires the type of the LLVMArrayType. Using this one it is allowed to use any number of dimensions
-    LLVMValueRef offset = LLVMBuildInBoundsGEP2(builder, vect_type, vect_id, idxs, 2, "");
-    return LLVMBuildLoad(builder, offset, "");
-  }
-
-  case VECTOR_UPDATE_OP: {
-    // evaluate the base address in the environment
-    LLVMValueRef vect_id = codegen_expr(e->vect_update.base, env, module, builder);
-    // evaluate the expression to get the offset
-    LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), 0, 0), codegen_expr(e->vect_update.offset, env, module, builder) };
-    
-    LLVMValueRef rhs = codegen_expr(e->vect_update.rhs, env, module, builder);
-
-    LLVMTypeRef vect_type = LLVMGetElementType(LLVMTypeOf(vect_id));
-    
-    LLVMValueRef offset = LLVMBuildInBoundsGEP2(builder, vect_type, vect_id, idxs, 2, "");
-
-    return LLVMBuildStore(builder, rhs, offset);
-  }
-
-  case SEQ: { // returns the last expression of the sequence
-    LLVMValueRef ret;
-    struct expr_vect *ve = e->vect;
-    do {
-      ret = codegen_expr(ve->curr_expr, env, module, builder);
-      ve = ve->next_expr;
-    } while(ve != NULL);
-
-    return ret;
-  }
-
-  case SUGARED_VECTOR_BUILD_OP: {
-    struct expr_vect *ve_head = e->vect_build.sample;
-    struct expr_vect *ve_last = e->vect_build.sample;
-    int i = 0;
-
-    int sample_vect_size = vect_len(ve_head);
-    LLVMValueRef val = codegen_expr(e->vect_build.len, env, module, builder);
-
-    unsigned new_size = sample_vect_size * LLVMConstIntGetZExtValue(val);
-
-    // create a C array to hold the result of the evaluation of of every expr in the list of expressions ve
-    LLVMValueRef* expressions = malloc(sizeof(LLVMValueRef) * new_size);
-
-    // make the given expr_vect circular linking the the last with the first element
-    while(ve_last->next_expr != NULL) {
-      ve_last = ve_last->next_expr;
-    }
-    ve_last->next_expr = ve_head;
-
-    // generate code for every expression in the vector
-    while(i < new_size) {
-      expressions[i] = codegen_expr(ve_head->curr_expr, env, module, builder);
-      ve_head = ve_head->next_expr;
-      ++i;
-    }
-    // here it is needed to undo the circularity because jit_eval performs two codegen_expr and
-    // and if this is not done then the second call remains stuck in the call vect_len
-    ve_last->next_expr = NULL;
-
-    LLVMTypeRef element_type = LLVMTypeOf(expressions[0]);
-    LLVMTypeRef vector_type  = LLVMArrayType(element_type, new_size);
-
-    // emit LLVM IR code to allocate space for this type of vector and get the base address of it
-    LLVMValueRef vector_base_address = LLVMBuildAlloca(builder, vector_type, "");
-
-    // put each vector elements in its place computing offsets starting from vector_base_address
-    i = 0;
-
-    while(i < new_size) 
-    {
-      LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32Type(), i, 0) };
-      // compute the offset where the i-th value has to be stored
-      LLVMValueRef offset = LLVMBuildInBoundsGEP2(builder, element_type, vector_base_address, idxs, 1, "");
-      // store element i at address: vector_base_address + offset
-      LLVMBuildStore(builder, expressions[i], offset);
-      ++i;
-    }
-      return vector_base_address;
-  }
-  
-  default:
-    return NULL;
-  }
-}
-
-void jit_eval(struct expr *expr) 
-{
-  LLVMModuleRef module = LLVMModuleCreateWithName("exe");
-  LLVMBuilderRef builder = LLVMCreateBuilder();
-  LLVMExecutionEngineRef engine;
-
-  LLVMTypeRef one_i32_arg[] = {LLVMInt32Type()};
-
-  LLVMAddFunction(module, "print_i32",
-                  LLVMFunctionType(LLVMVoidType(), one_i32_arg, 1, 0));
-
-  LLVMAddFunction(module, "read_i32",
-                  LLVMFunctionType(LLVMInt32Type(), one_i32_arg, 1, 0));
-
-  LLVMInitializeNativeTarget();
-  LLVMInitializeNativeAsmPrinter();
-  LLVMInitializeNativeAsmParser();
-  LLVMLinkInMCJIT();
-
-
-  // NEW
-  // Setup optimizations using a pass manager
-  
-  LLVMPassManagerRef pass_manager = LLVMCreateFunctionPassManagerForModule(module);
-  
-  // Do simple "peephole" optimizations and bit-twiddling opti.
-  // LLVMAddInstructionCombiningPass(pass_manager);
-  
-  // Reassociate expressions.
-  // LLVMAddReassociatePass(pass_manager);
-  
-  // Eliminate Common SubExpressions.
-  // LLVMAddGVNPass(pass_manager);
-  
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  LLVMAddCFGSimplificationPass(pass_manager);
-
-  //LLVMAddPromoteMemoryToRegisterPass(pass_manager);
-  LLVMInitializeFunctionPassManager(pass_manager);;
-  
-  char *error;
-  if (LLVMCreateExecutionEngineForModule(&engine, module, &error)) {
-    fprintf(stderr, "%s\n", error);
-    return;
-  }
-
-
-  // LLVM can only emit instructions in basic blocks
-  //   basic blocks are always part of a function
-  //   function are contained in modules
-
-  // visit expression to get its LLVM type
-  LLVMTypeRef bad_f_type = LLVMFunctionType(LLVMVoidType(), NULL, 0, 0);
-  LLVMValueRef typing_f = LLVMAddFunction(module, "typing_f", bad_f_type);
-  
-  LLVMBasicBlockRef typing_entry_bb = LLVMAppendBasicBlock(typing_f, "entry");
-  LLVMPositionBuilderAtEnd(builder, typing_entry_bb);
-  LLVMValueRef typing_ret = codegen_expr(expr, NULL, module, builder);
-  LLVMBuildRetVoid(builder);
-  LLVMTypeRef type = LLVMTypeOf(typing_ret);
-  LLVMDeleteFunction(typing_f);
-
-
-  // emit expression as function body
-  LLVMTypeRef actual_f_type = LLVMFunctionType(type, NULL, 0, 0);
-  LLVMValueRef f = LLVMAddFunction(module, "main", actual_f_type);
-  LLVMBasicBlockRef entry_bb = LLVMAppendBasicBlock(f, "entry");
-  LLVMPositionBuilderAtEnd(builder, entry_bb);
-  LLVMValueRef ret = codegen_expr(expr, NULL, module, builder);
-
-
-  // return the result and terminate the function
-  if (LLVMGetTypeKind(type) == LLVMVoidTypeKind) {
-    LLVMBuildRetVoid(builder);
-  } else {
-    LLVMBuildRet(builder, ret);
-  }
-
-  fprintf(stderr, "\ngenerating code...\n");
-  LLVMDumpValue(f);
-
-  LLVMVerifyModule(module, LLVMAbortProcessAction, &error);
-
-  // OPTIMISATION PASS
-  fprintf(stderr, "\ngenerating optimised code...\n");
-  LLVMRunFunctionPassManager(pass_manager, f);
-  LLVMDumpValue(f);
-
-
-  // EXECUTE LLVM GENERATED CODE  
-  fprintf(stderr, "\nrunning...\n");
-  LLVMGenericValueRef result = LLVMRunFunction(engine, f, 0, NULL);
-
-  if (LLVMGetTypeKind(type) == LLVMVoidTypeKind) {
-    printf("-> done\n");
-  } else {
-    printf("-> %d\n", (int)LLVMGenericValueToInt(result, 0));
-  }
-  
-  LLVMDisposeGenericValue(result);
-
-  LLVMDisposeBuilder(builder);
-  LLVMDisposeExecutionEngine(engine);
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <llvm-c/DebugInfo.h>
+
+#include "ast.h"
+#include "profile.h"
+#include "y.tab.h"
+
+// every node of the expression being parsed is allocated from here
+struct arena ast_arena;
+
+int bounds_checks;
+
+struct expr *make_val(int value) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = LITERAL;
+  e->value = value;
+
+  return e;
+}
+
+struct expr *make_bool(int value)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = LIT_BOOL;
+  e->value = value;
+
+  return e;
+}
+
+struct expr *make_identifier(int ident) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = IDENT;
+  e->ident = ident;
+
+  return e;
+}
+
+struct expr *make_call( int ident
+                      , struct expr_vect *args) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = CALL;
+  e->call.ident = ident;
+  e->call.args = args;
+  e->call.tail = 0;
+
+  return e;
+}
+
+struct expr *make_param( int ident
+                       , int type_ident)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = PARAM;
+  e->param.ident = ident;
+  e->param.type_ident = type_ident;
+
+  return e;
+}
+
+struct fun_def *make_fun_def( int ident
+                            , struct expr_vect *params
+                            , int ret_type_ident
+                            , struct expr *body)
+{
+  struct fun_def *f = arena_alloc(&ast_arena, sizeof(struct fun_def));
+
+  f->ident = ident;
+  f->params = params;
+  f->ret_type_ident = ret_type_ident;
+  f->body = body;
+  f->calls = 0;
+  f->parallel_safe = 0;
+
+  return f;
+}
+
+struct expr *make_let( int ident
+                     , struct expr *expr
+                     , struct expr *body)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = LET;
+  e->let.ident = ident;
+  e->let.expr = expr;
+  e->let.body = body;
+
+  return e;
+}
+
+struct expr *make_var( int ident
+                     , struct expr *expr
+                     , struct expr *body)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = VAR;
+  e->var.ident = ident;
+  e->var.expr = expr;
+  e->var.body = body;
+
+  return e;
+}
+
+struct expr *make_assign( int ident
+                        , struct expr *expr)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = ASSIGN;
+  e->assign.ident = ident;
+  e->assign.expr = expr;
+
+  return e;
+}
+
+struct expr *make_if( struct expr *cond
+                    , struct expr *e_true
+                    , struct expr *e_false)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = IF;
+  e->if_expr.cond = cond;
+  e->if_expr.e_true = e_true;
+  e->if_expr.e_false = e_false;
+  e->counts = NULL;
+
+  return e;
+}
+
+struct expr *make_while( struct expr *cond
+                       , struct expr *body) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = WHILE;
+  e->while_expr.cond = cond;
+  e->while_expr.body = body;
+  e->counts = NULL;
+
+  return e;
+}
+
+struct expr *make_un_op( int op
+                       , struct expr *expr) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = UN_OP;
+  e->unop.op = op;
+  e->unop.expr = expr;
+
+  return e;
+}
+
+struct expr *make_bin_op(struct expr *lhs
+                        , int op
+                        , struct expr *rhs) 
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = BIN_OP;
+  e->binop.lhs = lhs;
+  e->binop.op = op;
+  e->binop.rhs = rhs;
+  e->counts = NULL;
+
+  return e;
+}
+
+// -----------------------------------------------------------
+
+struct expr_vect *make_expr_vect( struct expr *curr
+                                , struct expr_vect *next)
+{
+  struct expr_vect *ve = arena_alloc(&ast_arena, sizeof(struct expr_vect));
+
+  ve->curr_expr = curr;
+  ve->next_expr = next;
+
+  return ve;
+}
+
+struct expr *make_vect(struct expr_vect *vect)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+  e->type = VECTOR;
+  e->vect = vect;
+
+  return e;
+}
+
+// the elements of vectors are scalars: an index applied to an access
+// makes it the access of a matrix, m[i][j], and so does an update through
+// one, m[i][j] := x
+struct expr *make_vect_access_op( struct expr *base
+                                , struct expr *offset)
+{
+  if (base->type == VECTOR_ACCESS_OP && base->vect_access.col == NULL) {
+    base->vect_access.col = offset;
+    return base;
+  }
+
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = VECTOR_ACCESS_OP;
+  e->vect_access.base = base;
+  e->vect_access.offset = offset;
+  e->vect_access.col = NULL;
+  e->in_bounds = 0;
+
+  return e;
+}
+
+struct expr *make_vect_update_op( struct expr *base
+                                , struct expr *offset
+                                , struct expr *new_rhs)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = VECTOR_UPDATE_OP;
+  e->vect_update.base  = base;
+  e->vect_update.offset = offset;
+  e->vect_update.col   = NULL;
+  e->vect_update.rhs   = new_rhs;
+  e->in_bounds = 0;
+
+  if (base->type == VECTOR_ACCESS_OP && base->vect_access.col == NULL) {
+    e->vect_update.base = base->vect_access.base;
+    e->vect_update.offset = base->vect_access.offset;
+    e->vect_update.col = offset;
+  }
+  return e;
+}
+
+struct expr *make_seq(struct expr_vect *new_seq)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = SEQ;
+  e->vect = new_seq;
+
+  return e;
+}
+
+struct expr *make_vect_sugared( struct expr_vect *new_vect
+                              , struct expr      *len)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type              = SUGARED_VECTOR_BUILD_OP;
+  e->vect_build.sample = new_vect;
+  e->vect_build.len    = len;
+  return e;  
+}
+
+struct expr *make_parallel_for( int ident
+                              , struct expr *from
+                              , struct expr *to
+                              , int op
+                              , struct expr *body)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = PARALLEL_FOR;
+  e->par_for.ident = ident;
+  e->par_for.from = from;
+  e->par_for.to = to;
+  e->par_for.op = op;
+  e->par_for.body = body;
+
+  return e;
+}
+
+struct expr *make_tiled_for( int row
+                           , struct expr *from
+                           , struct expr *to
+                           , int col
+                           , struct expr *col_from
+                           , struct expr *col_to
+                           , struct expr *tile
+                           , struct expr *body)
+{
+  struct expr *e = arena_alloc(&ast_arena, sizeof(struct expr));
+
+  e->type = TILED_FOR;
+  e->tiled_for.row = row;
+  e->tiled_for.from = from;
+  e->tiled_for.to = to;
+  e->tiled_for.col = col;
+  e->tiled_for.col_from = col_from;
+  e->tiled_for.col_to = col_to;
+  e->tiled_for.tile = tile;
+  e->tiled_for.body = body;
+
+  return e;
+}
+
+
+// -----------------------------------------------------------
+
+// auxiliary function to count the number of expressions in a list
+int vect_len(struct expr_vect *vect) {
+  int len = 0;
+  while(vect != NULL) {
+    ++len;
+    vect = vect->next_expr;
+  }
+  return len;
+}
+
+// -----------------------------------------------------------
+
+static uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+  // FNV-1a over the 8 bytes of v
+  for (int i = 0; i < 8; ++i) {
+    h ^= (v >> (i * 8)) & 0xff;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint64_t hash_string(uint64_t h, const char *s)
+{
+  for (; *s != '\0'; ++s) {
+    h ^= (unsigned char)*s;
+    h *= 1099511628211ULL;
+  }
+  return hash_mix(h, 0);
+}
+
+static uint64_t hash_vect(uint64_t h, struct expr_vect *ve)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    h = hash_expr(h, ve->curr_expr);
+  // terminate the list, so that nested lists cannot be confused
+  return hash_mix(h, -1);
+}
+
+uint64_t hash_fun_def(uint64_t h, struct fun_def *f)
+{
+  h = hash_string(h, symbol_name(f->ident));
+  h = hash_vect(h, f->params);
+  h = hash_string(h, symbol_name(f->ret_type_ident));
+  return hash_expr(h, f->body);
+}
+
+// identifiers are hashed by name: symbols depend on the order of interning
+uint64_t hash_expr(uint64_t h, struct expr *e)
+{
+  h = hash_mix(h, e->type);
+
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+    return hash_mix(h, e->value);
+
+  case IDENT:
+    return hash_string(h, symbol_name(e->ident));
+
+  case CALL: {
+    // a call depends on the definition of the function, except for the
+    // recursive calls of a function being defined
+    struct fun_def *f = lookup_function(e->call.ident);
+    h = hash_string(h, symbol_name(e->call.ident));
+    if (f != NULL)
+      h = hash_mix(h, f->hash);
+    return hash_vect(h, e->call.args);
+  }
+
+  case PARAM:
+    h = hash_string(h, symbol_name(e->param.ident));
+    return hash_string(h, symbol_name(e->param.type_ident));
+
+  case LET:
+  case VAR:
+    h = hash_string(h, symbol_name(e->let.ident));
+    h = hash_expr(h, e->let.expr);
+    return hash_expr(h, e->let.body);
+
+  case ASSIGN:
+    h = hash_string(h, symbol_name(e->assign.ident));
+    return hash_expr(h, e->assign.expr);
+
+  case IF:
+    h = hash_expr(h, e->if_expr.cond);
+    h = hash_expr(h, e->if_expr.e_true);
+    return hash_expr(h, e->if_expr.e_false);
+
+  case WHILE:
+    h = hash_expr(h, e->while_expr.cond);
+    return hash_expr(h, e->while_expr.body);
+
+  case UN_OP:
+    h = hash_mix(h, e->unop.op);
+    return hash_expr(h, e->unop.expr);
+
+  case BIN_OP:
+    h = hash_mix(h, e->binop.op);
+    h = hash_expr(h, e->binop.lhs);
+    return hash_expr(h, e->binop.rhs);
+
+  case VECTOR:
+  case SEQ:
+    return hash_vect(h, e->vect);
+
+  case VECTOR_ACCESS_OP:
+    h = hash_expr(h, e->vect_access.base);
+    h = hash_expr(h, e->vect_access.offset);
+    return e->vect_access.col != NULL ? hash_expr(h, e->vect_access.col) : h;
+
+  case VECTOR_UPDATE_OP:
+    h = hash_expr(h, e->vect_update.base);
+    h = hash_expr(h, e->vect_update.offset);
+    if (e->vect_update.col != NULL)
+      h = hash_expr(h, e->vect_update.col);
+    return hash_expr(h, e->vect_update.rhs);
+
+  case SUGARED_VECTOR_BUILD_OP:
+    h = hash_vect(h, e->vect_build.sample);
+    return hash_expr(h, e->vect_build.len);
+
+  case PARALLEL_FOR:
+    h = hash_string(h, symbol_name(e->par_for.ident));
+    h = hash_mix(h, e->par_for.op);
+    h = hash_expr(h, e->par_for.from);
+    h = hash_expr(h, e->par_for.to);
+    return hash_expr(h, e->par_for.body);
+
+  case TILED_FOR:
+    h = hash_string(h, symbol_name(e->tiled_for.row));
+    h = hash_string(h, symbol_name(e->tiled_for.col));
+    h = hash_expr(h, e->tiled_for.from);
+    h = hash_expr(h, e->tiled_for.to);
+    h = hash_expr(h, e->tiled_for.col_from);
+    h = hash_expr(h, e->tiled_for.col_to);
+    if (e->tiled_for.tile != NULL)
+      h = hash_expr(h, e->tiled_for.tile);
+    return hash_expr(h, e->tiled_for.body);
+  }
+  return h;
+}
+
+// create a stack slot in the entry basic block of the current function, so
+// that it is allocated once per call whatever loop it is used in, and leave
+// the builder where it was; a transient vector built in a loop body reuses
+// its slot at every iteration
+static LLVMValueRef build_entry_alloca(LLVMBuilderRef builder, LLVMTypeRef type, const char *name)
+{
+  LLVMBasicBlockRef current_bb = LLVMGetInsertBlock(builder);
+  LLVMValueRef f = LLVMGetBasicBlockParent(current_bb);
+  LLVMBasicBlockRef entry_bb = LLVMGetEntryBasicBlock(f);
+  LLVMValueRef first = LLVMGetFirstInstruction(entry_bb);
+
+  if (first != NULL)
+    LLVMPositionBuilder(builder, entry_bb, first);
+  else
+    LLVMPositionBuilderAtEnd(builder, entry_bb);
+  LLVMValueRef pointer = LLVMBuildAlloca(builder, type, name);
+
+  // return to the old builder position and continue from there
+  LLVMPositionBuilderAtEnd(builder, current_bb);
+  return pointer;
+}
+
+// address of the element idx of a vector, be it an array on the stack
+// ([N x T]*) or a runtime vector ({ i32, [0 x T] }*)
+static LLVMValueRef vect_elem_ptr(LLVMBuilderRef builder, LLVMValueRef vect, LLVMValueRef idx)
+{
+  LLVMTypeRef vect_type = LLVMGetElementType(LLVMTypeOf(vect));
+  LLVMContextRef ctx = LLVMGetTypeContext(vect_type);
+  LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0);
+
+  if (LLVMGetTypeKind(vect_type) == LLVMStructTypeKind) {
+    LLVMValueRef idxs[] = { zero, LLVMConstInt(LLVMInt32TypeInContext(ctx), 1, 0), idx };
+    return LLVMBuildInBoundsGEP2(builder, vect_type, vect, idxs, 3, "");
+  } else {
+    LLVMValueRef idxs[] = { zero, idx };
+    return LLVMBuildInBoundsGEP2(builder, vect_type, vect, idxs, 2, "");
+  }
+}
+
+// number of elements of a vector, as an i32 value
+static LLVMValueRef vect_length(LLVMBuilderRef builder, LLVMValueRef vect)
+{
+  LLVMTypeRef vect_type = LLVMGetElementType(LLVMTypeOf(vect));
+
+  if (LLVMGetTypeKind(vect_type) == LLVMStructTypeKind)
+    return LLVMBuildLoad(builder, LLVMBuildStructGEP(builder, vect, 0, ""), "len");
+  return LLVMConstInt(LLVMInt32TypeInContext(LLVMGetTypeContext(vect_type)), LLVMGetArrayLength(vect_type), 0);
+}
+
+// address of the element row, col of a matrix with rows of cols elements:
+// the elements are seen as an array of [cols x T] rows, so that LLVM gets
+// both indices
+static LLVMValueRef matrix_elem_ptr( LLVMBuilderRef builder
+                                   , LLVMValueRef vect
+                                   , LLVMValueRef row
+                                   , LLVMValueRef col
+                                   , int cols)
+{
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(row));
+  LLVMValueRef first = vect_elem_ptr(builder, vect, LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0));
+  LLVMTypeRef row_type = LLVMArrayType(LLVMGetElementType(LLVMTypeOf(first)), cols);
+  LLVMValueRef rows = LLVMBuildBitCast(builder, first, LLVMPointerType(row_type, 0), "");
+  LLVMValueRef idxs[] = { row, col };
+  return LLVMBuildInBoundsGEP2(builder, row_type, rows, idxs, 2, "");
+}
+
+// trap to the runtime function fail, called with args, unless ok holds
+static void build_check( LLVMBuilderRef builder
+                       , LLVMModuleRef module
+                       , LLVMValueRef ok
+                       , const char *fail
+                       , LLVMValueRef *args
+                       , unsigned n_args)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+  LLVMBasicBlockRef ok_bb   = LLVMAppendBasicBlockInContext(ctx, f, "in_bounds");
+  LLVMBasicBlockRef fail_bb = LLVMAppendBasicBlockInContext(ctx, f, "out_of_bounds");
+  LLVMBuildCondBr(builder, ok, ok_bb, fail_bb);
+
+  LLVMPositionBuilderAtEnd(builder, fail_bb);
+  LLVMBuildCall(builder, LLVMGetNamedFunction(module, fail), args, n_args, "");
+  LLVMBuildUnreachable(builder);
+
+  LLVMPositionBuilderAtEnd(builder, ok_bb);
+}
+
+// trap to the runtime unless 0 <= idx < length of vect
+static void build_bounds_check( LLVMBuilderRef builder
+                              , LLVMModuleRef module
+                              , LLVMValueRef vect
+                              , LLVMValueRef idx)
+{
+  // a negative index is a large unsigned one
+  LLVMValueRef len = vect_length(builder, vect);
+  LLVMValueRef args[] = { idx, len };
+  build_check(builder, module, LLVMBuildICmp(builder, LLVMIntULT, idx, len, ""), "vect_index_error", args, 2);
+}
+
+// the same for the element row, col of a matrix with rows of cols elements
+static void build_matrix_bounds_check( LLVMBuilderRef builder
+                                     , LLVMModuleRef module
+                                     , LLVMValueRef vect
+                                     , LLVMValueRef row
+                                     , LLVMValueRef col
+                                     , int cols)
+{
+  LLVMValueRef n_cols = LLVMConstInt(LLVMTypeOf(row), cols, 0);
+  LLVMValueRef n_rows = LLVMBuildUDiv(builder, vect_length(builder, vect), n_cols, "");
+  LLVMValueRef ok = LLVMBuildAnd(builder, LLVMBuildICmp(builder, LLVMIntULT, row, n_rows, ""),
+                                 LLVMBuildICmp(builder, LLVMIntULT, col, n_cols, ""), "");
+  LLVMValueRef args[] = { row, col, n_rows, n_cols };
+  build_check(builder, module, ok, "matrix_index_error", args, 4);
+}
+
+// copy the elements of vect, a row of cols elements, to the row starting
+// at the element idx of the matrix dst
+static void build_row_copy( LLVMBuilderRef builder
+                          , LLVMValueRef dst
+                          , LLVMValueRef idx
+                          , LLVMValueRef vect
+                          , struct expr *row)
+{
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(idx));
+  LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0);
+  unsigned size = row->len * (row->elem_vtype == INTEGER ? 4 : 1);
+  LLVMBuildMemCpy(builder, vect_elem_ptr(builder, dst, idx), 1, vect_elem_ptr(builder, vect, zero), 1,
+                  LLVMConstInt(LLVMInt32TypeInContext(ctx), size, 0));
+}
+
+// emit a loop running i from 0 to n - 1, in which body_fn emits the body;
+// leaves the builder after the loop
+static void build_counted_loop( LLVMBuilderRef builder
+                              , LLVMValueRef n
+                              , void (*body_fn)(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+                              , void *data)
+{
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(n));
+  LLVMBasicBlockRef pre_bb = LLVMGetInsertBlock(builder);
+  LLVMValueRef f = LLVMGetBasicBlockParent(pre_bb);
+  LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(ctx, f, "loop_cond");
+  LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(ctx, f, "loop_body");
+  LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(ctx, f, "loop_cont");
+
+  LLVMBuildBr(builder, cond_bb);
+
+  LLVMPositionBuilderAtEnd(builder, cond_bb);
+  LLVMValueRef i = LLVMBuildPhi(builder, LLVMInt32TypeInContext(ctx), "i");
+  LLVMValueRef cond = LLVMBuildICmp(builder, LLVMIntSLT, i, n, "");
+  LLVMBuildCondBr(builder, cond, body_bb, cont_bb);
+
+  LLVMPositionBuilderAtEnd(builder, body_bb);
+  body_fn(builder, i, data);
+  LLVMValueRef next = LLVMBuildAdd(builder, i, LLVMConstInt(LLVMInt32TypeInContext(ctx), 1, 0), "");
+  LLVMBuildBr(builder, cond_bb);
+
+  LLVMValueRef values[] = { LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0), next };
+  LLVMBasicBlockRef blocks[] = { pre_bb, LLVMGetInsertBlock(builder) };
+  LLVMAddIncoming(i, values, blocks, 2);
+
+  LLVMPositionBuilderAtEnd(builder, cont_bb);
+}
+
+struct fill_loop {
+  struct expr *e;
+  struct env *env;
+  LLVMModuleRef module;
+  LLVMValueRef vect;
+};
+
+// one round of the sample of [sample] times n: the elements of round i go
+// from i * |sample| on, or its rows from i * |sample| * cols on
+static void build_fill_body(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+{
+  struct fill_loop *fill = data;
+  LLVMContextRef ctx = LLVMGetModuleContext(fill->module);
+  struct expr_vect *ve = fill->e->vect_build.sample;
+  int width = fill->e->cols > 0 ? fill->e->cols : 1;
+  int sample_len = vect_len(ve) * width;
+
+  LLVMValueRef base = LLVMBuildMul(builder, i, LLVMConstInt(LLVMInt32TypeInContext(ctx), sample_len, 0), "");
+  for (int k = 0; ve != NULL; ve = ve->next_expr, k += width) {
+    LLVMValueRef val = codegen_expr(ve->curr_expr, fill->env, fill->module, builder);
+    LLVMValueRef idx = LLVMBuildAdd(builder, base, LLVMConstInt(LLVMInt32TypeInContext(ctx), k, 0), "");
+    if (fill->e->cols > 0)
+      build_row_copy(builder, fill->vect, idx, val, ve->curr_expr);
+    else
+      LLVMBuildStore(builder, val, vect_elem_ptr(builder, fill->vect, idx));
+  }
+}
+
+// the constant value of the type of x, an integer or an LLVM vector of them
+static LLVMValueRef const_like(LLVMValueRef x, int value)
+{
+  LLVMTypeRef type = LLVMTypeOf(x);
+  if (LLVMGetTypeKind(type) != LLVMVectorTypeKind)
+    return LLVMConstInt(type, value, 1);
+
+  unsigned n = LLVMGetVectorSize(type);
+  LLVMValueRef *lanes = malloc(sizeof(LLVMValueRef) * n);
+  for (unsigned i = 0; i < n; ++i)
+    lanes[i] = LLVMConstInt(LLVMGetElementType(type), value, 1);
+  LLVMValueRef splat = LLVMConstVector(lanes, n);
+  free(lanes);
+  return splat;
+}
+
+// sdiv and urem trap on a 0 divisor, and sdiv on INT_MIN / -1: x / 0 is 0,
+// x mod 0 is x and INT_MIN / -1 wraps around to INT_MIN, by dividing by 1
+// instead. A literal divisor needs no guard
+static int safe_divisor(LLVMValueRef rhs)
+{
+  return LLVMIsAConstantInt(rhs) != NULL &&
+    LLVMConstIntGetSExtValue(rhs) != 0 && LLVMConstIntGetSExtValue(rhs) != -1;
+}
+
+static LLVMValueRef build_div(LLVMBuilderRef builder, LLVMValueRef lhs, LLVMValueRef rhs)
+{
+  if (safe_divisor(rhs))
+    return LLVMBuildSDiv(builder, lhs, rhs, "");
+
+  LLVMValueRef zero = LLVMBuildICmp(builder, LLVMIntEQ, rhs, const_like(rhs, 0), "");
+  LLVMValueRef overflow = LLVMBuildAnd(builder,
+    LLVMBuildICmp(builder, LLVMIntEQ, lhs, const_like(lhs, INT_MIN), ""),
+    LLVMBuildICmp(builder, LLVMIntEQ, rhs, const_like(rhs, -1), ""), "");
+  LLVMValueRef divisor = LLVMBuildSelect(builder, LLVMBuildOr(builder, zero, overflow, ""),
+                                         const_like(rhs, 1), rhs, "");
+  LLVMValueRef quotient = LLVMBuildSDiv(builder, lhs, divisor, "");
+  return LLVMBuildSelect(builder, zero, const_like(quotient, 0), quotient, "");
+}
+
+static LLVMValueRef build_mod(LLVMBuilderRef builder, LLVMValueRef lhs, LLVMValueRef rhs)
+{
+  if (safe_divisor(rhs))
+    return LLVMBuildURem(builder, lhs, rhs, "");
+
+  LLVMValueRef zero = LLVMBuildICmp(builder, LLVMIntEQ, rhs, const_like(rhs, 0), "");
+  LLVMValueRef divisor = LLVMBuildSelect(builder, zero, const_like(rhs, 1), rhs, "");
+  return LLVMBuildSelect(builder, zero, lhs, LLVMBuildURem(builder, lhs, divisor, ""), "");
+}
+
+// arithmetic and comparisons, on scalars as well as on LLVM vectors
+static LLVMValueRef build_binop(LLVMBuilderRef builder, int op, LLVMValueRef lhs, LLVMValueRef rhs)
+{
+  switch (op)
+  {
+  case '+': return LLVMBuildAdd(builder, lhs, rhs, "");
+  case '-': return LLVMBuildSub(builder, lhs, rhs, "");
+  case '*': return LLVMBuildMul(builder, lhs, rhs, "");
+  case '/': return build_div(builder, lhs, rhs);
+  case MOD: return build_mod(builder, lhs, rhs);
+  case SHL_OP: return LLVMBuildShl(builder, lhs, rhs, "");
+  case '<': return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "");
+  case '>': return LLVMBuildICmp(builder, LLVMIntSGT, lhs, rhs, "");
+  case LE : return LLVMBuildICmp(builder, LLVMIntSLE, lhs, rhs, "");
+  case GE : return LLVMBuildICmp(builder, LLVMIntSGE, lhs, rhs, "");
+  case '=': return LLVMBuildICmp(builder, LLVMIntEQ, lhs, rhs, "");
+  case NE : return LLVMBuildICmp(builder, LLVMIntNE, lhs, rhs, "");
+  case AND: return LLVMBuildAnd(builder, lhs, rhs, "");
+  case OR : return LLVMBuildOr(builder, lhs, rhs, "");
+  default: return NULL;
+  }
+}
+
+// the largest vector, in bytes, given a stack slot: the stack of a thread
+// is a few megabytes, and one of the pool threads running a parallel for
+// has far less left
+#define STACK_VECT_MAX (16 * 1024)
+
+// storage for the vector e of n elements. A transient vector, see
+// mark_transient, of length known at compile time and of at most
+// STACK_VECT_MAX bytes lives in a stack slot that every evaluation reuses;
+// any other one is allocated by the runtime at every evaluation, as an array
+// of its elements when its length is known
+static LLVMValueRef build_vect_alloc( struct expr *e
+                                    , LLVMValueRef n
+                                    , LLVMModuleRef module
+                                    , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+  LLVMTypeRef array_type = LLVMArrayType(llvm_scalar_type(ctx, e->elem_vtype), e->len >= 0 ? e->len : 0);
+  int elem_size = e->elem_vtype == INTEGER ? 4 : 1;
+  if (e->len >= 0 && e->transient && (size_t)e->len * elem_size <= STACK_VECT_MAX)
+    return build_entry_alloca(builder, array_type, "");
+
+  if (e->len >= 0)
+    n = LLVMConstInt(i32, e->len, 0);
+  LLVMValueRef args[] = { n, LLVMConstInt(i32, elem_size, 0) };
+  LLVMValueRef raw = LLVMBuildCall(builder, LLVMGetNamedFunction(module, "vect_alloc"), args, 2, "");
+  LLVMValueRef vect = LLVMBuildBitCast(builder, raw, llvm_rt_vect_type(ctx, e->elem_vtype), "");
+  if (e->len < 0)
+    return vect;
+
+  LLVMValueRef idxs[] = { LLVMConstInt(i32, 0, 0), LLVMConstInt(i32, 1, 0) };
+  LLVMValueRef data = LLVMBuildInBoundsGEP2(builder, LLVMGetElementType(LLVMTypeOf(vect)), vect, idxs, 2, "");
+  return LLVMBuildBitCast(builder, data, LLVMPointerType(array_type, 0), "");
+}
+
+// Element-wise operations and reductions handle SIMD_WIDTH elements at a
+// time as an LLVM <SIMD_WIDTH x T> vector, one AVX2 register of i32 that
+// the backend splits in SSE registers when needed, then the remaining
+// elements one by one.
+#define SIMD_WIDTH 8
+
+// pointer to the SIMD_WIDTH elements of vect from idx on, seen as elem_type
+static LLVMValueRef lanes_ptr( LLVMBuilderRef builder
+                             , LLVMValueRef vect
+                             , LLVMValueRef idx
+                             , LLVMTypeRef elem_type)
+{
+  LLVMTypeRef lanes_type = LLVMPointerType(LLVMVectorType(elem_type, SIMD_WIDTH), 0);
+  return LLVMBuildBitCast(builder, vect_elem_ptr(builder, vect, idx), lanes_type, "");
+}
+
+// the elements of vectors are only aligned as their scalar type
+static LLVMValueRef load_lanes(LLVMBuilderRef builder, LLVMValueRef vect, LLVMValueRef idx)
+{
+  LLVMValueRef load = LLVMBuildLoad(builder, lanes_ptr(builder, vect, idx, LLVMInt32TypeInContext(LLVMGetTypeContext(LLVMTypeOf(idx)))), "");
+  LLVMSetAlignment(load, 4);
+  return load;
+}
+
+static LLVMValueRef splat(LLVMBuilderRef builder, LLVMValueRef scalar)
+{
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(scalar));
+  LLVMTypeRef lanes_type = LLVMVectorType(LLVMTypeOf(scalar), SIMD_WIDTH);
+  LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0);
+  LLVMValueRef v = LLVMBuildInsertElement(builder, LLVMGetUndef(lanes_type), scalar, zero, "");
+  LLVMValueRef mask = LLVMConstNull(LLVMVectorType(LLVMInt32TypeInContext(ctx), SIMD_WIDTH));
+  return LLVMBuildShuffleVector(builder, v, LLVMGetUndef(lanes_type), mask, "");
+}
+
+// An expression made of element-wise operations is evaluated in a single
+// loop, without building the intermediate vectors: its leaves (vectors, or
+// ints applied to every element) are evaluated once before the loop, then
+// the tree of operations is emitted in the loop body.
+struct operand {
+  LLVMValueRef vect;
+  LLVMValueRef scalar, lanes;
+};
+
+struct vect_loop {
+  struct expr *root;
+  struct operand *leaves;  // in the order of a left to right walk
+  unsigned n_leaves;
+  LLVMValueRef n;          // the number of elements
+  LLVMValueRef base;       // the first element handled one by one
+  LLVMValueRef dst;        // element-wise operations: the result
+  int op;                  // reductions: how elements are combined
+  LLVMValueRef acc;
+};
+
+static int fusible(struct expr *e)
+{
+  return e->type == BIN_OP && e->vtype == VECT && e->binop.op != CONCAT_KW;
+}
+
+static unsigned count_leaves(struct expr *e)
+{
+  return fusible(e) ? count_leaves(e->binop.lhs) + count_leaves(e->binop.rhs) : 1;
+}
+
+static void codegen_leaves( struct vect_loop *l
+                          , struct expr *e
+                          , struct env *env
+                          , LLVMModuleRef module
+                          , LLVMBuilderRef builder)
+{
+  if (fusible(e)) {
+    codegen_leaves(l, e->binop.lhs, env, module, builder);
+    codegen_leaves(l, e->binop.rhs, env, module, builder);
+    return;
+  }
+
+  struct operand *o = &l->leaves[l->n_leaves++];
+  LLVMValueRef val = codegen_expr(e, env, module, builder);
+  o->vect = e->vtype == VECT ? val : NULL;
+  o->scalar = e->vtype == VECT ? NULL : val;
+  o->lanes = e->vtype == VECT ? NULL : splat(builder, val);
+}
+
+// evaluate the leaves of root and the number of elements to go through: as
+// many as the shortest vector leaf when their lengths are only known at
+// runtime
+static void begin_vect_loop( struct vect_loop *l
+                           , struct expr *root
+                           , struct env *env
+                           , LLVMModuleRef module
+                           , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  l->root = root;
+  l->leaves = malloc(sizeof(struct operand) * count_leaves(root));
+  l->n_leaves = 0;
+  codegen_leaves(l, root, env, module, builder);
+
+  if (root->len >= 0) {
+    l->n = LLVMConstInt(LLVMInt32TypeInContext(ctx), root->len, 0);
+  } else {
+    l->n = NULL;
+    for (unsigned k = 0; k < l->n_leaves; ++k) {
+      if (l->leaves[k].vect == NULL)
+        continue;
+      LLVMValueRef n = vect_length(builder, l->leaves[k].vect);
+      l->n = l->n == NULL ? n
+        : LLVMBuildSelect(builder, LLVMBuildICmp(builder, LLVMIntSLT, n, l->n, ""), n, l->n, "");
+    }
+  }
+
+  LLVMValueRef width = LLVMConstInt(LLVMInt32TypeInContext(ctx), SIMD_WIDTH, 0);
+  l->base = LLVMBuildMul(builder, LLVMBuildUDiv(builder, l->n, width, ""), width, "");
+}
+
+// go through the elements SIMD_WIDTH at a time, then one by one
+static void build_vect_loop( LLVMBuilderRef builder
+                           , struct vect_loop *l
+                           , void (*lanes_fn)(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+                           , void (*rest_fn)(LLVMBuilderRef builder, LLVMValueRef i, void *data))
+{
+  LLVMValueRef n_lanes = LLVMBuildUDiv(builder, l->n, LLVMConstInt(LLVMTypeOf(l->n), SIMD_WIDTH, 0), "");
+  build_counted_loop(builder, n_lanes, lanes_fn, l);
+  build_counted_loop(builder, LLVMBuildSub(builder, l->n, l->base, ""), rest_fn, l);
+  free(l->leaves);
+}
+
+// the value of e at idx, or at the SIMD_WIDTH elements from idx on
+static LLVMValueRef build_fused( LLVMBuilderRef builder
+                               , struct expr *e
+                               , struct operand **leaf
+                               , LLVMValueRef idx
+                               , int lanes)
+{
+  if (!fusible(e)) {
+    struct operand *o = (*leaf)++;
+    if (o->vect == NULL)
+      return lanes ? o->lanes : o->scalar;
+    if (lanes)
+      return load_lanes(builder, o->vect, idx);
+    return LLVMBuildLoad(builder, vect_elem_ptr(builder, o->vect, idx), "");
+  }
+
+  LLVMValueRef lhs = build_fused(builder, e->binop.lhs, leaf, idx, lanes);
+  LLVMValueRef rhs = build_fused(builder, e->binop.rhs, leaf, idx, lanes);
+  return build_binop(builder, e->binop.op, lhs, rhs);
+}
+
+static void build_elementwise_lanes(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+{
+  struct vect_loop *l = data;
+  struct operand *leaf = l->leaves;
+  LLVMValueRef idx = LLVMBuildMul(builder, i, LLVMConstInt(LLVMTypeOf(i), SIMD_WIDTH, 0), "");
+  LLVMValueRef res = build_fused(builder, l->root, &leaf, idx, 1);
+  LLVMTypeRef elem_type = LLVMGetElementType(LLVMTypeOf(res));
+
+  // a <N x i1> is stored as a bitmask: widen the lanes to the byte each
+  // bool takes in a vector
+  if (LLVMGetIntTypeWidth(elem_type) == 1) {
+    res = LLVMBuildZExt(builder, res, LLVMVectorType(LLVMInt8TypeInContext(LLVMGetTypeContext(elem_type)), SIMD_WIDTH), "");
+    elem_type = LLVMInt8TypeInContext(LLVMGetTypeContext(elem_type));
+  }
+  LLVMValueRef store = LLVMBuildStore(builder, res, lanes_ptr(builder, l->dst, idx, elem_type));
+  LLVMSetAlignment(store, LLVMGetIntTypeWidth(elem_type) / 8);
+}
+
+static void build_elementwise_rest(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+{
+  struct vect_loop *l = data;
+  struct operand *leaf = l->leaves;
+  LLVMValueRef idx = LLVMBuildAdd(builder, l->base, i, "");
+  LLVMBuildStore(builder, build_fused(builder, l->root, &leaf, idx, 0), vect_elem_ptr(builder, l->dst, idx));
+}
+
+static LLVMValueRef codegen_elementwise( struct expr *e
+                                       , struct env *env
+                                       , LLVMModuleRef module
+                                       , LLVMBuilderRef builder)
+{
+  struct vect_loop l;
+  begin_vect_loop(&l, e, env, module, builder);
+  l.dst = build_vect_alloc(e, l.n, module, builder);
+  build_vect_loop(builder, &l, build_elementwise_lanes, build_elementwise_rest);
+  return l.dst;
+}
+
+// the value of a reduction of no element
+static int reduction_identity(int op)
+{
+  return op == '+' ? 0 : op == '<' ? INT_MAX : INT_MIN;
+}
+
+// the reductions combine with +, or with a select for min ('<') and max ('>')
+static LLVMValueRef build_combine(LLVMBuilderRef builder, int op, LLVMValueRef acc, LLVMValueRef x)
+{
+  if (op == '+')
+    return LLVMBuildAdd(builder, acc, x, "");
+  return LLVMBuildSelect(builder, build_binop(builder, op, acc, x), acc, x, "");
+}
+
+static void build_reduction_lanes(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+{
+  struct vect_loop *l = data;
+  struct operand *leaf = l->leaves;
+  LLVMValueRef idx = LLVMBuildMul(builder, i, LLVMConstInt(LLVMTypeOf(i), SIMD_WIDTH, 0), "");
+  LLVMValueRef acc = LLVMBuildLoad(builder, l->acc, "");
+  LLVMBuildStore(builder, build_combine(builder, l->op, acc, build_fused(builder, l->root, &leaf, idx, 1)), l->acc);
+}
+
+static void build_reduction_rest(LLVMBuilderRef builder, LLVMValueRef i, void *data)
+{
+  struct vect_loop *l = data;
+  struct operand *leaf = l->leaves;
+  LLVMValueRef idx = LLVMBuildAdd(builder, l->base, i, "");
+  LLVMValueRef acc = LLVMBuildLoad(builder, l->acc, "");
+  LLVMBuildStore(builder, build_combine(builder, l->op, acc, build_fused(builder, l->root, &leaf, idx, 0)), l->acc);
+}
+
+// sum, min and max of an int vector; those of an empty vector are 0,
+// INT_MAX and INT_MIN
+static LLVMValueRef codegen_reduction( struct expr *e
+                                     , struct env *env
+                                     , LLVMModuleRef module
+                                     , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  const char *name = symbol_name(e->call.ident);
+  struct vect_loop l;
+  l.op = strcmp(name, "sum") == 0 ? '+' : strcmp(name, "min") == 0 ? '<' : '>';
+  int identity = reduction_identity(l.op);
+
+  begin_vect_loop(&l, e->call.args->curr_expr, env, module, builder);
+
+  // one partial result per lane, combined together before the elements
+  // handled one by one
+  LLVMValueRef lanes_acc = build_entry_alloca(builder, LLVMVectorType(LLVMInt32TypeInContext(ctx), SIMD_WIDTH), "acc");
+  LLVMValueRef acc = build_entry_alloca(builder, LLVMInt32TypeInContext(ctx), "acc");
+  LLVMBuildStore(builder, splat(builder, LLVMConstInt(LLVMInt32TypeInContext(ctx), identity, 1)), lanes_acc);
+
+  struct vect_loop lanes = l;
+  lanes.acc = lanes_acc;
+  LLVMValueRef n_lanes = LLVMBuildUDiv(builder, l.n, LLVMConstInt(LLVMInt32TypeInContext(ctx), SIMD_WIDTH, 0), "");
+  build_counted_loop(builder, n_lanes, build_reduction_lanes, &lanes);
+
+  LLVMValueRef partial = LLVMBuildLoad(builder, lanes_acc, "");
+  LLVMValueRef val = LLVMBuildExtractElement(builder, partial, LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0), "");
+  for (int k = 1; k < SIMD_WIDTH; ++k) {
+    LLVMValueRef x = LLVMBuildExtractElement(builder, partial, LLVMConstInt(LLVMInt32TypeInContext(ctx), k, 0), "");
+    val = build_combine(builder, l.op, val, x);
+  }
+  LLVMBuildStore(builder, val, acc);
+
+  l.acc = acc;
+  build_counted_loop(builder, LLVMBuildSub(builder, l.n, l.base, ""), build_reduction_rest, &l);
+  free(l.leaves);
+  return LLVMBuildLoad(builder, acc, "");
+}
+
+// the function of fun in module, emitted the first time it is called from
+// the module: every module gets its own copy, with internal linkage, that
+// the optimiser is free to inline
+static LLVMValueRef emit_function(struct fun_def *fun, LLVMModuleRef module)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  const char *fun_name = symbol_name(fun->ident);
+  char *name = malloc(strlen(fun_name) + 5);
+  sprintf(name, "fun.%s", fun_name);
+  LLVMValueRef f = LLVMGetNamedFunction(module, name);
+  if (f != NULL) {
+    free(name);
+    return f;
+  }
+
+  unsigned n_params = vect_len(fun->params);
+  LLVMTypeRef *param_types = malloc(sizeof(LLVMTypeRef) * (n_params + 1));
+  struct expr_vect *p = fun->params;
+  for (unsigned i = 0; i < n_params; ++i, p = p->next_expr)
+    param_types[i] = llvm_type_of(ctx, p->curr_expr);
+  LLVMTypeRef ret_type = fun->ret == UNIT ? LLVMVoidTypeInContext(ctx) : llvm_scalar_type(ctx, fun->ret);
+
+  // declared before its body is generated, for the recursive calls
+  f = LLVMAddFunction(module, name, LLVMFunctionType(ret_type, param_types, n_params, 0));
+  LLVMSetLinkage(f, LLVMInternalLinkage);
+  free(param_types);
+  free(name);
+
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(ctx);
+  LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(ctx, f, "entry"));
+  struct env *env = env_create();
+  p = fun->params;
+  for (unsigned i = 0; i < n_params; ++i, p = p->next_expr)
+    push(env, p->curr_expr->param.ident, LLVMGetParam(f, i));
+
+  LLVMValueRef body = codegen_expr(fun->body, env, module, builder);
+  if (fun->ret == UNIT)
+    LLVMBuildRetVoid(builder);
+  else
+    LLVMBuildRet(builder, body);
+
+  env_dispose(env);
+  LLVMDisposeBuilder(builder);
+  return f;
+}
+
+// a direct call to a user function; the calls in tail position are marked
+// so, for the tail call elimination pass
+static LLVMValueRef codegen_call( struct expr *e
+                                , struct fun_def *fun
+                                , struct env *env
+                                , LLVMModuleRef module
+                                , LLVMBuilderRef builder)
+{
+  unsigned n_args = vect_len(e->call.args);
+  LLVMValueRef *args = malloc(sizeof(LLVMValueRef) * (n_args + 1));
+  struct expr_vect *ve = e->call.args;
+  for (unsigned i = 0; i < n_args; ++i, ve = ve->next_expr)
+    args[i] = codegen_expr(ve->curr_expr, env, module, builder);
+
+  LLVMValueRef call = LLVMBuildCall(builder, emit_function(fun, module), args, n_args, "");
+  if (e->call.tail)
+    LLVMSetTailCall(call, 1);
+  free(args);
+  return call;
+}
+
+// --profile-gen: the code of profile_count, for the branch of e going the
+// outcome way, at the start of the block it leads to. The counters are
+// where the profile keeps them, in the jit's own memory
+static void build_profile_count( LLVMBuilderRef builder
+                               , LLVMModuleRef module
+                               , struct expr *e
+                               , int outcome)
+{
+  if (profile_mode != PROFILE_GEN || e->counts == NULL)
+    return;
+
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+  struct branch_counts *c = e->counts;
+  uint64_t *counters[] = { outcome ? &c->n_true : &c->n_false, &c->flips, &c->last };
+  LLVMValueRef ptrs[3];
+  for (int k = 0; k < 3; ++k)
+    ptrs[k] = LLVMConstIntToPtr(LLVMConstInt(i64, (uintptr_t)counters[k], 0), LLVMPointerType(i64, 0));
+
+  LLVMValueRef one = LLVMConstInt(i64, 1, 0);
+  LLVMValueRef val = LLVMConstInt(i64, outcome, 0);
+  LLVMBuildStore(builder, LLVMBuildAdd(builder, LLVMBuildLoad(builder, ptrs[0], ""), one, ""), ptrs[0]);
+  LLVMValueRef flip = LLVMBuildICmp(builder, LLVMIntNE, LLVMBuildLoad(builder, ptrs[2], ""), val, "");
+  LLVMBuildStore(builder, LLVMBuildAdd(builder, LLVMBuildLoad(builder, ptrs[1], ""),
+                                       LLVMBuildZExt(builder, flip, i64, ""), ""), ptrs[1]);
+  LLVMBuildStore(builder, val, ptrs[2]);
+}
+
+// --profile-use: the weights of the two successors of the conditional
+// branch br of e, from the outcomes of its condition
+static void set_branch_weights(LLVMValueRef br, struct expr *e)
+{
+  if (profile_mode != PROFILE_USE || e->counts == NULL)
+    return;
+
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(br));
+  uint64_t n_true = e->counts->n_true, n_false = e->counts->n_false;
+  while (n_true >= UINT32_MAX || n_false >= UINT32_MAX) {
+    n_true >>= 1;
+    n_false >>= 1;
+  }
+  LLVMValueRef weights[] = {
+    LLVMMDStringInContext(ctx, "branch_weights", 14),
+    LLVMConstInt(LLVMInt32TypeInContext(ctx), n_true + 1, 0),
+    LLVMConstInt(LLVMInt32TypeInContext(ctx), n_false + 1, 0),
+  };
+  LLVMSetMetadata(br, LLVMGetMDKindIDInContext(ctx, "prof", 4), LLVMMDNodeInContext(ctx, weights, 3));
+}
+
+// --profile-use: a loop going round only a few times per run is not worth
+// unrolling nor vectorising; latch is the branch back to its head
+static void set_loop_metadata(LLVMValueRef latch, struct expr *e)
+{
+  if (profile_mode != PROFILE_USE || e->counts == NULL)
+    return;
+  struct branch_counts *c = e->counts;
+  if (c->n_false == 0 || c->n_true >= PROFILE_SHORT_TRIPS * c->n_false)
+    return;
+
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(latch));
+  LLVMValueRef unroll[] = { LLVMMDStringInContext(ctx, "llvm.loop.unroll.disable", 24) };
+  LLVMValueRef vectorize[] = {
+    LLVMMDStringInContext(ctx, "llvm.loop.vectorize.enable", 26),
+    LLVMConstInt(LLVMInt1TypeInContext(ctx), 0, 0),
+  };
+
+  // the first operand of a loop id is the loop id itself
+  LLVMMetadataRef self = LLVMTemporaryMDNode(ctx, NULL, 0);
+  LLVMValueRef ops[] = {
+    LLVMMetadataAsValue(ctx, self),
+    LLVMMDNodeInContext(ctx, unroll, 1),
+    LLVMMDNodeInContext(ctx, vectorize, 2),
+  };
+  LLVMValueRef loop_id = LLVMMDNodeInContext(ctx, ops, 3);
+  LLVMMetadataReplaceAllUsesWith(self, LLVMValueAsMetadata(loop_id));
+  LLVMSetMetadata(latch, LLVMGetMDKindIDInContext(ctx, "llvm.loop", 9), loop_id);
+}
+
+// the number of nodes of e if it can be evaluated whether it is needed or
+// not: cheap, without effects and without traps; -1 otherwise
+static int speculatable_size(struct expr *e)
+{
+  if (e->vtype == VECT)
+    return -1;
+
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+  case IDENT:
+    return 1;
+
+  case UN_OP: {
+    int n = speculatable_size(e->unop.expr);
+    return n < 0 ? -1 : n + 1;
+  }
+
+  case BIN_OP: {
+    // a division is not cheap, even less with the guards of build_div
+    int op = e->binop.op;
+    struct expr *rhs = e->binop.rhs;
+    int literal_divisor = rhs->type == LITERAL && rhs->value != 0 && rhs->value != -1;
+    if (((op == '/' || op == MOD) && !literal_divisor) || op == AND_SC || op == OR_SC)
+      return -1;
+    int l = speculatable_size(e->binop.lhs);
+    int r = speculatable_size(e->binop.rhs);
+    return l < 0 || r < 0 ? -1 : l + r + 1;
+  }
+
+  default:
+    return -1;
+  }
+}
+
+// --profile-use: an if whose condition keeps changing, with short arms,
+// costs less evaluating both and selecting one than mispredicting
+static int lower_to_select(struct expr *e)
+{
+  if (profile_mode != PROFILE_USE || e->counts == NULL || (e->vtype != INTEGER && e->vtype != BOOLEAN))
+    return 0;
+  struct branch_counts *c = e->counts;
+  uint64_t n = c->n_true + c->n_false;
+  if (n == 0 || c->flips * PROFILE_FLIP_RATIO < n)
+    return 0;
+
+  int n_true = speculatable_size(e->if_expr.e_true);
+  int n_false = speculatable_size(e->if_expr.e_false);
+  return n_true >= 0 && n_false >= 0 && n_true <= PROFILE_SELECT_NODES && n_false <= PROFILE_SELECT_NODES;
+}
+
+// the value of a variable bound to val in the environment: the value
+// itself, or what its var cell holds
+static LLVMValueRef build_ident(LLVMBuilderRef builder, LLVMValueRef val)
+{
+  LLVMTypeRef  val_type  = LLVMTypeOf(val);
+  LLVMTypeKind val_kind  = LLVMGetTypeKind(val_type);
+
+  // act on val depending on its kind: literal or pointer
+  if (val_kind == LLVMPointerTypeKind) {
+
+    LLVMTypeRef  elem_type = LLVMGetElementType(val_type);
+    LLVMTypeKind elem_kind = LLVMGetTypeKind(elem_type);
+    // in the case of val being a LLVMPointerTypeKind, evaluate it according to its kind ("simple", LLVMArrayTypeKind
+    // or LLVMStructTypeKind for runtime vectors)
+    if(elem_kind == LLVMArrayTypeKind || elem_kind == LLVMStructTypeKind) {
+      // val is a vector => we return it as it is to evaluate it further in the following recursions
+      return val;
+    } else {
+      return LLVMBuildLoad(builder, val, "");
+    }
+  } else {
+    return val;
+  }
+}
+
+// a set of symbols, or a stack of bindings
+struct sym_list {
+  int *syms;
+  unsigned n, cap;
+};
+
+static void sym_push(struct sym_list *l, int sym)
+{
+  if (l->n == l->cap) {
+    l->cap = l->cap ? 2 * l->cap : 8;
+    l->syms = realloc(l->syms, sizeof(int) * l->cap);
+  }
+  l->syms[l->n++] = sym;
+}
+
+static int sym_find(const struct sym_list *l, int sym)
+{
+  for (unsigned k = 0; k < l->n; ++k) {
+    if (l->syms[k] == sym)
+      return 1;
+  }
+  return 0;
+}
+
+// the variables a parallel for body reads from around it, in order of
+// first use: it cannot assign them, see typecheck_expr, so the body gets
+// their values. bound holds the bindings of the body itself, innermost last
+static void capture(struct expr *e, struct sym_list *captured, struct sym_list *bound);
+
+static void capture_vect(struct expr_vect *ve, struct sym_list *captured, struct sym_list *bound)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    capture(ve->curr_expr, captured, bound);
+}
+
+static void capture(struct expr *e, struct sym_list *captured, struct sym_list *bound)
+{
+  switch (e->type) {
+  case IDENT:
+    if (!sym_find(bound, e->ident) && !sym_find(captured, e->ident))
+      sym_push(captured, e->ident);
+    return;
+
+  case ASSIGN:
+    capture(e->assign.expr, captured, bound);
+    return;
+
+  case LET:
+  case VAR:
+    capture(e->let.expr, captured, bound);
+    sym_push(bound, e->let.ident);
+    capture(e->let.body, captured, bound);
+    --bound->n;
+    return;
+
+  case PARALLEL_FOR:
+    capture(e->par_for.from, captured, bound);
+    capture(e->par_for.to, captured, bound);
+    sym_push(bound, e->par_for.ident);
+    capture(e->par_for.body, captured, bound);
+    --bound->n;
+    return;
+
+  case TILED_FOR:
+    capture(e->tiled_for.from, captured, bound);
+    capture(e->tiled_for.to, captured, bound);
+    capture(e->tiled_for.col_from, captured, bound);
+    capture(e->tiled_for.col_to, captured, bound);
+    if (e->tiled_for.tile != NULL)
+      capture(e->tiled_for.tile, captured, bound);
+    sym_push(bound, e->tiled_for.row);
+    sym_push(bound, e->tiled_for.col);
+    capture(e->tiled_for.body, captured, bound);
+    bound->n -= 2;
+    return;
+
+  case IF:
+    capture(e->if_expr.cond, captured, bound);
+    capture(e->if_expr.e_true, captured, bound);
+    capture(e->if_expr.e_false, captured, bound);
+    return;
+
+  case WHILE:
+    capture(e->while_expr.cond, captured, bound);
+    capture(e->while_expr.body, captured, bound);
+    return;
+
+  case CALL:
+    capture_vect(e->call.args, captured, bound);
+    return;
+
+  case UN_OP:
+    capture(e->unop.expr, captured, bound);
+    return;
+
+  case BIN_OP:
+    capture(e->binop.lhs, captured, bound);
+    capture(e->binop.rhs, captured, bound);
+    return;
+
+  case VECTOR:
+  case SEQ:
+    capture_vect(e->vect, captured, bound);
+    return;
+
+  case VECTOR_ACCESS_OP:
+    capture(e->vect_access.base, captured, bound);
+    capture(e->vect_access.offset, captured, bound);
+    if (e->vect_access.col != NULL)
+      capture(e->vect_access.col, captured, bound);
+    return;
+
+  case VECTOR_UPDATE_OP:
+    capture(e->vect_update.base, captured, bound);
+    capture(e->vect_update.offset, captured, bound);
+    if (e->vect_update.col != NULL)
+      capture(e->vect_update.col, captured, bound);
+    capture(e->vect_update.rhs, captured, bound);
+    return;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    capture_vect(e->vect_build.sample, captured, bound);
+    capture(e->vect_build.len, captured, bound);
+    return;
+
+  default:
+    return;
+  }
+}
+
+// parallel for: the body is outlined into a function running the indices
+// lo .. hi - 1, in order, and returning the reduction of their values. It
+// reads the variables it captures from a context the loop fills in on the
+// stack, and par_for or par_reduce, in the runtime, run it on chunks of
+// the indices on their threads
+static LLVMValueRef codegen_parallel_for( struct expr *e
+                                        , struct env *env
+                                        , LLVMModuleRef module
+                                        , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+  LLVMTypeRef ptr_type = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+  int op = e->par_for.op;
+
+  LLVMValueRef from = codegen_expr(e->par_for.from, env, module, builder);
+  LLVMValueRef to = codegen_expr(e->par_for.to, env, module, builder);
+
+  struct sym_list captured = { NULL, 0, 0 }, bound = { NULL, 0, 0 };
+  sym_push(&bound, e->par_for.ident);
+  capture(e->par_for.body, &captured, &bound);
+  free(bound.syms);
+
+  LLVMValueRef *values = malloc(sizeof(LLVMValueRef) * (captured.n + 1));
+  LLVMTypeRef *types = malloc(sizeof(LLVMTypeRef) * (captured.n + 1));
+  for (unsigned k = 0; k < captured.n; ++k) {
+    values[k] = build_ident(builder, resolve(env, captured.syms[k]));
+    types[k] = LLVMTypeOf(values[k]);
+  }
+  LLVMTypeRef context_type = LLVMStructTypeInContext(ctx, types, captured.n, 0);
+  LLVMValueRef context = build_entry_alloca(builder, context_type, "par.ctx");
+  for (unsigned k = 0; k < captured.n; ++k)
+    LLVMBuildStore(builder, values[k], LLVMBuildStructGEP(builder, context, k, ""));
+
+  LLVMTypeRef param_types[] = { ptr_type, i32, i32 };
+  LLVMValueRef fn = LLVMAddFunction(module, "par.body", LLVMFunctionType(i32, param_types, 3, 0));
+  LLVMSetLinkage(fn, LLVMInternalLinkage);
+
+  LLVMBuilderRef fn_builder = LLVMCreateBuilderInContext(ctx);
+  LLVMBasicBlockRef entry_bb = LLVMAppendBasicBlockInContext(ctx, fn, "entry");
+  LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(ctx, fn, "loop_cond");
+  LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(ctx, fn, "loop_body");
+  LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(ctx, fn, "loop_cont");
+  LLVMPositionBuilderAtEnd(fn_builder, entry_bb);
+
+  struct env *fn_env = env_create();
+  LLVMValueRef fn_context = LLVMBuildBitCast(fn_builder, LLVMGetParam(fn, 0), LLVMPointerType(context_type, 0), "");
+  for (unsigned k = 0; k < captured.n; ++k) {
+    LLVMValueRef field = LLVMBuildStructGEP(fn_builder, fn_context, k, "");
+    push(fn_env, captured.syms[k], LLVMBuildLoad(fn_builder, field, symbol_name(captured.syms[k])));
+  }
+  LLVMValueRef acc = NULL;
+  if (op != 0) {
+    acc = LLVMBuildAlloca(fn_builder, i32, "acc");
+    LLVMBuildStore(fn_builder, LLVMConstInt(i32, reduction_identity(op), 1), acc);
+  }
+  LLVMBuildBr(fn_builder, cond_bb);
+
+  // the indices are compared rather than counted: hi - lo may not fit
+  LLVMPositionBuilderAtEnd(fn_builder, cond_bb);
+  LLVMValueRef i = LLVMBuildPhi(fn_builder, i32, symbol_name(e->par_for.ident));
+  LLVMBuildCondBr(fn_builder, LLVMBuildICmp(fn_builder, LLVMIntSLT, i, LLVMGetParam(fn, 2), ""), body_bb, cont_bb);
+
+  LLVMPositionBuilderAtEnd(fn_builder, body_bb);
+  push(fn_env, e->par_for.ident, i);
+  LLVMValueRef val = codegen_expr(e->par_for.body, fn_env, module, fn_builder);
+  pop(fn_env);
+  if (acc != NULL)
+    LLVMBuildStore(fn_builder, build_combine(fn_builder, op, LLVMBuildLoad(fn_builder, acc, ""), val), acc);
+  LLVMValueRef next = LLVMBuildNSWAdd(fn_builder, i, LLVMConstInt(i32, 1, 0), "");
+  LLVMBuildBr(fn_builder, cond_bb);
+
+  LLVMValueRef incoming[] = { LLVMGetParam(fn, 1), next };
+  LLVMBasicBlockRef blocks[] = { entry_bb, LLVMGetInsertBlock(fn_builder) };
+  LLVMAddIncoming(i, incoming, blocks, 2);
+
+  LLVMPositionBuilderAtEnd(fn_builder, cont_bb);
+  LLVMBuildRet(fn_builder, acc != NULL ? LLVMBuildLoad(fn_builder, acc, "") : LLVMConstInt(i32, 0, 0));
+
+  env_dispose(fn_env);
+  LLVMDisposeBuilder(fn_builder);
+  free(values);
+  free(types);
+  free(captured.syms);
+
+  LLVMValueRef args[] = { fn, LLVMBuildBitCast(builder, context, ptr_type, ""), from, to, LLVMConstInt(i32, op, 0) };
+  if (op == 0)
+    return LLVMBuildCall(builder, LLVMGetNamedFunction(module, "par_for"), args, 4, "");
+  return LLVMBuildCall(builder, LLVMGetNamedFunction(module, "par_reduce"), args, 5, "");
+}
+
+// a loop running i from lo while i < hi, whose next i is given at the end
+// of its body
+struct range_loop {
+  LLVMValueRef i;
+  LLVMBasicBlockRef cond_bb, cont_bb;
+};
+
+// leaves the builder in the body of the loop
+static void begin_range_loop( LLVMBuilderRef builder
+                            , struct range_loop *l
+                            , LLVMValueRef lo
+                            , LLVMValueRef hi
+                            , const char *name)
+{
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(lo));
+  LLVMBasicBlockRef pre_bb = LLVMGetInsertBlock(builder);
+  LLVMValueRef f = LLVMGetBasicBlockParent(pre_bb);
+  l->cond_bb = LLVMAppendBasicBlockInContext(ctx, f, "range_cond");
+  LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(ctx, f, "range_body");
+  l->cont_bb = LLVMAppendBasicBlockInContext(ctx, f, "range_cont");
+  LLVMBuildBr(builder, l->cond_bb);
+
+  LLVMPositionBuilderAtEnd(builder, l->cond_bb);
+  l->i = LLVMBuildPhi(builder, LLVMTypeOf(lo), name);
+  LLVMAddIncoming(l->i, &lo, &pre_bb, 1);
+  LLVMBuildCondBr(builder, LLVMBuildICmp(builder, LLVMIntSLT, l->i, hi, ""), body_bb, l->cont_bb);
+
+  LLVMPositionBuilderAtEnd(builder, body_bb);
+}
+
+// leaves the builder after the loop, returns its back edge
+static LLVMValueRef end_range_loop(LLVMBuilderRef builder, struct range_loop *l, LLVMValueRef next)
+{
+  LLVMBasicBlockRef latch_bb = LLVMGetInsertBlock(builder);
+  LLVMValueRef br = LLVMBuildBr(builder, l->cond_bb);
+  LLVMAddIncoming(l->i, &next, &latch_bb, 1);
+  LLVMPositionBuilderAtEnd(builder, l->cont_bb);
+  return br;
+}
+
+// the end of the tile of size tile starting at lo, in a range ending at hi:
+// lo + tile unless it goes past hi (hi - lo fits in an unsigned)
+static LLVMValueRef build_tile_end( LLVMBuilderRef builder
+                                  , LLVMValueRef lo
+                                  , LLVMValueRef hi
+                                  , LLVMValueRef tile)
+{
+  LLVMValueRef fits = LLVMBuildICmp(builder, LLVMIntULT, tile, LLVMBuildSub(builder, hi, lo, ""), "");
+  return LLVMBuildSelect(builder, fits, LLVMBuildAdd(builder, lo, tile, ""), hi, "");
+}
+
+// for row in from..to, col in col_from..col_to tile size: the rows and the
+// columns are cut in tiles of size indices, the tiles are gone through row
+// after row, and so are the indices in a tile. Without a size the whole
+// range is one tile
+static LLVMValueRef codegen_tiled_for( struct expr *e
+                                     , struct env *env
+                                     , LLVMModuleRef module
+                                     , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+  LLVMValueRef one = LLVMConstInt(i32, 1, 0);
+
+  LLVMValueRef from = codegen_expr(e->tiled_for.from, env, module, builder);
+  LLVMValueRef to = codegen_expr(e->tiled_for.to, env, module, builder);
+  LLVMValueRef col_from = codegen_expr(e->tiled_for.col_from, env, module, builder);
+  LLVMValueRef col_to = codegen_expr(e->tiled_for.col_to, env, module, builder);
+  LLVMValueRef tile = LLVMConstInt(i32, INT_MAX, 0);
+  if (e->tiled_for.tile != NULL) {
+    // a tile of less than one index has one
+    tile = codegen_expr(e->tiled_for.tile, env, module, builder);
+    tile = LLVMBuildSelect(builder, LLVMBuildICmp(builder, LLVMIntSLT, tile, one, ""), one, tile, "");
+  }
+
+  struct range_loop row_tiles, col_tiles, rows, cols;
+  begin_range_loop(builder, &row_tiles, from, to, "row_tile");
+  LLVMValueRef row_end = build_tile_end(builder, row_tiles.i, to, tile);
+  begin_range_loop(builder, &col_tiles, col_from, col_to, "col_tile");
+  LLVMValueRef col_end = build_tile_end(builder, col_tiles.i, col_to, tile);
+  begin_range_loop(builder, &rows, row_tiles.i, row_end, symbol_name(e->tiled_for.row));
+  begin_range_loop(builder, &cols, col_tiles.i, col_end, symbol_name(e->tiled_for.col));
+
+  push(env, e->tiled_for.row, rows.i);
+  push(env, e->tiled_for.col, cols.i);
+  codegen_expr(e->tiled_for.body, env, module, builder);
+  pop(env);
+  pop(env);
+
+  end_range_loop(builder, &cols, LLVMBuildNSWAdd(builder, cols.i, one, ""));
+  end_range_loop(builder, &rows, LLVMBuildNSWAdd(builder, rows.i, one, ""));
+  end_range_loop(builder, &col_tiles, col_end);
+  return end_range_loop(builder, &row_tiles, row_end); // a void value
+}
+
+LLVMValueRef codegen_expr(
+  struct expr *e,
+  struct env *env,
+  LLVMModuleRef module,
+  LLVMBuilderRef builder
+)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+
+  switch (e->type) {
+  case LITERAL: {
+    return LLVMConstInt(LLVMInt32TypeInContext(ctx), e->value, 0);
+  }
+
+  case LIT_BOOL: {
+    return LLVMConstInt(LLVMInt1TypeInContext(ctx), e->value, 0);
+  }
+
+  case CALL: {
+    struct fun_def *fun = lookup_function(e->call.ident);
+    if (fun != NULL)
+      return codegen_call(e, fun, env, module, builder);
+
+    // the builtins taking a vector are the reductions, lowered inline, and
+    // print_vec, handed the elements and their number
+    const char *name = symbol_name(e->call.ident);
+    struct expr *arg = e->call.args->curr_expr;
+    if (arg->vtype == VECT && strcmp(name, "print_vec") != 0)
+      return codegen_reduction(e, env, module, builder);
+    if (arg->vtype == VECT) {
+      LLVMValueRef vect = codegen_expr(arg, env, module, builder);
+      LLVMValueRef args[] = {
+        vect_elem_ptr(builder, vect, LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0)),
+        vect_length(builder, vect),
+      };
+      return LLVMBuildCall(builder, LLVMGetNamedFunction(module, name), args, 2, "");
+    }
+
+    LLVMValueRef expr = codegen_expr(arg, env, module, builder);
+    LLVMValueRef args[] = { expr };
+    LLVMValueRef fn = LLVMGetNamedFunction(module, name);
+    if (!fn) {
+      fprintf(stderr, "Undefined function: %s\n", name);
+      return expr;
+    }
+    return LLVMBuildCall(builder, fn, args, 1, "");
+  }
+
+  case LET: {
+    LLVMValueRef expr = codegen_expr(e->let.expr, env, module, builder);
+    push(env, e->let.ident, expr);
+    LLVMValueRef body = codegen_expr(e->let.body, env, module, builder);
+    pop(env);
+    return body;
+  }
+
+  case VAR: {
+    LLVMValueRef expr = codegen_expr(e->var.expr, env, module, builder);
+
+    LLVMValueRef pointer = build_entry_alloca(builder, LLVMTypeOf(expr), symbol_name(e->var.ident));
+    LLVMBuildStore(builder, expr, pointer);
+
+    push(env, e->var.ident, pointer);
+    LLVMValueRef body = codegen_expr(e->var.body, env, module, builder);
+    pop(env);
+    return body;
+  }
+
+  case ASSIGN: {
+    // first evaluate the expression on rhs so that it is not valid the pointer is not resolved in the environment needless
+    LLVMValueRef expr = codegen_expr(e->var.expr, env, module, builder);
+    // 
+    LLVMValueRef pointer = resolve(env, e->assign.ident);
+    return LLVMBuildStore(builder, expr, pointer);
+  }
+
+  case IDENT:
+    // evaluate the ID in the given environment
+    return build_ident(builder, resolve(env, e->ident));
+
+  case IF: {
+    if (lower_to_select(e)) {
+      LLVMValueRef cond = codegen_expr(e->if_expr.cond, env, module, builder);
+      LLVMValueRef then_val = codegen_expr(e->if_expr.e_true, env, module, builder);
+      LLVMValueRef else_val = codegen_expr(e->if_expr.e_false, env, module, builder);
+      return LLVMBuildSelect(builder, cond, then_val, else_val, "");
+    }
+
+    LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+    LLVMBasicBlockRef then_bb = LLVMAppendBasicBlockInContext(ctx, f, "then");
+    LLVMBasicBlockRef else_bb = LLVMAppendBasicBlockInContext(ctx, f, "else");
+    LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(ctx, f, "cont");
+
+    LLVMValueRef cond = codegen_expr(e->if_expr.cond, env, module, builder);
+    set_branch_weights(LLVMBuildCondBr(builder, cond, then_bb, else_bb), e);
+
+    LLVMPositionBuilderAtEnd(builder, then_bb);
+    build_profile_count(builder, module, e, 1);
+    LLVMValueRef then_val = codegen_expr(e->if_expr.e_true, env, module, builder);
+    LLVMBuildBr(builder, cont_bb);
+    then_bb = LLVMGetInsertBlock(builder);
+
+    LLVMPositionBuilderAtEnd(builder, else_bb);
+    build_profile_count(builder, module, e, 0);
+    LLVMValueRef else_val = codegen_expr(e->if_expr.e_false, env, module, builder);
+    LLVMBuildBr(builder, cont_bb);
+    else_bb = LLVMGetInsertBlock(builder);
+
+    LLVMPositionBuilderAtEnd(builder, cont_bb);
+
+    LLVMTypeRef type = LLVMTypeOf(then_val);
+
+    if (LLVMGetTypeKind(type) == LLVMVoidTypeKind) {
+      return then_val; // void value, just return any expr of the appropriate type
+    } 
+    else {
+      LLVMValueRef phi = LLVMBuildPhi(builder, type, "");
+      LLVMValueRef values[] = {then_val, else_val};
+      LLVMBasicBlockRef blocks[] = {then_bb, else_bb};
+      LLVMAddIncoming(phi, values, blocks, 2);
+      return phi;
+    }
+  }
+
+  case WHILE: {
+    LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+    LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(ctx, f, "cond");
+    LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(ctx, f, "body");
+    LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(ctx, f, "cont");
+
+    LLVMValueRef ret = LLVMBuildBr(builder, cond_bb);
+
+    LLVMPositionBuilderAtEnd(builder, cond_bb);
+    LLVMValueRef cond = codegen_expr(e->while_expr.cond, env, module, builder);
+    set_branch_weights(LLVMBuildCondBr(builder, cond, body_bb, cont_bb), e);
+
+    LLVMPositionBuilderAtEnd(builder, body_bb);
+    build_profile_count(builder, module, e, 1);
+    codegen_expr(e->while_expr.body, env, module, builder);
+    set_loop_metadata(LLVMBuildBr(builder, cond_bb), e);
+
+    LLVMPositionBuilderAtEnd(builder, cont_bb);
+    build_profile_count(builder, module, e, 0);
+    return ret; // return a void expression
+  }
+
+  case UN_OP: {
+    LLVMValueRef expr = codegen_expr(e->unop.expr, env, module, builder);
+    return LLVMBuildNot(builder, expr, "");
+  }
+
+  case BIN_OP: {
+    // the idea is to not generate code for righthand side if lefthand side is false
+    if(e->binop.op == AND_SC)
+    {
+      LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+      LLVMBasicBlockRef left_true_bb  = LLVMAppendBasicBlockInContext(ctx, f, "left_true");
+      LLVMBasicBlockRef left_false_bb = LLVMAppendBasicBlockInContext(ctx, f, "left_false");
+      LLVMBasicBlockRef cont_bb       = LLVMAppendBasicBlockInContext(ctx, f, "cont");
+
+      LLVMValueRef left_val = codegen_expr(e->binop.lhs, env, module, builder);
+      // generate a branching point with condition left_val as condition and
+      // left_true and left_false as possible successors blocks
+      set_branch_weights(LLVMBuildCondBr(builder, left_val, left_true_bb, left_false_bb), e);
+
+      // in the case left is true we need to evaluate the right hand side
+      LLVMPositionBuilderAtEnd(builder, left_true_bb);
+      build_profile_count(builder, module, e, 1);
+      LLVMValueRef right_val = LLVMBuildAnd(builder, left_val, codegen_expr(e->binop.rhs, env, module, builder), "");
+      LLVMBuildBr(builder, cont_bb);
+      left_true_bb = LLVMGetInsertBlock(builder);
+
+      // in the case left is flase we can skip the codegeneration for the right hand side
+      LLVMPositionBuilderAtEnd(builder, left_false_bb);
+      build_profile_count(builder, module, e, 0);
+      // skip code generation for right hand side of the expression
+      LLVMBuildBr(builder, cont_bb);
+      left_false_bb = LLVMGetInsertBlock(builder);
+      
+      LLVMPositionBuilderAtEnd(builder, cont_bb);
+
+      // create a phi block to let the two previous block sink in a phi block
+      LLVMValueRef phi = LLVMBuildPhi(builder, LLVMInt1TypeInContext(ctx), "");
+
+      // set edges to the newly created block
+      LLVMValueRef partial_results[] = {left_val, right_val};
+      LLVMBasicBlockRef blocks[]     = {left_true_bb, left_false_bb};
+      LLVMAddIncoming(phi, partial_results, blocks, 2);
+      return phi;
+    }
+    // the idea is to not generate code for righthand side if lefthand side is false
+      else if(e->binop.op == OR_SC)
+    {
+      LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+      LLVMBasicBlockRef left_true_bb  = LLVMAppendBasicBlockInContext(ctx, f, "left_true");
+      LLVMBasicBlockRef left_false_bb = LLVMAppendBasicBlockInContext(ctx, f, "left_false");
+      LLVMBasicBlockRef cont_bb       = LLVMAppendBasicBlockInContext(ctx, f, "cont");
+
+      LLVMValueRef left_val = codegen_expr(e->binop.lhs, env, module, builder);
+      set_branch_weights(LLVMBuildCondBr(builder, left_val, left_true_bb, left_false_bb), e);
+  
+      LLVMPositionBuilderAtEnd(builder, left_false_bb);
+      build_profile_count(builder, module, e, 0);
+      LLVMValueRef right_val = LLVMBuildOr(builder, left_val, codegen_expr(e->binop.rhs, env, module, builder), "");
+      LLVMBuildBr(builder, cont_bb);
+      left_false_bb = LLVMGetInsertBlock(builder);
+
+      LLVMPositionBuilderAtEnd(builder, left_true_bb);
+      build_profile_count(builder, module, e, 1);
+      // skip codegen
+      LLVMBuildBr(builder, cont_bb);
+      left_true_bb = LLVMGetInsertBlock(builder);
+  
+      LLVMPositionBuilderAtEnd(builder, cont_bb);
+
+      LLVMValueRef phi = LLVMBuildPhi(builder, LLVMInt1TypeInContext(ctx), "");
+      LLVMValueRef partial_results[] = {left_val, right_val};
+      LLVMBasicBlockRef blocks[] = {left_true_bb, left_false_bb};
+      LLVMAddIncoming(phi, partial_results, blocks, 2);
+
+      return phi;
+    }
+    else if(e->binop.op == CONCAT_KW)
+    {
+      LLVMValueRef lhs = codegen_expr(e->binop.lhs, env, module, builder);
+      LLVMValueRef rhs = codegen_expr(e->binop.rhs, env, module, builder);
+      LLVMValueRef elem_size = LLVMConstInt(LLVMInt32TypeInContext(ctx), e->elem_vtype == INTEGER ? 4 : 1, 0);
+
+      LLVMValueRef size_lhs = vect_length(builder, lhs);
+      LLVMValueRef size_rhs = vect_length(builder, rhs);
+
+      // the result is a runtime vector when one of the operands is
+      LLVMValueRef conc_vector_base_address =
+        build_vect_alloc(e, LLVMBuildAdd(builder, size_lhs, size_rhs, ""), module, builder);
+
+      // copy lhs then rhs right after it, with one memcpy each
+      LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0);
+      LLVMBuildMemCpy(builder, vect_elem_ptr(builder, conc_vector_base_address, zero), 1,
+                      vect_elem_ptr(builder, lhs, zero), 1,
+                      LLVMBuildMul(builder, size_lhs, elem_size, ""));
+      LLVMBuildMemCpy(builder, vect_elem_ptr(builder, conc_vector_base_address, size_lhs), 1,
+                      vect_elem_ptr(builder, rhs, zero), 1,
+                      LLVMBuildMul(builder, size_rhs, elem_size, ""));
+      return conc_vector_base_address;
+    }
+
+    else if(e->vtype == VECT) // element-wise operation on vectors
+    {
+      return codegen_elementwise(e, env, module, builder);
+    }
+
+    else // "standard" binary operation
+    {
+      LLVMValueRef lhs = codegen_expr(e->binop.lhs, env, module, builder);
+      LLVMValueRef rhs = codegen_expr(e->binop.rhs, env, module, builder);
+      return build_binop(builder, e->binop.op, lhs, rhs);
+    }
+  }
+
+  case VECTOR: {
+    struct expr_vect *ve = e->vect;
+    int i = 0;
+
+    // the rows of a matrix are copied one after the other
+    if (e->cols > 0) {
+      LLVMValueRef matrix = build_vect_alloc(e, NULL, module, builder);
+      for (; ve != NULL; ve = ve->next_expr, i += e->cols) {
+        LLVMValueRef row = codegen_expr(ve->curr_expr, env, module, builder);
+        build_row_copy(builder, matrix, LLVMConstInt(LLVMInt32TypeInContext(ctx), i, 0), row, ve->curr_expr);
+      }
+      return matrix;
+    }
+
+    int size = vect_len(ve);
+    
+    // create a C array to hold the result of the evaluation of of every expr in the list of expressions ve
+    LLVMValueRef* expressions = malloc(sizeof(LLVMValueRef) * size);
+
+    // generate code for every expression in the vector
+    while(ve != NULL) {
+      expressions[i] = codegen_expr(ve->curr_expr, env, module, builder);
+      ve = ve->next_expr;
+      ++i;
+    }
+
+    // Now we evaluated every expression in the vector. It is left to store each results in memory
+
+    // compute the type of the vector of expressions 
+    // implementation choice: the type must be the same for every expression in the list
+    LLVMTypeRef element_type = LLVMTypeOf(expressions[0]);
+    LLVMTypeRef vector_type  = LLVMArrayType(element_type, size);
+
+    // emit LLVM IR code to allocate space for this type of vector and get the base address of it
+    LLVMValueRef vector_base_address = build_vect_alloc(e, NULL, module, builder);
+    // put each vector elements in its place computing offsets starting from vector_base_address
+    i = 0;
+    while(i < size) 
+    {
+      LLVMValueRef idxs[] = { LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(ctx), i, 0) };
+      // compute the offset where the i-th value has to be stored
+      LLVMValueRef offset = LLVMBuildInBoundsGEP2(builder, vector_type, vector_base_address, idxs, 2, "");
+      // store element i at address: vector_base_address + offset
+      LLVMBuildStore(builder, expressions[i], offset);
+      ++i;
+    }
+    free(expressions);
+    return vector_base_address;
+  }
+
+  case VECTOR_ACCESS_OP: {
+    LLVMValueRef vect_id = codegen_expr(e->vect_access.base, env, module, builder);
+    // evaluate the expression yielding the offset to access the given vector
+    LLVMValueRef idx = codegen_expr(e->vect_access.offset, env, module, builder);
+    if (e->vect_access.col != NULL) {
+      int cols = e->vect_access.base->cols;
+      LLVMValueRef col = codegen_expr(e->vect_access.col, env, module, builder);
+      if (bounds_checks && !e->in_bounds)
+        build_matrix_bounds_check(builder, module, vect_id, idx, col, cols);
+      return LLVMBuildLoad(builder, matrix_elem_ptr(builder, vect_id, idx, col, cols), "");
+    }
+    if (bounds_checks && !e->in_bounds)
+      build_bounds_check(builder, module, vect_id, idx);
+    LLVMValueRef offset = vect_elem_ptr(builder, vect_id, idx);
+    return LLVMBuildLoad(builder, offset, "");
+  }
+
+  case VECTOR_UPDATE_OP: {
+    // evaluate the base address in the environment
+    LLVMValueRef vect_id = codegen_expr(e->vect_update.base, env, module, builder);
+    // evaluate the expression to get the offset
+    LLVMValueRef idx = codegen_expr(e->vect_update.offset, env, module, builder);
+    if (e->vect_update.col != NULL) {
+      int cols = e->vect_update.base->cols;
+      LLVMValueRef col = codegen_expr(e->vect_update.col, env, module, builder);
+      LLVMValueRef rhs = codegen_expr(e->vect_update.rhs, env, module, builder);
+      if (bounds_checks && !e->in_bounds)
+        build_matrix_bounds_check(builder, module, vect_id, idx, col, cols);
+      return LLVMBuildStore(builder, rhs, matrix_elem_ptr(builder, vect_id, idx, col, cols));
+    }
+    
+    LLVMValueRef rhs = codegen_expr(e->vect_update.rhs, env, module, builder);
+    if (bounds_checks && !e->in_bounds)
+      build_bounds_check(builder, module, vect_id, idx);
+
+    LLVMValueRef offset = vect_elem_ptr(builder, vect_id, idx);
+
+    return LLVMBuildStore(builder, rhs, offset);
+  }
+
+  case SEQ: { // returns the last expression of the sequence
+    LLVMValueRef ret;
+    struct expr_vect *ve = e->vect;
+    do {
+      ret = codegen_expr(ve->curr_expr, env, module, builder);
+      ve = ve->next_expr;
+    } while(ve != NULL);
+
+    return ret;
+  }
+
+  case PARALLEL_FOR:
+    return codegen_parallel_for(e, env, module, builder);
+
+  case TILED_FOR:
+    return codegen_tiled_for(e, env, module, builder);
+
+  case SUGARED_VECTOR_BUILD_OP: {
+    long long sample_len = (long long)vect_len(e->vect_build.sample) * (e->cols > 0 ? e->cols : 1);
+    struct fill_loop fill = { e, env, module, NULL };
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+
+    // a vector of runtime length is allocated once its length is known, to
+    // be an int: the length of a static one was checked by typecheck_expr
+    LLVMValueRef times, n = NULL;
+    if (e->len >= 0) {
+      times = LLVMConstInt(LLVMInt32TypeInContext(ctx), e->vect_build.len->const_value, 0);
+    } else {
+      times = codegen_expr(e->vect_build.len, env, module, builder);
+      LLVMValueRef wide = LLVMBuildMul(builder, LLVMBuildSExt(builder, times, i64, ""),
+                                       LLVMConstInt(i64, sample_len, 0), "");
+      LLVMValueRef f = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+      LLVMBasicBlockRef ok_bb = LLVMAppendBasicBlockInContext(ctx, f, "len_ok");
+      LLVMBasicBlockRef long_bb = LLVMAppendBasicBlockInContext(ctx, f, "too_long");
+      LLVMBuildCondBr(builder, LLVMBuildICmp(builder, LLVMIntSLE, wide, LLVMConstInt(i64, INT_MAX, 0), ""),
+                      ok_bb, long_bb);
+      LLVMPositionBuilderAtEnd(builder, long_bb);
+      LLVMBuildCall(builder, LLVMGetNamedFunction(module, "vect_length_error"), &wide, 1, "");
+      LLVMBuildUnreachable(builder);
+      LLVMPositionBuilderAtEnd(builder, ok_bb);
+      n = LLVMBuildTrunc(builder, wide, LLVMInt32TypeInContext(ctx), "");
+    }
+    fill.vect = build_vect_alloc(e, n, module, builder);
+
+    // a loop evaluates the sample once per round, so that the size of the
+    // code does not depend on the length of the vector
+    build_counted_loop(builder, times, build_fill_body, &fill);
+    return fill.vect;
+  }
+  
+  default:
+    return NULL;
+  }
+}
@@ -1,141 +1,266 @@
-#include <llvm-c/Core.h>
-#include "utils.h"
-
-enum expr_type {
-  LITERAL,
-  LIT_BOOL,
-  IDENT,
-  LET,
-  VAR,
-  ASSIGN,
-  IF,
-  CALL,
-  WHILE,
-  UN_OP,
-  BIN_OP,
-  VECTOR,
-  VECTOR_ACCESS_OP,
-  VECTOR_UPDATE_OP,
-  SEQ,
-  SUGARED_VECTOR_BUILD_OP,
-
-};
-
-enum value_type {
-  ERROR,
-  INTEGER,
-  BOOLEAN,
-};
-
-struct expr_vect {
-  struct expr      *curr_expr;
-  struct expr_vect *next_expr;
-};
-
-struct expr {
-  enum expr_type type;
-  union {
-    int value;
-
-    char *ident;
-
-    struct {
-      char *ident;
-      struct expr *expr;
-    } call;
-
-    struct {
-      char *ident;
-      struct expr *expr;
-      struct expr *body;
-    } let;
-
-    struct {
-      char *ident;
-      struct expr *expr;
-      struct expr *body;
-    } var;
-
-    struct {
-      char *ident;
-      struct expr *expr;
-    } assign;
-
-    struct {
-      struct expr *cond;
-      struct expr *e_true;
-      struct expr *e_false;
-    } if_expr;
-
-    struct {
-      struct expr *cond;
-      struct expr *body;
-    } while_expr;
-
-    struct {
-      struct expr *expr;
-      int op;
-    } unop;
-
-    struct {
-      struct expr *lhs;
-      struct expr *rhs;
-      int op;
-    } binop;
-
-    struct {
-      struct expr *base;
-      struct expr *offset;
-    } vect_access;
-
-    struct {
-      struct expr *base;
-      struct expr *offset;
-      struct expr *rhs;
-    } vect_update;
-
-    struct {
-      struct expr_vect *sample;
-      struct expr      *len;
-    } vect_build;
-
-    struct expr_vect *vect;
-  };
-};
-
-
-
-struct expr *make_val(int value);
-struct expr *make_bool(int value);
-struct expr *make_identifier(char *ident);
-struct expr *make_call(char *ident, struct expr *expr);
-struct expr *make_let(char *ident, struct expr *expr, struct expr *body);
-struct expr *make_var(char *ident, struct expr *expr, struct expr *body);
-struct expr *make_assign(char *ident, struct expr *expr);
-struct expr *make_if(struct expr *cond, struct expr *e_true, struct expr *e_false);
-struct expr *make_while(struct expr *cond, struct expr *body);
-
-struct expr *make_un_op(int op, struct expr *expr);
-struct expr *make_bin_op(struct expr *lhs, int op, struct expr *rhs);
-
-struct expr *make_vect(struct expr_vect *new_vect);
-struct expr *make_vect_access_op(struct expr *base, struct expr *offset);
-struct expr *make_vect_update_op(struct expr *base, struct expr *offset, struct expr *new_rhs);
-
-struct expr *make_seq(struct expr_vect *new_seq);
-
-struct expr *make_vect_sugared(struct expr_vect *new_vect, struct expr *len);
-
-
-struct expr_vect *make_expr_vect(struct expr *curr, struct expr_vect *next);
-
-void free_expr(struct expr *e);
-
-
-LLVMValueRef codegen_expr(
-  struct expr *e,
-  struct env *env,
-  LLVMModuleRef module,
-  LLVMBuilderRef builder
-);
-void jit_eval(struct expr *e);
+#ifndef AST_H
+#define AST_H
+
+#include <stdint.h>
+#include <llvm-c/Core.h>
+#include "arena.h"
+#include "utils.h"
+
+enum expr_type {
+  LITERAL,
+  LIT_BOOL,
+  IDENT,
+  LET,
+  VAR,
+  ASSIGN,
+  IF,
+  CALL,
+  WHILE,
+  UN_OP,
+  BIN_OP,
+  VECTOR,
+  VECTOR_ACCESS_OP,
+  VECTOR_UPDATE_OP,
+  SEQ,
+  SUGARED_VECTOR_BUILD_OP,
+  PARAM,
+  PARALLEL_FOR,
+  TILED_FOR,
+
+};
+
+enum value_type {
+  ERROR,
+  INTEGER,
+  BOOLEAN,
+  UNIT,     // expressions evaluated only for their effects (while, :=, ...)
+  VECT,
+};
+
+// operators the parser never produces, see fold_expr: out of the range of
+// the characters and of the tokens
+enum { SHL_OP = -1 };
+
+struct branch_counts;
+
+struct expr_vect {
+  struct expr      *curr_expr;
+  struct expr_vect *next_expr;
+};
+
+struct expr {
+  enum expr_type type;
+
+  // annotations filled in by typecheck_expr
+  enum value_type vtype;
+  enum value_type elem_vtype;  // VECT only: the type of the elements
+  int len;                     // VECT only: the number of elements, -1 if
+                               // only known at runtime
+  int cols;                    // VECT only: the length of the rows of a
+                               // matrix, 0 for a plain vector
+  int transient;               // VECT only: the vector is used up by its
+                               // parent, see mark_transient
+  int is_const;                // INTEGER only: the value is known at compile time
+  int const_value;
+  int in_bounds;               // VECTOR_ACCESS_OP and VECTOR_UPDATE_OP only: the
+                               // index is known to be valid, see analyse_bounds
+  struct branch_counts *counts;  // IF, WHILE, AND_SC and OR_SC only, with a
+                                 // profile: see profile_attach
+
+  union {
+    int value;
+
+    int ident;
+
+    struct {
+      int ident;
+      struct expr_vect *args;
+      int tail;           // in tail position of a function body
+    } call;
+
+    struct {
+      int ident;
+      int type_ident;     // the name of its type, resolved by define_function
+    } param;
+
+    struct {
+      int ident;
+      struct expr *expr;
+      struct expr *body;
+    } let;
+
+    struct {
+      int ident;
+      struct expr *expr;
+      struct expr *body;
+    } var;
+
+    struct {
+      int ident;
+      struct expr *expr;
+    } assign;
+
+    struct {
+      struct expr *cond;
+      struct expr *e_true;
+      struct expr *e_false;
+    } if_expr;
+
+    struct {
+      struct expr *cond;
+      struct expr *body;
+    } while_expr;
+
+    struct {
+      struct expr *expr;
+      int op;
+    } unop;
+
+    struct {
+      struct expr *lhs;
+      struct expr *rhs;
+      int op;
+    } binop;
+
+    // base[offset], or base[offset][col] on a matrix
+    struct {
+      struct expr *base;
+      struct expr *offset;
+      struct expr *col;   // NULL on a plain vector
+    } vect_access;
+
+    struct {
+      struct expr *base;
+      struct expr *offset;
+      struct expr *col;
+      struct expr *rhs;
+    } vect_update;
+
+    struct {
+      struct expr_vect *sample;
+      struct expr      *len;
+    } vect_build;
+
+    // parallel for ident in from..to [reduce op] do body
+    struct {
+      int ident;
+      struct expr *from;
+      struct expr *to;
+      int op;             // '+', '<' for min, '>' for max, 0 without a
+                          // reduction, -1 for an unknown one
+      struct expr *body;
+    } par_for;
+
+    // for row in from..to, col in col_from..col_to [tile size] do body
+    struct {
+      int row, col;
+      struct expr *from, *to;
+      struct expr *col_from, *col_to;
+      struct expr *tile;  // NULL for a single tile
+      struct expr *body;
+    } tiled_for;
+
+    struct expr_vect *vect;
+  };
+};
+
+
+
+struct expr *make_val(int value);
+struct expr *make_bool(int value);
+struct expr *make_identifier(int ident);
+struct expr *make_call(int ident, struct expr_vect *args);
+struct expr *make_let(int ident, struct expr *expr, struct expr *body);
+struct expr *make_var(int ident, struct expr *expr, struct expr *body);
+struct expr *make_assign(int ident, struct expr *expr);
+struct expr *make_if(struct expr *cond, struct expr *e_true, struct expr *e_false);
+struct expr *make_while(struct expr *cond, struct expr *body);
+
+struct expr *make_un_op(int op, struct expr *expr);
+struct expr *make_bin_op(struct expr *lhs, int op, struct expr *rhs);
+
+struct expr *make_vect(struct expr_vect *new_vect);
+struct expr *make_vect_access_op(struct expr *base, struct expr *offset);
+struct expr *make_vect_update_op(struct expr *base, struct expr *offset, struct expr *new_rhs);
+
+struct expr *make_seq(struct expr_vect *new_seq);
+
+struct expr *make_vect_sugared(struct expr_vect *new_vect, struct expr *len);
+
+struct expr *make_parallel_for(int ident, struct expr *from, struct expr *to, int op, struct expr *body);
+struct expr *make_tiled_for(int row, struct expr *from, struct expr *to, int col, struct expr *col_from, struct expr *col_to, struct expr *tile, struct expr *body);
+
+
+struct expr_vect *make_expr_vect(struct expr *curr, struct expr_vect *next);
+
+// fun name(p1: t1, ..., pn: tn): t = body
+struct fun_def {
+  int ident;
+  struct expr_vect *params;   // PARAM nodes
+  int ret_type_ident;
+  enum value_type ret;
+  struct expr *body;
+  uint64_t hash;              // of the definition, see hash_expr
+  unsigned calls;             // --tiered: calls interpreted so far
+  int parallel_safe;          // can be called from a parallel for body, see
+                              // define_function
+};
+
+struct expr *make_param(int ident, int type_ident);
+struct fun_def *make_fun_def(int ident, struct expr_vect *params, int ret_type_ident, struct expr *body);
+
+// the nodes are not freed one by one: the parser allocates them in
+// ast_arena, which goes with each top-level item to the compiler, see
+// stream.h, and is reset once the expression has been evaluated
+extern struct arena ast_arena;
+
+int vect_len(struct expr_vect *vect);
+
+// structural hash of an expression, chained from h: equal programs hash to
+// the same value across runs (start from HASH_SEED)
+#define HASH_SEED 14695981039346656037ULL
+uint64_t hash_expr(uint64_t h, struct expr *e);
+uint64_t hash_fun_def(uint64_t h, struct fun_def *f);
+uint64_t hash_string(uint64_t h, const char *s);
+
+// annotates every node of e with its value type, reporting type errors on
+// stderr; returns the type of e, or ERROR if it is not well typed
+enum value_type typecheck_expr(struct expr *e, struct env *env);
+
+// the functions defined so far: define_function typechecks f and, if it is
+// well typed, makes it callable from the expressions that follow; returns 0
+// on success
+int define_function(struct fun_def *f);
+struct fun_def *lookup_function(int ident);
+
+// the LLVM types are created in the context ctx: every module, and so every
+// type, lives in the context of the thread compiling it
+LLVMTypeRef llvm_scalar_type(LLVMContextRef ctx, enum value_type t);
+LLVMTypeRef llvm_type_of(LLVMContextRef ctx, struct expr *e);
+LLVMTypeRef llvm_rt_vect_type(LLVMContextRef ctx, enum value_type elem_vtype);
+
+// --checked: vector accesses are checked against the length of the vector,
+// except those analyse_bounds proves valid on a typed expression
+extern int bounds_checks;
+void analyse_bounds(struct expr *e, struct env *env);
+
+// constant propagation through let, branch folding, removal of the effect
+// free elements of a sequence and strength reduction, in place on a typed
+// expression, so that less IR is generated and optimised
+void fold_expr(struct expr *e);
+
+// marks the vectors e builds whose value is only read, updated or copied by
+// their parent, never bound, assigned or returned: no reference to one
+// outlives its parent, so that the next evaluation can reuse its storage.
+// transient tells whether the value of e itself is used up; run on a typed
+// and folded expression
+void mark_transient(struct expr *e, int transient);
+
+LLVMValueRef codegen_expr(
+  struct expr *e,
+  struct env *env,
+  LLVMModuleRef module,
+  LLVMBuilderRef builder
+);
+
+#endif
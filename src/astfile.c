@@ -0,0 +1,606 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astfile.h"
+#include "stream.h"
+#include "y.tab.h"
+
+struct ast_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_items;
+  uint32_t n_syms;
+  uint64_t syms_offset;
+};
+
+// the operators that are tokens rather than characters, by rank: their
+// numbers change with the grammar, their rank only with the format
+static const int op_tokens[] = { MOD, LE, GE, NE, AND_SC, AND, OR_SC, OR, CONCAT_KW };
+#define N_OP_TOKENS (sizeof(op_tokens) / sizeof(op_tokens[0]))
+
+static uint32_t encode_op(int op)
+{
+  for (unsigned k = 0; k < N_OP_TOKENS; ++k) {
+    if (op_tokens[k] == op)
+      return 256 + k;
+  }
+  return op;
+}
+
+// ------------------------------------------------------------- writer
+
+static FILE *out;
+static const char *out_path;
+static uint32_t n_items;
+
+// the item being written: its nodes, numbered in the order they are
+// queued, the one being written, and its bytes
+static struct expr **queue;
+static unsigned n_queued, queue_cap;
+static long current;
+static unsigned char *bytes;
+static unsigned n_bytes, bytes_cap;
+static unsigned n_cells;
+
+static void put_byte(unsigned char b)
+{
+  if (n_bytes == bytes_cap) {
+    bytes_cap = bytes_cap ? bytes_cap * 2 : 4096;
+    bytes = realloc(bytes, bytes_cap);
+  }
+  bytes[n_bytes++] = b;
+}
+
+static void put_uint(uint32_t u)
+{
+  for (; u >= 0x80; u >>= 7)
+    put_byte(u | 0x80);
+  put_byte(u);
+}
+
+static void put_int(int i)
+{
+  put_uint((uint32_t)i << 1 ^ (uint32_t)(i >> 31));
+}
+
+static void put_ref(struct expr *e)
+{
+  if (e == NULL) {
+    put_uint(AST_NONE);
+    return;
+  }
+  if (n_queued == queue_cap) {
+    queue_cap = queue_cap ? queue_cap * 2 : 256;
+    queue = realloc(queue, queue_cap * sizeof(struct expr *));
+  }
+  put_uint(n_queued - current);
+  queue[n_queued++] = e;
+}
+
+static void put_list(struct expr_vect *ve)
+{
+  put_uint(vect_len(ve));
+  for (; ve != NULL; ve = ve->next_expr) {
+    put_ref(ve->curr_expr);
+    ++n_cells;
+  }
+}
+
+static void put_node(struct expr *e)
+{
+  put_uint(e->type);
+
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+    put_int(e->value);
+    break;
+  case IDENT:
+    put_uint(e->ident);
+    break;
+  case CALL:
+    put_uint(e->call.ident);
+    put_list(e->call.args);
+    break;
+  case PARAM:
+    put_uint(e->param.ident);
+    put_uint(e->param.type_ident);
+    break;
+  case LET:
+  case VAR:
+    put_uint(e->let.ident);
+    put_ref(e->let.expr);
+    put_ref(e->let.body);
+    break;
+  case ASSIGN:
+    put_uint(e->assign.ident);
+    put_ref(e->assign.expr);
+    break;
+  case IF:
+    put_ref(e->if_expr.cond);
+    put_ref(e->if_expr.e_true);
+    put_ref(e->if_expr.e_false);
+    break;
+  case WHILE:
+    put_ref(e->while_expr.cond);
+    put_ref(e->while_expr.body);
+    break;
+  case UN_OP:
+    put_ref(e->unop.expr);
+    put_uint(encode_op(e->unop.op));
+    break;
+  case BIN_OP:
+    put_ref(e->binop.lhs);
+    put_ref(e->binop.rhs);
+    put_uint(encode_op(e->binop.op));
+    break;
+  case VECTOR_ACCESS_OP:
+    put_ref(e->vect_access.base);
+    put_ref(e->vect_access.offset);
+    put_ref(e->vect_access.col);
+    break;
+  case VECTOR_UPDATE_OP:
+    put_ref(e->vect_update.base);
+    put_ref(e->vect_update.offset);
+    put_ref(e->vect_update.col);
+    put_ref(e->vect_update.rhs);
+    break;
+  case SUGARED_VECTOR_BUILD_OP:
+    put_list(e->vect_build.sample);
+    put_ref(e->vect_build.len);
+    break;
+  case PARALLEL_FOR:
+    put_uint(e->par_for.ident);
+    put_ref(e->par_for.from);
+    put_ref(e->par_for.to);
+    put_int(e->par_for.op);
+    put_ref(e->par_for.body);
+    break;
+  case TILED_FOR:
+    put_uint(e->tiled_for.row);
+    put_uint(e->tiled_for.col);
+    put_ref(e->tiled_for.from);
+    put_ref(e->tiled_for.to);
+    put_ref(e->tiled_for.col_from);
+    put_ref(e->tiled_for.col_to);
+    put_ref(e->tiled_for.tile);
+    put_ref(e->tiled_for.body);
+    break;
+  case VECTOR:
+  case SEQ:
+    put_list(e->vect);
+    break;
+  }
+}
+
+// the bytes put so far lead the item; the nodes they queued, and the ones
+// those queue in turn, follow
+static void write_item(uint32_t kind)
+{
+  for (current = 0; current < n_queued; ++current)
+    put_node(queue[current]);
+
+  // the head goes before the bytes of the item, it is put after them
+  unsigned n_item_bytes = n_bytes;
+  put_uint(kind);
+  put_uint(n_queued);
+  put_uint(n_cells);
+  put_uint(n_item_bytes);
+  fwrite(bytes + n_item_bytes, 1, n_bytes - n_item_bytes, out);
+  fwrite(bytes, 1, n_item_bytes, out);
+  ++n_items;
+
+  n_queued = 0;
+  current = -1;
+  n_bytes = 0;
+  n_cells = 0;
+}
+
+int ast_emit_open(const char *path)
+{
+  out = fopen(path, "wb");
+  if (out == NULL) {
+    perror(path);
+    return 1;
+  }
+  out_path = path;
+  n_items = 0;
+  current = -1;
+
+  // written again once the symbols are known
+  struct ast_header header = { 0 };
+  fwrite(&header, sizeof(header), 1, out);
+  return 0;
+}
+
+void ast_emit_expr(struct expr *e)
+{
+  put_ref(e);
+  write_item(AST_ITEM_EXPR);
+}
+
+int ast_emit_fun(struct fun_def *f)
+{
+  put_uint(f->ident);
+  put_uint(f->ret_type_ident);
+  put_list(f->params);
+  put_ref(f->body);
+  write_item(AST_ITEM_FUN);
+  return 0;
+}
+
+int ast_emit_close(void)
+{
+  // every symbol, the ones of the items and the ones interned before them
+  struct ast_header header = {
+    .magic = AST_MAGIC,
+    .version = AST_VERSION,
+    .n_items = n_items,
+    .n_syms = symbol_count(),
+    .syms_offset = ftell(out),
+  };
+  for (uint32_t sym = 0; sym < header.n_syms; ++sym) {
+    const char *name = symbol_name(sym);
+    size_t len = strlen(name);
+    put_uint(len);
+    fwrite(bytes, 1, n_bytes, out);
+    fwrite(name, 1, len, out);
+    n_bytes = 0;
+  }
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+
+  int failed = ferror(out);
+  failed = fclose(out) != 0 || failed;
+  if (failed)
+    fprintf(stderr, "%s: write failed\n", out_path);
+
+  free(queue);
+  free(bytes);
+  queue = NULL;
+  bytes = NULL;
+  queue_cap = bytes_cap = 0;
+  return failed;
+}
+
+// ------------------------------------------------------------- loader
+
+static const char *in_path;
+static const unsigned char *in_bytes;
+static size_t in_size;
+
+// the bytes being decoded, and the blocks of their item
+struct reader {
+  const unsigned char *p, *end;
+  const int *syms;
+  uint32_t n_syms;
+
+  struct expr *nodes;
+  uint32_t n_nodes;
+  int64_t current;          // the index of the node being decoded, -1 for
+                            // the bytes leading the item
+  struct expr_vect *cells;
+  uint32_t n_cells, cells_used;
+
+  // how each node is referred to, see check_params
+  unsigned char *uses;
+  int in_params;            // the references read are parameters
+
+  int failed;
+};
+
+enum { USE_PARAM = 1, USE_CHILD = 2 };
+
+static uint32_t get_uint(struct reader *r)
+{
+  uint32_t u = 0;
+  for (unsigned shift = 0; shift < 35; shift += 7) {
+    if (r->p == r->end)
+      break;
+    unsigned char b = *r->p++;
+    u |= (uint32_t)(b & 0x7f) << shift;
+    if (b < 0x80)
+      return u;
+  }
+  r->failed = 1;
+  return 0;
+}
+
+static int get_int(struct reader *r)
+{
+  uint32_t u = get_uint(r);
+  return (int)(u >> 1 ^ -(u & 1));
+}
+
+static int get_sym(struct reader *r)
+{
+  uint32_t k = get_uint(r);
+  if (k >= r->n_syms) {
+    r->failed = 1;
+    return 0;
+  }
+  return r->syms[k];
+}
+
+static int get_op(struct reader *r)
+{
+  uint32_t op = get_uint(r);
+  if (op < 256)
+    return op;
+  if (op - 256 >= N_OP_TOKENS) {
+    r->failed = 1;
+    return 0;
+  }
+  return op_tokens[op - 256];
+}
+
+// a child, NULL only where the node allows it: the indices only go
+// forward, so that no node is its own descendant
+static struct expr *get_ref(struct reader *r, int optional)
+{
+  uint32_t delta = get_uint(r);
+  if (delta == AST_NONE && optional)
+    return NULL;
+  if (delta == AST_NONE || delta >= r->n_nodes - r->current) {
+    r->failed = 1;
+    return NULL;
+  }
+  r->uses[r->current + delta] |= r->in_params ? USE_PARAM : USE_CHILD;
+  return &r->nodes[r->current + delta];
+}
+
+static struct expr_vect *get_list(struct reader *r)
+{
+  uint32_t n = get_uint(r);
+  if (n > r->n_cells - r->cells_used) {
+    r->failed = 1;
+    return NULL;
+  }
+
+  struct expr_vect *first = n > 0 ? &r->cells[r->cells_used] : NULL;
+  for (uint32_t k = 0; k < n; ++k) {
+    struct expr_vect *ve = &r->cells[r->cells_used++];
+    ve->curr_expr = get_ref(r, 0);
+    ve->next_expr = k + 1 < n ? ve + 1 : NULL;
+  }
+  return first;
+}
+
+static void get_node(struct reader *r, struct expr *e)
+{
+  e->type = get_uint(r);
+
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+    e->value = get_int(r);
+    break;
+  case IDENT:
+    e->ident = get_sym(r);
+    break;
+  case CALL:
+    e->call.ident = get_sym(r);
+    e->call.args = get_list(r);
+    break;
+  case PARAM:
+    e->param.ident = get_sym(r);
+    e->param.type_ident = get_sym(r);
+    break;
+  case LET:
+  case VAR:
+    e->let.ident = get_sym(r);
+    e->let.expr = get_ref(r, 0);
+    e->let.body = get_ref(r, 0);
+    break;
+  case ASSIGN:
+    e->assign.ident = get_sym(r);
+    e->assign.expr = get_ref(r, 0);
+    break;
+  case IF:
+    e->if_expr.cond = get_ref(r, 0);
+    e->if_expr.e_true = get_ref(r, 0);
+    e->if_expr.e_false = get_ref(r, 0);
+    break;
+  case WHILE:
+    e->while_expr.cond = get_ref(r, 0);
+    e->while_expr.body = get_ref(r, 0);
+    break;
+  case UN_OP:
+    e->unop.expr = get_ref(r, 0);
+    e->unop.op = get_op(r);
+    break;
+  case BIN_OP:
+    e->binop.lhs = get_ref(r, 0);
+    e->binop.rhs = get_ref(r, 0);
+    e->binop.op = get_op(r);
+    break;
+  case VECTOR_ACCESS_OP:
+    e->vect_access.base = get_ref(r, 0);
+    e->vect_access.offset = get_ref(r, 0);
+    e->vect_access.col = get_ref(r, 1);
+    break;
+  case VECTOR_UPDATE_OP:
+    e->vect_update.base = get_ref(r, 0);
+    e->vect_update.offset = get_ref(r, 0);
+    e->vect_update.col = get_ref(r, 1);
+    e->vect_update.rhs = get_ref(r, 0);
+    break;
+  case SUGARED_VECTOR_BUILD_OP:
+    e->vect_build.sample = get_list(r);
+    e->vect_build.len = get_ref(r, 0);
+    break;
+  case PARALLEL_FOR:
+    e->par_for.ident = get_sym(r);
+    e->par_for.from = get_ref(r, 0);
+    e->par_for.to = get_ref(r, 0);
+    e->par_for.op = get_int(r);
+    e->par_for.body = get_ref(r, 0);
+    break;
+  case TILED_FOR:
+    e->tiled_for.row = get_sym(r);
+    e->tiled_for.col = get_sym(r);
+    e->tiled_for.from = get_ref(r, 0);
+    e->tiled_for.to = get_ref(r, 0);
+    e->tiled_for.col_from = get_ref(r, 0);
+    e->tiled_for.col_to = get_ref(r, 0);
+    e->tiled_for.tile = get_ref(r, 1);
+    e->tiled_for.body = get_ref(r, 0);
+    break;
+  case VECTOR:
+  case SEQ:
+    e->vect = get_list(r);
+    break;
+  default:
+    r->failed = 1;
+    break;
+  }
+}
+
+int ast_load_file(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return 1;
+  }
+
+  size_t size = st.st_size;
+  void *map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  const struct ast_header *header = map;
+  if (map == MAP_FAILED || size < sizeof(*header)
+      || header->magic != AST_MAGIC || header->version != AST_VERSION
+      || header->syms_offset < sizeof(*header) || header->syms_offset > size) {
+    fprintf(stderr, "%s: not an AST file of this version\n", path);
+    if (map != MAP_FAILED)
+      munmap(map, size);
+    return 1;
+  }
+
+  in_path = path;
+  in_bytes = map;
+  in_size = size;
+  return 0;
+}
+
+// intern the names of the symbols of the file into syms
+static int load_symbols(const struct ast_header *header, int *syms)
+{
+  struct reader r = {
+    .p = in_bytes + header->syms_offset,
+    .end = in_bytes + in_size,
+  };
+  for (uint32_t k = 0; k < header->n_syms; ++k) {
+    uint32_t len = get_uint(&r);
+    if (r.failed || len > r.end - r.p)
+      return 1;
+    syms[k] = intern((const char *)r.p, len);
+    r.p += len;
+  }
+  return 0;
+}
+
+// the PARAM nodes are the parameters of the function, and nothing else: the
+// fields of any other node, read as those of a parameter, are no symbols
+static int check_params(struct reader *r)
+{
+  for (uint32_t k = 0; k < r->n_nodes; ++k) {
+    if ((r->nodes[k].type == PARAM) != (r->uses[k] == USE_PARAM))
+      return 1;
+  }
+  return 0;
+}
+
+int ast_parse(void)
+{
+  const struct ast_header *header = (const void *)in_bytes;
+  const unsigned char *p = in_bytes + sizeof(*header);
+  const unsigned char *end = in_bytes + header->syms_offset;
+
+  // every symbol takes a byte at least
+  if (header->n_syms > in_size) {
+    fprintf(stderr, "%s: corrupt AST file\n", in_path);
+    return 1;
+  }
+  int *syms = malloc((header->n_syms + 1) * sizeof(int));
+  int failed = load_symbols(header, syms);
+  unsigned char *uses = NULL;
+  uint32_t uses_cap = 0;
+
+  for (uint32_t item = 0; item < header->n_items && !failed; ++item) {
+    struct reader r = { .p = p, .end = end };
+    uint32_t kind = get_uint(&r);
+    uint32_t n_nodes = get_uint(&r);
+    uint32_t n_cells = get_uint(&r);
+    uint32_t n_bytes = get_uint(&r);
+    // every node takes two bytes at least, every cell one
+    if (r.failed || n_bytes > r.end - r.p || n_nodes > n_bytes / 2 || n_cells > n_bytes) {
+      failed = 1;
+      break;
+    }
+
+    r.end = r.p + n_bytes;
+    r.syms = syms;
+    r.n_syms = header->n_syms;
+    r.nodes = arena_alloc(&ast_arena, n_nodes * sizeof(struct expr));
+    r.n_nodes = n_nodes;
+    r.current = -1;
+    r.cells = arena_alloc(&ast_arena, n_cells * sizeof(struct expr_vect));
+    r.n_cells = n_cells;
+    if (n_nodes > uses_cap) {
+      uses_cap = n_nodes;
+      uses = realloc(uses, uses_cap);
+    }
+    r.uses = uses;
+    memset(r.uses, 0, n_nodes);
+    // the fields make_* leave alone are zero, the annotations are left to
+    // typecheck_expr as for a parsed node
+    memset(r.nodes, 0, n_nodes * sizeof(struct expr));
+
+    struct fun_def *f = NULL;
+    struct expr *root = NULL;
+    if (kind == AST_ITEM_FUN) {
+      f = arena_alloc(&ast_arena, sizeof(struct fun_def));
+      f->ident = get_sym(&r);
+      f->ret_type_ident = get_sym(&r);
+      r.in_params = 1;
+      f->params = get_list(&r);
+      r.in_params = 0;
+      f->body = get_ref(&r, 0);
+      f->calls = 0;
+      f->parallel_safe = 0;
+    } else {
+      r.failed = kind != AST_ITEM_EXPR;
+      root = get_ref(&r, 0);
+    }
+
+    for (r.current = 0; r.current < n_nodes && !r.failed; ++r.current)
+      get_node(&r, &r.nodes[r.current]);
+
+    failed = r.failed || r.p != r.end || check_params(&r);
+    if (failed)
+      break;
+    p = r.end;
+    if (f != NULL)
+      stream_put_fun(f);
+    else
+      stream_put_expr(root);
+  }
+
+  if (failed)
+    fprintf(stderr, "%s: corrupt AST file\n", in_path);
+  free(uses);
+  free(syms);
+  return failed;
+}
@@ -0,0 +1,52 @@
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include <stdint.h>
+#include "ast.h"
+
+// Pre-parsed programs. --emit-ast writes the items of a program, as the
+// parser hands them over, to a file that --load-ast reads back in place of
+// the source: the file is mapped in memory and every item is decoded into
+// one block of nodes and one block of list cells of its arena, with no
+// scanning, no parsing and no allocation per node.
+//
+// After a fixed header, the numbers are LEB128 varints, the signed ones
+// zigzag encoded:
+//
+//   header   AST_MAGIC, AST_VERSION, items, symbols (32 bits each) and the
+//            offset of the symbols (64 bits), in the byte order of the writer
+//   items    kind (AST_ITEM_EXPR or AST_ITEM_FUN), nodes, cells, bytes,
+//            then the bytes: the root of an expression, or the name, type
+//            name, parameter list and body of a function, followed by the
+//            nodes in order
+//   symbols  length and bytes of each name
+//
+// A node is its type followed by its fields, in the order of the union of
+// struct expr. The nodes are numbered breadth first, so that the children
+// come after their parent: a child is the difference of its index and the
+// one of its parent, AST_NONE for NULL. A list is its length followed by
+// its elements. Identifiers are indices in the symbols of the file,
+// interned once when it is loaded; operators are characters, or 256 plus
+// their rank among the tokens of the grammar.
+#define AST_MAGIC   0x5453414cu   // "LAST" on little-endian machines
+#define AST_VERSION 1
+#define AST_NONE    0
+
+enum { AST_ITEM_EXPR, AST_ITEM_FUN };
+
+// --emit-ast: the items are written as they are handed to ast_emit_expr
+// and ast_emit_fun, which stream_run calls in place of evaluating them;
+// ast_emit_close writes the symbols. Opening and closing return non zero
+// on failure
+int ast_emit_open(const char *path);
+void ast_emit_expr(struct expr *e);
+int ast_emit_fun(struct fun_def *f);
+int ast_emit_close(void);
+
+// --load-ast: map the file at path, returns non zero on failure; ast_parse
+// is then run in place of yyparse, and hands every item of the file to the
+// stream. It returns non zero if the file turns out to be corrupt
+int ast_load_file(const char *path);
+int ast_parse(void);
+
+#endif
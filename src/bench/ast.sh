@@ -0,0 +1,49 @@
+#!/bin/sh
+# Front end time of a generated program of M expressions and M / 100
+# functions (a few MB of source), parsed from the source and loaded from
+# the file --emit-ast wrote: the wall time of writing the program back out
+# with --emit-ast, which runs nothing, and the parse time --stats reports
+# for the expressions of a --tiered run. The output must not depend on
+# where the program came from.
+#
+#   make jit_eval && sh bench/ast.sh [M]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+M=${1:-20000}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v m="$M" 'BEGIN {
+  for (i = 0; i < m; ++i) {
+    f = int(i / 100)
+    if (i % 100 == 0)
+      printf "fun step_%d(x: int, y: int): int = if x < y || x = 0 then x * %d + y else step_%d(x - y, y + 1)\n", f, f, f
+    printf "let a = %d in var b = (a mod 100) * 3 in seq while b > 0 && !(b = 1) do seq b := b - 7; if (b mod 2) = 0 then b := b - 1 else b := b + 0.; [a, b, a + b][1] + step_%d(a mod 50, 3) + sum([1, 2, 3] times 4).\n", i, f
+  }
+}' > "$TMP/prog"
+"$JIT" --emit-ast "$TMP/prog.ast" "$TMP/prog" 2>/dev/null || exit 1
+
+now_ms() {
+  date +%s%N | awk '{ printf "%.0f", $1 / 1000000 }'
+}
+
+# name, file, then the option reading it
+run() {
+  name=$1
+  file=$2
+  shift 2
+  start=$(now_ms)
+  "$JIT" "$@" "$file" --emit-ast "$TMP/out.ast" 2>/dev/null
+  ms=$(($(now_ms) - start))
+  parse=$("$JIT" --tiered --stats "$TMP/stats" "$@" "$file" > "$TMP/out.$name" 2>/dev/null &&
+          awk -F '"parse_ms":' '{ split($2, f, ","); s += f[1] } END { printf "%.1f", s }' "$TMP/stats")
+  printf "%-8s %10d %12d %14s\n" "$name" "$(wc -c < "$file")" "$ms" "$parse"
+}
+
+echo "M=$M"
+printf "%-8s %10s %12s %14s\n" input bytes emit-ms parse-ms
+run source "$TMP/prog"
+run ast "$TMP/prog.ast" --load-ast
+cmp -s "$TMP/out.source" "$TMP/out.ast" || echo "output differs from the parsed program"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compile throughput of --batch against the serial mode, on a generated
+# program of M independent expressions, for 1 .. THREADS compiling threads
+# (by default as many as the cores). The output must not depend on the mode.
+#
+#   make jit_eval && sh bench/batch.sh [M] [LEVEL] [THREADS]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+M=${1:-2000}
+LEVEL=${2:-2}
+THREADS=${3:-$(getconf _NPROCESSORS_ONLN)}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v m="$M" 'BEGIN {
+  for (i = 0; i < m; ++i)
+    printf "let a = %d in var b = a * 3 in seq while b > 0 do b := b - 7; a + b.\n", i
+}' > "$TMP/prog"
+
+now_ms() {
+  date +%s%N | awk '{ printf "%.0f", $1 / 1000000 }'
+}
+
+run() {
+  start=$(now_ms)
+  "$JIT" -O"$LEVEL" $2 "$TMP/prog" > "$TMP/out" 2>/dev/null
+  ms=$(($(now_ms) - start))
+  awk -v name="$1" -v ms="$ms" -v m="$M" 'BEGIN { printf "%-12s %8d ms %8.1f expr/s\n", name, ms, m * 1000 / ms }'
+  if [ -f "$TMP/serial" ] && ! cmp -s "$TMP/out" "$TMP/serial"; then
+    echo "output differs from the serial mode"
+  fi
+}
+
+echo "M=$M -O$LEVEL"
+run "serial" ""
+cp "$TMP/out" "$TMP/serial"
+j=1
+while [ "$j" -le "$THREADS" ]; do
+  run "batch -j $j" "--batch -j $j"
+  j=$((j * 2))
+done
@@ -0,0 +1,132 @@
+// Micro-benchmark of the symbol environment on let/var nesting depths from
+// 10 to 100k, compared with the linked list of frames it replaced.
+//
+//   make bench_env && ./bench_env
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils.h"
+
+// the previous environment: one malloc per binding, lookups walk the
+// chain comparing names
+struct list_env {
+  struct list_env *prev;
+  char *name;
+  void *value;
+};
+
+static void *list_resolve(struct list_env *env, char *name)
+{
+  for (; env != NULL; env = env->prev) {
+    if (strcmp(env->name, name) == 0)
+      return env->value;
+  }
+  return NULL;
+}
+
+static struct list_env *list_push(struct list_env *env, char *name, void *value)
+{
+  struct list_env *r = malloc(sizeof(struct list_env));
+  r->name = name;
+  r->prev = env;
+  r->value = value;
+  return r;
+}
+
+static struct list_env *list_pop(struct list_env *env)
+{
+  struct list_env *r = env->prev;
+  free(env);
+  return r;
+}
+
+static unsigned rng = 12345;
+
+static int pick(int n)
+{
+  rng = rng * 1103515245u + 12345u;
+  return (rng >> 8) % n;
+}
+
+// a nesting of depth bindings where every level looks up variables bound
+// at random distances; returns the ns per lookup
+static double run_list(char **names, int depth, int lookups)
+{
+  long hits = 0;
+  double start = time_ms();
+
+  struct list_env *env = NULL;
+  for (int i = 0; i < depth; ++i) {
+    env = list_push(env, names[i], names[i]);
+    for (int k = 0; k < lookups; ++k)
+      hits += list_resolve(env, names[pick(i + 1)]) != NULL;
+  }
+  while (env != NULL)
+    env = list_pop(env);
+
+  double ms = time_ms() - start;
+  if (hits != (long)depth * lookups)
+    printf("unexpected: missing bindings\n");
+  return ms * 1e6 / ((double)depth * lookups);
+}
+
+static double run_table(int *syms, char **names, int depth, int lookups)
+{
+  long hits = 0;
+  double start = time_ms();
+
+  struct env *env = env_create();
+  for (int i = 0; i < depth; ++i) {
+    push(env, syms[i], names[i]);
+    for (int k = 0; k < lookups; ++k)
+      hits += resolve(env, syms[pick(i + 1)]) != NULL;
+  }
+  for (int i = 0; i < depth; ++i)
+    pop(env);
+  env_dispose(env);
+
+  double ms = time_ms() - start;
+  if (hits != (long)depth * lookups)
+    printf("unexpected: missing bindings\n");
+  return ms * 1e6 / ((double)depth * lookups);
+}
+
+static void run(int depth, int lookups)
+{
+  int *syms = malloc(depth * sizeof(int));
+  char **names = malloc(depth * sizeof(char *));
+  char buf[32];
+
+  for (int i = 0; i < depth; ++i) {
+    snprintf(buf, sizeof(buf), "v%d", i);
+    syms[i] = intern(buf, strlen(buf));
+    names[i] = strdup(buf);
+  }
+
+  double table_ns = run_table(syms, names, depth, lookups);
+  // the list is quadratic in the depth: past 10k it takes minutes
+  if (depth <= 10000) {
+    double list_ns = run_list(names, depth, lookups);
+    printf("%8d %14.2f %14.2f %10.1fx\n", depth, list_ns, table_ns, list_ns / table_ns);
+  } else {
+    printf("%8d %14s %14.2f %11s\n", depth, "-", table_ns, "-");
+  }
+
+  for (int i = 0; i < depth; ++i)
+    free(names[i]);
+  free(names);
+  free(syms);
+}
+
+int main(void)
+{
+  int depths[] = { 10, 100, 1000, 10000, 100000 };
+
+  printf("%8s %14s %14s %11s\n", "depth", "list ns/op", "table ns/op", "speedup");
+  for (unsigned i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i)
+    run(depths[i], 16);
+
+  return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Overhead of --checked on loops over vectors, at -O0 .. -O3: run time of
+# each program without and with bounds checks, as reported by jit_eval for
+# REPEAT runs, and the number of checks left in the generated code.
+#
+#   make jit_eval && sh bench/checked.sh [REPEAT]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+REPEAT=${1:-20}
+
+run() {
+  echo "$2" | "$JIT" -O$1 -r "$REPEAT" $3 2>&1 >/dev/null | awk '/^compile:/ { print $5 }'
+}
+
+checks() {
+  echo "$1" | "$JIT" -O0 --checked 2>&1 >/dev/null |
+    awk '/^generating code/ { on = 1 } /^generating optimised/ { on = 0 } on && /^out_of_bounds/ { n++ } END { print n + 0 }'
+}
+
+bench() {
+  printf '%-12s %6s' "$1" "$(checks "$2")"
+  for level in 0 1 2 3; do
+    printf ' %10s %10s' "$(run $level "$2")" "$(run $level "$2" --checked)"
+  done
+  echo
+}
+
+printf '%-12s %6s' "" "checks"
+for level in 0 1 2 3; do
+  printf ' %10s %10s' "-O$level" "checked"
+done
+echo
+
+# the index of every access is proved valid: no check is left
+bench "static" \
+  "let n = 100000 in var x = [1, 2, 3, 4] times (n / 4) in var s = 0 in var i = 1 in seq while i < n do seq x[i] := x[i] + x[i - 1]; s := s + x[i]; i := i + 1.; s."
+# the length is only known at runtime: every access is checked
+bench "runtime" \
+  "var n = 100000 in var x = [1, 2, 3, 4] times (n / 4) in var s = 0 in var i = 1 in seq while i < n do seq x[i] := x[i] + x[i - 1]; s := s + x[i]; i := i + 1.; s."
+# indices read from a vector: only the accesses through them are checked
+bench "indirect" \
+  "let n = 100000 in var x = [1, 2, 3, 4] times (n / 4) in var y = [3, 0, 2, 1] times (n / 4) in var s = 0 in var i = 0 in seq while i < n do seq s := s + x[y[i]]; i := i + 1.; s."
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Size of the IR generated for a ++ b and compile time at -O0 and -O2, as
+# the length N of the operands grows. Run it against a jit_eval built
+# before and after a change to the lowering of ++ to compare the two.
+#
+#   make jit_eval && sh bench/concat.sh [N...]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+[ $# -gt 0 ] || set -- 10 100 1000 10000 50000
+
+printf '%8s %14s %14s %14s\n' "N" "IR lines" "-O0 ms" "-O2 ms"
+for n in "$@"; do
+  prog="let a = [0] times $n in let b = [1] times $n in (a ++ b)[$n]"
+  ir=$(echo "$prog" | "$JIT" -O0 2>&1 >/dev/null |
+         awk '/^generating code/ { on = 1; next } /^(generating optimised|compile:)/ { on = 0 } on' | wc -l)
+  o0=$(echo "$prog" | "$JIT" -O0 2>&1 >/dev/null | awk '/^compile:/ { print $2 }')
+  o2=$(echo "$prog" | "$JIT" -O2 2>&1 >/dev/null | awk '/^compile:/ { print $2 }')
+  printf '%8s %14s %14s %14s\n' "$n" "$ir" "$o0" "$o2"
+done
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Throughput of the runtime I/O, in millions of integers per second: N
+# integers read one at a time with read_i32 and all at once with read_vec,
+# then written with print_i32 and print_vec. The times are the run times
+# reported by jit_eval, compilation excluded.
+#
+#   make jit_eval && sh bench/io.sh [N] [LEVEL]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+N=${1:-10000000}
+LEVEL=${2:-2}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# the input, one integer per line, with a fair share of negative ones
+awk -v n="$N" 'BEGIN { srand(1); for (i = 0; i < n; ++i) print int(rand() * 2000000) - 1000000 }' > "$TMP/input"
+
+# the program comes from a file: stdin is left to the integers
+run() {
+  echo "$2" > "$TMP/prog"
+  "$JIT" -O"$LEVEL" "$TMP/prog" < "$TMP/input" 2>&1 >/dev/null |
+    awk -v n="$N" -v name="$1" '/^compile:/ { printf "%-12s %10.1f ms %8.1f Mint/s\n", name, $5, n / $5 / 1000 }'
+}
+
+echo "N=$N -O$LEVEL"
+run "read_i32" "var s = 0 in var i = 0 in seq while i < $N do seq s := s + read_i32(0); i := i + 1.; s."
+run "read_vec" "sum(read_vec($N))"
+run "print_i32" "var i = 0 in while i < $N do seq print_i32(i * 7919 - 1000000); i := i + 1."
+run "print_vec" "var n = $N / 4 in print_vec([1000000, 0 - 999999, 3, 0 - 42] times n)"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Run times, in ms, of an N x N matrix product: on vectors indexed by hand
+# with i * n + j, on matrices indexed by row and column, and on matrices
+# walked by a tiled for, in the i-k-j order (a row of b and of c per step)
+# and in the i-j-k order. The matrices live on the stack, 12 * N * N bytes.
+# The times are the run times reported by jit_eval, compilation excluded.
+#
+#   make jit_eval && sh bench/matmul.sh [N] [LEVEL] [TILE]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+N=${1:-384}
+LEVEL=${2:-2}
+TILE=${3:-32}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# the run time of the program of each line, in order
+run_times() {
+  "$JIT" -O"$LEVEL" "$@" "$TMP/prog" 2>&1 >/dev/null | awk '/^compile:/ { print $5 }'
+}
+
+FLAT="let n = $N in let a = [0] times $N * $N in let b = [0] times $N * $N in let c = [0] times $N * $N in seq"
+MAT="let n = $N in let a = [[0] times $N] times $N in let b = [[0] times $N] times $N in let c = [[0] times $N] times $N in seq"
+INIT="for i in 0..n, j in 0..n do seq a[i][j] := (i * 7 + j * 3) mod 11; b[i][j] := (i * 5 + j) mod 13.;"
+DOT="seq var s = 0 in seq var k = 0 in while k < n do seq s := s + a[i][k] * b[k][j]; k := k + 1.; c[i][j] := s.."
+
+{
+  echo "$FLAT var i = 0 in while i < n do seq var j = 0 in while j < n do seq a[i * n + j] := (i * 7 + j * 3) mod 11; b[i * n + j] := (i * 5 + j) mod 13; j := j + 1.; i := i + 1.; var i = 0 in while i < n do seq var j = 0 in while j < n do seq var s = 0 in seq var k = 0 in while k < n do seq s := s + a[i * n + k] * b[k * n + j]; k := k + 1.; c[i * n + j] := s.; j := j + 1.; i := i + 1.; sum(c)."
+  echo "$MAT $INIT for i in 0..n, j in 0..n do $DOT; sum(c)."
+  echo "$MAT $INIT for i in 0..n, k in 0..n tile $TILE do let x = a[i][k] in var j = 0 in while j < n do seq c[i][j] := c[i][j] + x * b[k][j]; j := j + 1.; sum(c)."
+  echo "$MAT $INIT for i in 0..n, j in 0..n tile $TILE do $DOT; sum(c)."
+} > "$TMP/prog"
+
+run_times > "$TMP/times"
+
+echo "N=$N -O$LEVEL, tile $TILE"
+printf "%-12s %12s %12s %12s\n" flat matrix tiled-ikj tiled-ijk
+paste -s "$TMP/times" | awk '{ printf "%-12s %12s %12s %12s\n", $1, $2, $3, $4 }'
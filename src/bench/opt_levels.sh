@@ -0,0 +1,24 @@
+#!/bin/sh
+# Compile and run time of every example under examples/ at -O0 .. -O3.
+# Every file is evaluated REPEAT times in the same session and the timings
+# reported by jit_eval are averaged.
+#
+#   make jit_eval && sh bench/opt_levels.sh [REPEAT]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+REPEAT=${1:-20}
+
+printf '%-48s %5s %14s %14s\n' "example" "level" "compile ms" "run ms"
+for f in examples/*/*.code; do
+  for level in 0 1 2 3; do
+    i=0
+    while [ $i -lt "$REPEAT" ]; do
+      cat "$f"; echo
+      i=$((i + 1))
+    done | "$JIT" -O$level 2>&1 >/dev/null |
+      awk -v f="$f" -v l="-O$level" '
+        /^compile:/ { gsub(",", ""); c += $2; r += $5; n++ }
+        END { if (n) printf "%-48s %5s %14.3f %14.3f\n", f, l, c / n, r / n }'
+  done
+done
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Run times, in ms, of parallel for loops on 1, 2, 4... threads up to one per
+# core, with the speedup over one thread: a sum whose body runs an inner
+# loop, a min of a pseudo-random sequence, and a parallel for summing the
+# parallel for of each of its indices (the nested ones run sequentially).
+# The times are the run times reported by jit_eval, compilation excluded.
+#
+#   make jit_eval && [CORES=n] sh bench/parallel.sh [N] [LEVEL]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+N=${1:-2000000}
+LEVEL=${2:-2}
+CORES=${CORES:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# the run time of the program of each line, in order
+run_times() {
+  "$JIT" -O"$LEVEL" "$@" "$TMP/prog" 2>&1 >/dev/null | awk '/^compile:/ { print $5 }'
+}
+
+{
+  echo "parallel for i in 0..$N reduce + do var j = 0 in var s = 0 in seq while j < 100 do seq s := s + (i * j) mod 7; j := j + 1.; s."
+  echo "fun step(x: int): int = (x * 1103515245 + 12345) mod 2147483648"
+  echo "parallel for i in 0..$N reduce min do var x = i in seq var j = 0 in while j < 50 do seq x := step(x); j := j + 1.; x."
+  echo "parallel for i in 0..$N / 100 reduce + do parallel for j in 0..1000 reduce + do (i * j) mod 13"
+} > "$TMP/prog"
+
+T=1
+: > "$TMP/threads"
+while [ "$T" -le "$CORES" ]; do
+  echo "$T" >> "$TMP/threads"
+  run_times --threads "$T" > "$TMP/t$T"
+  T=$((T * 2))
+done
+
+echo "N=$N -O$LEVEL, $CORES cores"
+printf "%-8s %12s %12s %12s\n" threads inner-loop min nested
+while read -r T; do
+  paste "$TMP/t1" "$TMP/t$T" | awk -v t="$T" '
+    { ms[NR] = $2; up[NR] = $1 / ($2 > 0 ? $2 : 1) }
+    END { printf "%-8s", t
+          for (k = 1; k <= 3; ++k) printf " %6.1f %4.1fx", ms[k], up[k]
+          printf "\n" }'
+done < "$TMP/threads"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Run times, in ms, of programs compiled without and with the profile of a
+# --profile-gen run of themselves: an if on pseudo-random data, a biased
+# if, a loop nested in another going round twice, and the instrumented run
+# itself. The times are the run times reported by jit_eval, compilation
+# excluded.
+#
+#   make jit_eval && sh bench/pgo.sh [N] [LEVEL]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+N=${1:-20000000}
+LEVEL=${2:-1}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# the run time of the program of each line, in order
+run_times() {
+  "$JIT" -O"$LEVEL" "$@" "$TMP/prog" 2>&1 >/dev/null | awk '/^compile:/ { print $5 }'
+}
+
+{
+  echo "fun step(x: int): int = (x * 1103515245 + 12345) mod 2147483648"
+  echo "var i = 0 in var x = 7 in var s = 0 in seq while i < $N do seq x := step(x); let r = x mod 1024 in let d = if r < 512 then x mod 7 else x mod 5 in s := s + d; i := i + 1.; s."
+  echo "var i = 0 in var s = 0 in seq while i < $N do seq if (i mod 1000) = 0 then s := s + i else s := s - 1; i := i + 1.; s."
+  echo "var i = 0 in var s = 0 in seq while i < $N / 4 do seq var j = 0 in while j < 2 do seq s := s + i * j; j := j + 1.; i := i + 1.; s."
+} > "$TMP/prog"
+
+run_times --profile-gen "$TMP/profile" > "$TMP/gen"
+run_times > "$TMP/plain"
+run_times --profile-use "$TMP/profile" > "$TMP/use"
+
+echo "N=$N -O$LEVEL"
+printf "%-12s %12s %12s %12s\n" program instrumented plain profiled
+paste "$TMP/gen" "$TMP/plain" "$TMP/use" |
+  awk 'BEGIN { split("random-if biased-if short-loop", name, " ") }
+       { printf "%-12s %12.1f %12.1f %12.1f\n", name[NR], $1, $2, $3 }'
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Run time of element-wise vector operations and reductions against the
+# equivalent scalar while loop, on vectors of N elements, at -O0 .. -O3.
+# Every program applies its operation K times to the same input vectors,
+# and is run REPEAT times by jit_eval; the times are per program run.
+#
+#   make jit_eval && sh bench/simd.sh [N] [K] [REPEAT]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+N=${1:-1000000}
+K=${2:-10}
+REPEAT=${3:-5}
+
+# var keeps n from being folded, so that the vectors are built at runtime
+INPUT="var n = $N / 4 in let a = [1, 2, 3, 4] times n in let b = [5, 6, 7, 8] times n in"
+INPUT="$INPUT var s = 0 in var k = 0 in seq while k < $K do seq"
+
+run() {
+  echo "$INPUT $2; k := k + 1.; s." | "$JIT" -O$1 -r "$REPEAT" 2>&1 >/dev/null |
+    awk '/^compile:/ { print $5 }'
+}
+
+bench() {
+  printf '%-10s' "$1"
+  for level in 0 1 2 3; do
+    printf ' %12s %12s' "$(run $level "$2")" "$(run $level "$3")"
+  done
+  echo
+}
+
+printf '%-10s' "N=$N"
+for level in 0 1 2 3; do
+  printf ' %12s %12s' "-O$level simd" "-O$level loop"
+done
+echo
+
+bench "a * b + a" \
+  "s := (a * b + a)[k]" \
+  "let c = [0] times (4 * n) in var i = 0 in seq while i < 4 * n do seq c[i] := a[i] * b[i] + a[i]; i := i + 1.; s := c[k]."
+bench "a < b" \
+  "s := s + (if (a < b)[k] then 1 else 0)" \
+  "let c = [false] times (4 * n) in var i = 0 in seq while i < 4 * n do seq c[i] := a[i] < b[i]; i := i + 1.; s := s + (if c[k] then 1 else 0)."
+bench "sum(a*b)" \
+  "s := s + sum(a * b)" \
+  "var i = 0 in while i < 4 * n do seq s := s + a[i] * b[i]; i := i + 1."
+bench "max(a)" \
+  "s := s + max(a)" \
+  "var m = a[0] in var i = 0 in seq while i < 4 * n do seq if a[i] > m then m := a[i] else m := m; i := i + 1.; s := s + m."
@@ -0,0 +1,148 @@
+#!/bin/sh
+# Median and 99th percentile of the compile and run times of every example
+# under examples/, and of generated programs scaling up each construct:
+# deep let and var nesting, a huge vector literal, a long seq, a large
+# times vector and a long while loop. Every program is evaluated REPEAT
+# times in the same session, the times come from --stats.
+#
+# With -w the medians are written to BASELINE; otherwise they are compared
+# with the ones there, and the programs slower than the baseline by more
+# than THRESHOLD percent (and 1 ms) make the script fail. FLAGS go to the
+# jit, e.g. FLAGS=--tiered.
+#
+#   make bench             sh bench/suite.sh [REPEAT] [LEVEL]
+#   make bench-baseline    sh bench/suite.sh -w [REPEAT] [LEVEL]
+
+cd "$(dirname "$0")/.." || exit 1
+JIT=${JIT:-./jit_eval}
+BASELINE=${BASELINE:-bench/baseline.txt}
+THRESHOLD=${THRESHOLD:-25}
+FLAGS=${FLAGS:-}
+
+WRITE=0
+if [ "$1" = "-w" ]; then
+  WRITE=1
+  shift
+fi
+REPEAT=${1:-30}
+LEVEL=${2:-2}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+mkdir "$TMP/gen"
+
+# the sizes of the generated programs
+DEPTH=${DEPTH:-200}
+VECT=${VECT:-2000}
+SEQ=${SEQ:-2000}
+TIMES=${TIMES:-1000000}
+TRIPS=${TRIPS:-10000000}
+
+awk -v d="$DEPTH" 'BEGIN {
+  print "let x0 = 1 in"
+  for (i = 1; i <= d; ++i) printf "let x%d = x%d + %d in\n", i, i - 1, i
+  printf "x%d\n", d
+}' > "$TMP/gen/let_nest.code"
+awk -v d="$DEPTH" 'BEGIN {
+  print "var x0 = 1 in"
+  for (i = 1; i <= d; ++i) printf "var x%d = x%d + %d in\n", i, i - 1, i
+  printf "x%d\n", d
+}' > "$TMP/gen/var_nest.code"
+awk -v n="$VECT" 'BEGIN {
+  printf "let v = ["
+  for (i = 0; i < n; ++i) printf "%s%d", i ? "," : "", i
+  printf "] in v[%d] + sum(v)\n", n - 1
+}' > "$TMP/gen/vect_literal.code"
+awk -v n="$SEQ" 'BEGIN {
+  print "var s = 0 in seq"
+  for (i = 0; i < n; ++i) printf "  s := s * 3 + %d;\n", i
+  print "  s."
+}' > "$TMP/gen/seq_chain.code"
+echo "var n = $TIMES in sum([1, 2] times n)" > "$TMP/gen/times_vect.code"
+echo "var i = 0 in var s = 0 in seq while i < $TRIPS do seq s := s + i mod 7; i := i + 1.; s." > "$TMP/gen/while_loop.code"
+
+# name, then median and p99 of the compile and of the run times, in ms, of
+# the REPEAT evaluations of a program (the times of all its expressions
+# added up)
+measure() {
+  i=0
+  while [ $i -lt "$REPEAT" ]; do
+    cat "$2"; echo
+    i=$((i + 1))
+  done > "$TMP/prog"
+  "$JIT" -O"$LEVEL" $FLAGS --stats "$TMP/stats" "$TMP/prog" >/dev/null 2>&1
+  awk -v name="$1" -v repeat="$REPEAT" '
+    function sort(a, n,    i, j, t) {
+      for (i = 2; i <= n; ++i)
+        for (j = i; j > 1 && a[j - 1] > a[j]; --j) { t = a[j]; a[j] = a[j - 1]; a[j - 1] = t }
+    }
+    function pct(a, n, p,    k) {
+      k = int(p * n + 0.999999)
+      return a[k < 1 ? 1 : k]
+    }
+    {
+      gsub(/[{}"]/, "")
+      m = split($0, fields, ",")
+      for (j = 1; j <= m; ++j) {
+        split(fields[j], kv, ":")
+        if (kv[1] ~ /^(check|codegen|verify|optimise|emit)_ms$/) compile[NR] += kv[2]
+        else if (kv[1] == "run_ms") run[NR] = kv[2]
+      }
+    }
+    END {
+      if (NR == 0 || NR % repeat) { printf "%s failed\n", name > "/dev/stderr"; exit }
+      per = NR / repeat
+      for (i = 1; i <= NR; ++i) {
+        r = int((i - 1) / per) + 1
+        c[r] += compile[i]; x[r] += run[i]
+      }
+      sort(c, repeat); sort(x, repeat)
+      printf "%s %.3f %.3f %.3f %.3f\n", name, pct(c, repeat, 0.5), pct(c, repeat, 0.99), pct(x, repeat, 0.5), pct(x, repeat, 0.99)
+    }' "$TMP/stats"
+}
+
+for f in examples/*/*.code "$TMP"/gen/*.code; do
+  case $f in
+  "$TMP"/*) name=gen/$(basename "$f") ;;
+  *) name=$f ;;
+  esac
+  measure "$name" "$f"
+done > "$TMP/results"
+
+echo "REPEAT=$REPEAT -O$LEVEL $FLAGS"
+if [ "$WRITE" = 1 ]; then
+  cp "$TMP/results" "$BASELINE"
+  echo "baseline written to $BASELINE"
+fi
+BASE=
+if [ "$WRITE" = 0 ] && [ -f "$BASELINE" ]; then
+  BASE=$BASELINE
+fi
+
+awk -v threshold="$THRESHOLD" -v baseline="$BASE" '
+  BEGIN {
+    while (baseline != "" && (getline line < baseline) > 0) {
+      split(line, f, " ")
+      base_c[f[1]] = f[2]
+      base_r[f[1]] = f[4]
+    }
+    printf "%-52s %21s %21s", "program", "compile ms med/p99", "run ms med/p99"
+    if (baseline != "") printf " %15s", "vs baseline"
+    printf "\n"
+  }
+  function delta(now, base) {
+    if (base == "") return "      -"
+    if (now - base > 1 && now > base * (1 + threshold / 100)) failed = 1
+    return sprintf("%+6.0f%%", base > 0 ? (now - base) * 100 / base : 0)
+  }
+  {
+    printf "%-52s %10.3f %10.3f %10.3f %10.3f", $1, $2, $3, $4, $5
+    if (baseline != "") printf " %s %s", delta($2, base_c[$1]), delta($4, base_r[$1])
+    printf "\n"
+  }
+  END {
+    if (failed) {
+      printf "slower than the baseline by more than %s%%\n", threshold
+      exit 1
+    }
+  }' "$TMP/results"
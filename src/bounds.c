@@ -0,0 +1,581 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "y.tab.h"
+
+// Elimination of the bounds checks of --checked. An interval of the values
+// an int expression can take is computed from the facts known about the
+// variables it reads, and an access whose index interval lies within the
+// length of its vector, when it is known at compile time, is marked
+// in_bounds so that codegen_expr emits no check for it.
+//
+// The facts about a variable are bound to its name in the environment while
+// its body is analysed, following the order of evaluation. The current fact
+// about a var only holds until the var is assigned; its base fact holds
+// during its whole life: a var only ever incremented by non-negative
+// constants is never below its initial value, one only ever decremented
+// never above it, unless a step wraps around, in which case the analysis is
+// run again without that fact.
+
+struct interval {
+  long long lo, hi;
+};
+
+static const struct interval unknown = { INT_MIN, INT_MAX };
+
+struct fact {
+  struct interval base;
+  struct interval current;
+  struct expr *var;   // the var binding, if only ever incremented or decremented
+};
+
+struct bounds {
+  struct env *env;
+  struct expr **wrapping;  // vars a step of which may wrap around
+  unsigned n_wrapping, cap;
+  int again;
+};
+
+static int wraps(struct bounds *b, struct expr *var)
+{
+  for (unsigned i = 0; i < b->n_wrapping; ++i) {
+    if (b->wrapping[i] == var)
+      return 1;
+  }
+  return 0;
+}
+
+// the values of an i32 computation: any value if it may have wrapped
+static struct interval make_interval(long long lo, long long hi)
+{
+  if (lo < INT_MIN || hi > INT_MAX)
+    return unknown;
+  return (struct interval){ lo, hi };
+}
+
+static struct interval intersect(struct interval a, struct interval b)
+{
+  return (struct interval){ a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi };
+}
+
+// the interval of e, from the facts known before it is evaluated; the
+// expressions that could change those facts while e is evaluated (seq, if,
+// :=, ...) are not looked into
+static struct interval range(struct expr *e, struct env *env)
+{
+  if (e->vtype != INTEGER)
+    return unknown;
+  if (e->is_const)
+    return make_interval(e->const_value, e->const_value);
+
+  switch (e->type) {
+  case IDENT: {
+    struct fact *f = resolve(env, e->ident);
+    return f != NULL ? f->current : unknown;
+  }
+
+  case BIN_OP: {
+    struct interval l = range(e->binop.lhs, env);
+    struct interval r = range(e->binop.rhs, env);
+    switch (e->binop.op) {
+    case '+':
+      return make_interval(l.lo + r.lo, l.hi + r.hi);
+    case '-':
+      return make_interval(l.lo - r.hi, l.hi - r.lo);
+    case '*':
+      if (l.lo < 0 || r.lo < 0)
+        return unknown;
+      return make_interval(l.lo * r.lo, l.hi * r.hi);
+    case '/':
+      if (!e->binop.rhs->is_const || e->binop.rhs->const_value <= 0)
+        return unknown;
+      return make_interval(l.lo / r.lo, l.hi / r.lo);
+    case MOD:
+      // an unsigned remainder
+      if (!e->binop.rhs->is_const || e->binop.rhs->const_value <= 0)
+        return unknown;
+      return make_interval(0, r.lo - 1);
+    case SHL_OP:
+      if (l.lo < 0 || !e->binop.rhs->is_const)
+        return unknown;
+      return make_interval(l.lo << r.lo, l.hi << r.lo);
+    case AND:
+      // a mask, see fold_expr
+      if (!e->binop.rhs->is_const || e->binop.rhs->const_value < 0)
+        return unknown;
+      return make_interval(0, r.lo);
+    default:
+      return unknown;
+    }
+  }
+
+  default:
+    return unknown;
+  }
+}
+
+// whether e has no effect on the facts
+static int pure(struct expr *e)
+{
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+  case IDENT:
+    return 1;
+  case UN_OP:
+    return pure(e->unop.expr);
+  case BIN_OP:
+    return pure(e->binop.lhs) && pure(e->binop.rhs);
+  default:
+    return 0;
+  }
+}
+
+// how sym is assigned in e
+enum { INCREMENTED = 1, DECREMENTED = 2, ASSIGNED = 4 };
+
+static int assignments(struct expr *e, int sym);
+
+static int vect_assignments(struct expr_vect *ve, int sym)
+{
+  int kind = 0;
+  for (; ve != NULL; ve = ve->next_expr)
+    kind |= assignments(ve->curr_expr, sym);
+  return kind;
+}
+
+static int assignments(struct expr *e, int sym)
+{
+  switch (e->type) {
+  case CALL:
+    return vect_assignments(e->call.args, sym);
+
+  case LET:
+  case VAR:
+    // an inner binding of sym hides it in its body
+    return assignments(e->let.expr, sym) | (e->let.ident == sym ? 0 : assignments(e->let.body, sym));
+
+  case ASSIGN: {
+    struct expr *rhs = e->assign.expr;
+    int kind = assignments(rhs, sym);
+    if (e->assign.ident != sym)
+      return kind;
+    // sym := sym + c or sym := sym - c, with c >= 0
+    if (rhs->type == BIN_OP && (rhs->binop.op == '+' || rhs->binop.op == '-') &&
+        rhs->binop.lhs->type == IDENT && rhs->binop.lhs->ident == sym &&
+        rhs->binop.rhs->is_const && rhs->binop.rhs->const_value >= 0)
+      return kind | (rhs->binop.op == '+' ? INCREMENTED : DECREMENTED);
+    return kind | ASSIGNED;
+  }
+
+  case IF:
+    return assignments(e->if_expr.cond, sym) | assignments(e->if_expr.e_true, sym) |
+           assignments(e->if_expr.e_false, sym);
+
+  case WHILE:
+    return assignments(e->while_expr.cond, sym) | assignments(e->while_expr.body, sym);
+
+  case UN_OP:
+    return assignments(e->unop.expr, sym);
+
+  case BIN_OP:
+    return assignments(e->binop.lhs, sym) | assignments(e->binop.rhs, sym);
+
+  case VECTOR:
+  case SEQ:
+    return vect_assignments(e->vect, sym);
+
+  case SUGARED_VECTOR_BUILD_OP:
+    return vect_assignments(e->vect_build.sample, sym) | assignments(e->vect_build.len, sym);
+
+  case PARALLEL_FOR:
+    return assignments(e->par_for.from, sym) | assignments(e->par_for.to, sym) |
+           (e->par_for.ident == sym ? 0 : assignments(e->par_for.body, sym));
+
+  case TILED_FOR:
+    return assignments(e->tiled_for.from, sym) | assignments(e->tiled_for.to, sym) |
+           assignments(e->tiled_for.col_from, sym) | assignments(e->tiled_for.col_to, sym) |
+           (e->tiled_for.tile != NULL ? assignments(e->tiled_for.tile, sym) : 0) |
+           (e->tiled_for.row == sym || e->tiled_for.col == sym ? 0 : assignments(e->tiled_for.body, sym));
+
+  case VECTOR_ACCESS_OP:
+    return assignments(e->vect_access.base, sym) | assignments(e->vect_access.offset, sym) |
+           (e->vect_access.col != NULL ? assignments(e->vect_access.col, sym) : 0);
+
+  case VECTOR_UPDATE_OP:
+    return assignments(e->vect_update.base, sym) | assignments(e->vect_update.offset, sym) |
+           (e->vect_update.col != NULL ? assignments(e->vect_update.col, sym) : 0) |
+           assignments(e->vect_update.rhs, sym);
+
+  default:
+    return 0;
+  }
+}
+
+// the variables e may assign fall back to their base fact: e may run a
+// number of times that is not known, or not at all
+static void invalidate(struct expr *e, struct env *env);
+
+static void invalidate_vect(struct expr_vect *ve, struct env *env)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    invalidate(ve->curr_expr, env);
+}
+
+static void invalidate(struct expr *e, struct env *env)
+{
+  switch (e->type) {
+  case CALL:
+    invalidate_vect(e->call.args, env);
+    break;
+
+  case LET:
+  case VAR:
+    invalidate(e->let.expr, env);
+    invalidate(e->let.body, env);
+    break;
+
+  case ASSIGN: {
+    struct fact *f = resolve(env, e->assign.ident);
+    if (f != NULL)
+      f->current = f->base;
+    invalidate(e->assign.expr, env);
+    break;
+  }
+
+  case IF:
+    invalidate(e->if_expr.cond, env);
+    invalidate(e->if_expr.e_true, env);
+    invalidate(e->if_expr.e_false, env);
+    break;
+
+  case WHILE:
+    invalidate(e->while_expr.cond, env);
+    invalidate(e->while_expr.body, env);
+    break;
+
+  case UN_OP:
+    invalidate(e->unop.expr, env);
+    break;
+
+  case BIN_OP:
+    invalidate(e->binop.lhs, env);
+    invalidate(e->binop.rhs, env);
+    break;
+
+  case VECTOR:
+  case SEQ:
+    invalidate_vect(e->vect, env);
+    break;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    invalidate_vect(e->vect_build.sample, env);
+    invalidate(e->vect_build.len, env);
+    break;
+
+  case PARALLEL_FOR:
+    invalidate(e->par_for.from, env);
+    invalidate(e->par_for.to, env);
+    invalidate(e->par_for.body, env);
+    break;
+
+  case TILED_FOR:
+    invalidate(e->tiled_for.from, env);
+    invalidate(e->tiled_for.to, env);
+    invalidate(e->tiled_for.col_from, env);
+    invalidate(e->tiled_for.col_to, env);
+    if (e->tiled_for.tile != NULL)
+      invalidate(e->tiled_for.tile, env);
+    invalidate(e->tiled_for.body, env);
+    break;
+
+  case VECTOR_ACCESS_OP:
+    invalidate(e->vect_access.base, env);
+    invalidate(e->vect_access.offset, env);
+    if (e->vect_access.col != NULL)
+      invalidate(e->vect_access.col, env);
+    break;
+
+  case VECTOR_UPDATE_OP:
+    invalidate(e->vect_update.base, env);
+    invalidate(e->vect_update.offset, env);
+    if (e->vect_update.col != NULL)
+      invalidate(e->vect_update.col, env);
+    invalidate(e->vect_update.rhs, env);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// the facts a condition narrows in the branch where it holds, restored
+// when leaving that branch
+#define MAX_NARROWED 8
+
+struct narrowing {
+  unsigned n;
+  struct fact *facts[MAX_NARROWED];
+  struct interval saved[MAX_NARROWED];
+};
+
+static void narrow(struct narrowing *nw, struct expr *e, struct env *env, long long lo, long long hi)
+{
+  struct fact *f = e->type == IDENT ? resolve(env, e->ident) : NULL;
+  if (f == NULL || nw->n == MAX_NARROWED)
+    return;
+  nw->facts[nw->n] = f;
+  nw->saved[nw->n++] = f->current;
+  f->current = intersect(f->current, (struct interval){ lo, hi });
+}
+
+static void restore(struct narrowing *nw)
+{
+  while (nw->n > 0) {
+    --nw->n;
+    nw->facts[nw->n]->current = nw->saved[nw->n];
+  }
+}
+
+static void narrow_cond(struct narrowing *nw, struct expr *cond, struct env *env)
+{
+  if (cond->type != BIN_OP)
+    return;
+
+  struct expr *lhs = cond->binop.lhs;
+  struct expr *rhs = cond->binop.rhs;
+  if (cond->binop.op == AND_SC || cond->binop.op == AND) {
+    narrow_cond(nw, lhs, env);
+    narrow_cond(nw, rhs, env);
+    return;
+  }
+  if (lhs->vtype != INTEGER || rhs->vtype != INTEGER)
+    return;
+
+  struct interval l = range(lhs, env);
+  struct interval r = range(rhs, env);
+  switch (cond->binop.op) {
+  case '<':
+    narrow(nw, lhs, env, INT_MIN, r.hi - 1);
+    narrow(nw, rhs, env, l.lo + 1, INT_MAX);
+    break;
+  case '>':
+    narrow(nw, lhs, env, r.lo + 1, INT_MAX);
+    narrow(nw, rhs, env, INT_MIN, l.hi - 1);
+    break;
+  case LE:
+    narrow(nw, lhs, env, INT_MIN, r.hi);
+    narrow(nw, rhs, env, l.lo, INT_MAX);
+    break;
+  case GE:
+    narrow(nw, lhs, env, r.lo, INT_MAX);
+    narrow(nw, rhs, env, INT_MIN, l.hi);
+    break;
+  case '=':
+    narrow(nw, lhs, env, r.lo, r.hi);
+    narrow(nw, rhs, env, l.lo, l.hi);
+    break;
+  }
+}
+
+static int fits(struct interval idx, struct expr *vect)
+{
+  return vect->len >= 0 && idx.lo >= 0 && idx.hi < vect->len;
+}
+
+// the same for the element row, col of a matrix
+static int fits_matrix(struct interval row, struct interval col, struct expr *matrix)
+{
+  return matrix->len >= 0 && row.lo >= 0 && row.hi < matrix->len / matrix->cols &&
+         col.lo >= 0 && col.hi < matrix->cols;
+}
+
+static void analyse(struct expr *e, struct bounds *b);
+
+// the fact of an index going from the lowest value of from to the highest
+// of to, excluded
+static struct fact index_fact(struct expr *from, struct expr *to, struct bounds *b)
+{
+  struct interval lo = range(from, b->env);
+  struct interval hi = range(to, b->env);
+  analyse(from, b);
+  analyse(to, b);
+  struct interval idx = make_interval(lo.lo, hi.hi - 1);
+  return (struct fact){ idx, idx, NULL };
+}
+
+static void analyse_vect(struct expr_vect *ve, struct bounds *b)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    analyse(ve->curr_expr, b);
+}
+
+static void analyse(struct expr *e, struct bounds *b)
+{
+  switch (e->type) {
+  case CALL:
+    analyse_vect(e->call.args, b);
+    break;
+
+  case LET:
+  case VAR: {
+    struct interval init = range(e->let.expr, b->env);
+    analyse(e->let.expr, b);
+
+    struct fact f = { init, init, NULL };
+    if (e->type == VAR) {
+      int kind = assignments(e->var.body, e->var.ident);
+      if (kind == INCREMENTED && !wraps(b, e)) {
+        f.base = make_interval(init.lo, INT_MAX);
+        f.var = e;
+      } else if (kind == DECREMENTED && !wraps(b, e)) {
+        f.base = make_interval(INT_MIN, init.hi);
+        f.var = e;
+      } else if (kind != 0) {
+        f.base = unknown;
+      }
+    }
+    push(b->env, e->let.ident, &f);
+    analyse(e->let.body, b);
+    pop(b->env);
+    break;
+  }
+
+  case ASSIGN: {
+    struct interval value = range(e->assign.expr, b->env);
+    analyse(e->assign.expr, b);
+    struct fact *f = resolve(b->env, e->assign.ident);
+    if (f == NULL)
+      break;
+    if (f->var != NULL && value.lo == unknown.lo && value.hi == unknown.hi) {
+      if (b->n_wrapping == b->cap) {
+        b->cap = b->cap ? 2 * b->cap : 4;
+        b->wrapping = realloc(b->wrapping, sizeof(struct expr *) * b->cap);
+      }
+      b->wrapping[b->n_wrapping++] = f->var;
+      b->again = 1;
+    }
+    f->current = intersect(value, f->base);
+    break;
+  }
+
+  case IF: {
+    struct narrowing nw = { 0 };
+    analyse(e->if_expr.cond, b);
+    if (pure(e->if_expr.cond))
+      narrow_cond(&nw, e->if_expr.cond, b->env);
+    analyse(e->if_expr.e_true, b);
+    restore(&nw);
+    invalidate(e->if_expr.e_true, b->env);
+    analyse(e->if_expr.e_false, b);
+    invalidate(e->if_expr.e_false, b->env);
+    break;
+  }
+
+  case WHILE: {
+    // what holds when entering the loop must hold after every iteration
+    struct narrowing nw = { 0 };
+    invalidate(e, b->env);
+    analyse(e->while_expr.cond, b);
+    if (pure(e->while_expr.cond))
+      narrow_cond(&nw, e->while_expr.cond, b->env);
+    analyse(e->while_expr.body, b);
+    restore(&nw);
+    invalidate(e, b->env);
+    break;
+  }
+
+  case UN_OP:
+    analyse(e->unop.expr, b);
+    break;
+
+  case BIN_OP:
+    analyse(e->binop.lhs, b);
+    analyse(e->binop.rhs, b);
+    // the right operand of && and || may not be evaluated
+    if (e->binop.op == AND_SC || e->binop.op == OR_SC)
+      invalidate(e->binop.rhs, b->env);
+    break;
+
+  case VECTOR:
+  case SEQ:
+    analyse_vect(e->vect, b);
+    break;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    // the sample is evaluated once per round
+    analyse(e->vect_build.len, b);
+    invalidate_vect(e->vect_build.sample, b->env);
+    analyse_vect(e->vect_build.sample, b);
+    invalidate_vect(e->vect_build.sample, b->env);
+    break;
+
+  case PARALLEL_FOR: {
+    // the body cannot assign the variables around it
+    struct fact f = index_fact(e->par_for.from, e->par_for.to, b);
+    push(b->env, e->par_for.ident, &f);
+    analyse(e->par_for.body, b);
+    pop(b->env);
+    break;
+  }
+
+  case TILED_FOR: {
+    // the bounds are evaluated once, the body may run any number of times
+    struct fact row = index_fact(e->tiled_for.from, e->tiled_for.to, b);
+    struct fact col = index_fact(e->tiled_for.col_from, e->tiled_for.col_to, b);
+    if (e->tiled_for.tile != NULL)
+      analyse(e->tiled_for.tile, b);
+    invalidate(e->tiled_for.body, b->env);
+    push(b->env, e->tiled_for.row, &row);
+    push(b->env, e->tiled_for.col, &col);
+    analyse(e->tiled_for.body, b);
+    pop(b->env);
+    pop(b->env);
+    invalidate(e->tiled_for.body, b->env);
+    break;
+  }
+
+  case VECTOR_ACCESS_OP: {
+    analyse(e->vect_access.base, b);
+    struct interval idx = range(e->vect_access.offset, b->env);
+    analyse(e->vect_access.offset, b);
+    if (e->vect_access.col != NULL) {
+      struct interval col = range(e->vect_access.col, b->env);
+      analyse(e->vect_access.col, b);
+      e->in_bounds = fits_matrix(idx, col, e->vect_access.base);
+    } else {
+      e->in_bounds = fits(idx, e->vect_access.base);
+    }
+    break;
+  }
+
+  case VECTOR_UPDATE_OP: {
+    analyse(e->vect_update.base, b);
+    struct interval idx = range(e->vect_update.offset, b->env);
+    analyse(e->vect_update.offset, b);
+    struct interval col = unknown;
+    if (e->vect_update.col != NULL) {
+      col = range(e->vect_update.col, b->env);
+      analyse(e->vect_update.col, b);
+    }
+    analyse(e->vect_update.rhs, b);
+    e->in_bounds = e->vect_update.col != NULL ? fits_matrix(idx, col, e->vect_update.base)
+                                              : fits(idx, e->vect_update.base);
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+void analyse_bounds(struct expr *e, struct env *env)
+{
+  struct bounds b = { env, NULL, 0, 0, 0 };
+  do {
+    b.again = 0;
+    analyse(e, &b);
+  } while (b.again);
+  free(b.wrapping);
+}
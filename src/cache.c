@@ -0,0 +1,166 @@
+#include <llvm-c/Analysis.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "cache.h"
+
+#define CACHE_SUFFIX ".bc"
+
+// the total size of the entries in the directory, and the path of the least
+// recently used one in oldest (empty when there is none)
+static unsigned long long scan(const char *dir_path, char *oldest, size_t size)
+{
+  unsigned long long total = 0;
+  time_t oldest_time = 0;
+  oldest[0] = '\0';
+
+  DIR *dir = opendir(dir_path);
+  if (dir == NULL)
+    return 0;
+
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL) {
+    size_t len = strlen(d->d_name);
+    if (len < strlen(CACHE_SUFFIX) || strcmp(d->d_name + len - strlen(CACHE_SUFFIX), CACHE_SUFFIX) != 0)
+      continue;
+
+    char path[4096];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir_path, d->d_name);
+    if (stat(path, &st) != 0)
+      continue;
+
+    total += st.st_size;
+    if (oldest[0] == '\0' || st.st_mtime < oldest_time) {
+      oldest_time = st.st_mtime;
+      snprintf(oldest, size, "%s", path);
+    }
+  }
+  closedir(dir);
+  return total;
+}
+
+struct code_cache *cache_open(const char *dir, unsigned long long max_bytes)
+{
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    perror(dir);
+    return NULL;
+  }
+
+  struct code_cache *cache = malloc(sizeof(struct code_cache));
+  cache->dir = strdup(dir);
+  cache->max_bytes = max_bytes;
+  char oldest[4096];
+  cache->total_bytes = scan(dir, oldest, sizeof(oldest));
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  pthread_mutex_init(&cache->lock, NULL);
+
+  return cache;
+}
+
+void cache_close(struct code_cache *cache)
+{
+  fprintf(stderr, "code cache: %lu hits, %lu misses, %lu evictions\n",
+          cache->hits, cache->misses, cache->evictions);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->dir);
+  free(cache);
+}
+
+static void entry_path(struct code_cache *cache, uint64_t key, char *path, size_t size)
+{
+  snprintf(path, size, "%s/%016llx" CACHE_SUFFIX, cache->dir, (unsigned long long)key);
+}
+
+static void count(struct code_cache *cache, unsigned long *counter)
+{
+  pthread_mutex_lock(&cache->lock);
+  ++*counter;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+LLVMModuleRef cache_lookup(struct code_cache *cache, uint64_t key, LLVMContextRef ctx)
+{
+  char path[4096];
+  entry_path(cache, key, path, sizeof(path));
+
+  LLVMMemoryBufferRef buffer;
+  char *error = NULL;
+  if (LLVMCreateMemoryBufferWithContentsOfFile(path, &buffer, &error)) {
+    LLVMDisposeMessage(error);
+    count(cache, &cache->misses);
+    return NULL;
+  }
+
+  // LLVMParseBitcodeInContext2 hands the errors to the diagnostic handler
+  // of the context, which exits on them: this reader returns them instead
+  LLVMModuleRef module;
+  int failed = LLVMParseBitcodeInContext(ctx, buffer, &module, &error);
+  LLVMDisposeMemoryBuffer(buffer);
+  if (!failed) {
+    // nor is a module that parses but does not verify run
+    failed = LLVMVerifyModule(module, LLVMReturnStatusAction, &error);
+    if (failed)
+      LLVMDisposeModule(module);
+  }
+  if (error != NULL)
+    LLVMDisposeMessage(error);
+  if (failed) {
+    // a corrupted entry is just a miss, it will be overwritten
+    count(cache, &cache->misses);
+    return NULL;
+  }
+
+  // the modification time orders the entries for eviction
+  utime(path, NULL);
+  count(cache, &cache->hits);
+  return module;
+}
+
+// remove the least recently used entries until the cache fits in its bound;
+// the scans also catch up with the entries other runs stored meanwhile
+static void evict(struct code_cache *cache)
+{
+  while (cache->total_bytes > cache->max_bytes) {
+    char oldest[4096];
+    struct stat st;
+    cache->total_bytes = scan(cache->dir, oldest, sizeof(oldest));
+    if (cache->total_bytes <= cache->max_bytes || oldest[0] == '\0'
+        || stat(oldest, &st) != 0 || remove(oldest) != 0)
+      return;
+    cache->total_bytes -= st.st_size;
+    ++cache->evictions;
+  }
+}
+
+void cache_store(struct code_cache *cache, uint64_t key, LLVMModuleRef module)
+{
+  char path[4096], tmp[4200];
+  entry_path(cache, key, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+  // write aside and rename, so that concurrent runs never read half an entry;
+  // the threads of a run store one at a time
+  pthread_mutex_lock(&cache->lock);
+  struct stat old, st;
+  off_t replaced = stat(path, &old) == 0 ? old.st_size : 0;
+  if (LLVMWriteBitcodeToFile(module, tmp) != 0 || rename(tmp, path) != 0) {
+    remove(tmp);
+  } else {
+    if (stat(path, &st) == 0)
+      cache->total_bytes += st.st_size - replaced;
+    evict(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,38 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <llvm-c/Core.h>
+
+// On-disk cache of compiled expressions. An entry is the optimised module
+// of an expression, stored as bitcode under a key that combines the
+// structural hash of the expression with everything else the code depends
+// on (optimisation level, LLVM version, target). On a hit the module is
+// loaded back, skipping both codegen and the optimisation pipeline.
+//
+// The total size of the entries is kept under a bound by evicting the least
+// recently used ones.
+struct code_cache {
+  char *dir;
+  unsigned long long max_bytes;
+  // the size of the entries, scanned at open and then kept up to date, so
+  // that only a store that goes over the bound reads the directory
+  unsigned long long total_bytes;
+
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+
+  // the cache is shared by the threads of --batch
+  pthread_mutex_t lock;
+};
+
+struct code_cache *cache_open(const char *dir, unsigned long long max_bytes);
+void cache_close(struct code_cache *cache);
+
+// returns the cached module for key, loaded in ctx, or NULL
+LLVMModuleRef cache_lookup(struct code_cache *cache, uint64_t key, LLVMContextRef ctx);
+void cache_store(struct code_cache *cache, uint64_t key, LLVMModuleRef module);
+
+#endif
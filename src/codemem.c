@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "codemem.h"
+
+#define CODE_CHUNK_SIZE (64 * 1024)
+
+enum { CODE, RODATA, DATA, N_KINDS };
+
+struct code_chunk {
+  struct code_chunk *next;
+  unsigned char *base;
+  size_t size;
+  size_t used;        // bytes handed out
+  size_t protected;   // bytes given their final protection
+};
+
+static unsigned long long total_mapped;
+
+static size_t page_round(size_t n)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (n + page - 1) & ~(page - 1);
+}
+
+static uint8_t *allocate(struct code_memory *mem, int kind, uintptr_t size, unsigned alignment)
+{
+  if (alignment == 0)
+    alignment = 16;
+
+  struct code_chunk *c = mem->chunks[kind];
+  size_t offset = c != NULL ? (c->used + alignment - 1) & ~(size_t)(alignment - 1) : 0;
+  if (c == NULL || offset + size > c->size) {
+    size_t chunk_size = page_round(size > CODE_CHUNK_SIZE ? size : CODE_CHUNK_SIZE);
+    void *base = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      return NULL;
+
+    c = malloc(sizeof(struct code_chunk));
+    c->next = mem->chunks[kind];
+    c->base = base;
+    c->size = chunk_size;
+    c->used = 0;
+    c->protected = 0;
+    mem->chunks[kind] = c;
+    __atomic_add_fetch(&total_mapped, chunk_size, __ATOMIC_RELAXED);
+    offset = 0;
+  }
+
+  c->used = offset + size;
+  return c->base + offset;
+}
+
+static uint8_t *allocate_code( void *opaque
+                             , uintptr_t size
+                             , unsigned alignment
+                             , unsigned section_id
+                             , const char *section_name)
+{
+  struct code_memory *mem = opaque;
+  mem->code_bytes += size;
+  return allocate(mem, CODE, size, alignment);
+}
+
+static uint8_t *allocate_data( void *opaque
+                             , uintptr_t size
+                             , unsigned alignment
+                             , unsigned section_id
+                             , const char *section_name
+                             , LLVMBool read_only)
+{
+  struct code_memory *mem = opaque;
+  mem->data_bytes += size;
+  return allocate(mem, read_only ? RODATA : DATA, size, alignment);
+}
+
+// the sections handed out since the last call get their final protection;
+// the pages they end in are not shared with the next module
+static LLVMBool finalize(void *opaque, char **error)
+{
+  static const int prot[N_KINDS] = { PROT_READ | PROT_EXEC, PROT_READ, PROT_READ | PROT_WRITE };
+  struct code_memory *mem = opaque;
+
+  for (int kind = 0; kind < N_KINDS; ++kind) {
+    // the older chunks are done with
+    for (struct code_chunk *c = mem->chunks[kind]; c != NULL && c->protected < c->used; c = c->next) {
+      size_t end = page_round(c->used);
+      if (mprotect(c->base + c->protected, end - c->protected, prot[kind]) != 0) {
+        *error = strdup("cannot protect the jit memory");
+        return 1;
+      }
+      if (kind == CODE)
+        __builtin___clear_cache((char *)c->base + c->protected, (char *)c->base + end);
+      c->used = c->protected = end;
+    }
+  }
+  return 0;
+}
+
+static void destroy(void *opaque)
+{
+  struct code_memory *mem = opaque;
+  for (int kind = 0; kind < N_KINDS; ++kind) {
+    while (mem->chunks[kind] != NULL) {
+      struct code_chunk *next = mem->chunks[kind]->next;
+      munmap(mem->chunks[kind]->base, mem->chunks[kind]->size);
+      free(mem->chunks[kind]);
+      mem->chunks[kind] = next;
+    }
+  }
+  free(mem);
+}
+
+LLVMMCJITMemoryManagerRef code_memory_create(struct code_memory **mem)
+{
+  *mem = calloc(1, sizeof(struct code_memory));
+  return LLVMCreateSimpleMCJITMemoryManager(*mem, allocate_code, allocate_data, finalize, destroy);
+}
+
+unsigned long long code_memory_mapped(void)
+{
+  return __atomic_load_n(&total_mapped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,27 @@
+#ifndef CODEMEM_H
+#define CODEMEM_H
+
+#include <llvm-c/ExecutionEngine.h>
+
+// The memory an MCJIT engine emits its machine code and data into: sections
+// are bump allocated in chunks mapped from the system, and given their final
+// protection (code executable, constants read-only) once the engine is done
+// with a module. Every section is counted, for --stats.
+struct code_chunk;
+
+struct code_memory {
+  struct code_chunk *chunks[3];   // code, read-only and writable data
+
+  // counters, since the creation of the engine
+  unsigned long long code_bytes;    // machine code sections
+  unsigned long long data_bytes;    // data sections
+};
+
+// the memory manager to create an engine with, through the MCJMM option;
+// the engine owns it, mem is released along with the engine
+LLVMMCJITMemoryManagerRef code_memory_create(struct code_memory **mem);
+
+// the bytes mapped by the memory managers of all the engines so far
+unsigned long long code_memory_mapped(void);
+
+#endif
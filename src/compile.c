@@ -0,0 +1,322 @@
+#include <llvm/Config/llvm-config.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/Transforms/InstCombine.h>
+#include <llvm-c/Transforms/PassManagerBuilder.h>
+#include <llvm-c/Transforms/Scalar.h>
+#include <llvm-c/Transforms/Vectorize.h>
+#if LLVM_VERSION_MAJOR >= 7
+#include <llvm-c/Transforms/Utils.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+#include "profile.h"
+
+void declare_runtime(LLVMModuleRef module)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMTypeRef one_i32_arg[] = {LLVMInt32TypeInContext(ctx)};
+
+  LLVMAddFunction(module, "print_i32",
+                  LLVMFunctionType(LLVMVoidTypeInContext(ctx), one_i32_arg, 1, 0));
+
+  LLVMAddFunction(module, "read_i32",
+                  LLVMFunctionType(LLVMInt32TypeInContext(ctx), one_i32_arg, 1, 0));
+
+  LLVMAddFunction(module, "read_vec",
+                  LLVMFunctionType(llvm_rt_vect_type(ctx, INTEGER), one_i32_arg, 1, 0));
+
+  LLVMTypeRef print_vec_args[] = {LLVMPointerType(LLVMInt32TypeInContext(ctx), 0), LLVMInt32TypeInContext(ctx)};
+  LLVMAddFunction(module, "print_vec",
+                  LLVMFunctionType(LLVMVoidTypeInContext(ctx), print_vec_args, 2, 0));
+
+  LLVMTypeRef two_i32_args[] = {LLVMInt32TypeInContext(ctx), LLVMInt32TypeInContext(ctx)};
+
+  LLVMAddFunction(module, "vect_alloc",
+                  LLVMFunctionType(LLVMPointerType(LLVMInt8TypeInContext(ctx), 0), two_i32_args, 2, 0));
+
+  // parallel for: the outlined body, run on chunks of the indices, see
+  // parallel.h
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+  LLVMTypeRef body_args[] = {i8_ptr, LLVMInt32TypeInContext(ctx), LLVMInt32TypeInContext(ctx)};
+  LLVMTypeRef body_type = LLVMPointerType(LLVMFunctionType(LLVMInt32TypeInContext(ctx), body_args, 3, 0), 0);
+  LLVMTypeRef par_args[] = {body_type, i8_ptr, LLVMInt32TypeInContext(ctx), LLVMInt32TypeInContext(ctx),
+                            LLVMInt32TypeInContext(ctx)};
+
+  LLVMAddFunction(module, "par_for",
+                  LLVMFunctionType(LLVMVoidTypeInContext(ctx), par_args, 4, 0));
+
+  LLVMAddFunction(module, "par_reduce",
+                  LLVMFunctionType(LLVMInt32TypeInContext(ctx), par_args, 5, 0));
+
+  // the failed bounds checks of --checked and the vectors too long to be
+  // built, out of the way of the hot paths
+  LLVMTypeRef one_i64_arg[] = {LLVMInt64TypeInContext(ctx)};
+  LLVMTypeRef four_i32_args[] = {LLVMInt32TypeInContext(ctx), LLVMInt32TypeInContext(ctx),
+                                 LLVMInt32TypeInContext(ctx), LLVMInt32TypeInContext(ctx)};
+  LLVMValueRef index_errors[] = {
+    LLVMAddFunction(module, "vect_index_error",
+                    LLVMFunctionType(LLVMVoidTypeInContext(ctx), two_i32_args, 2, 0)),
+    LLVMAddFunction(module, "matrix_index_error",
+                    LLVMFunctionType(LLVMVoidTypeInContext(ctx), four_i32_args, 4, 0)),
+    LLVMAddFunction(module, "vect_length_error",
+                    LLVMFunctionType(LLVMVoidTypeInContext(ctx), one_i64_arg, 1, 0)),
+  };
+  static const char *const attrs[] = { "noreturn", "cold", "nounwind" };
+  for (unsigned k = 0; k < sizeof(index_errors) / sizeof(index_errors[0]); ++k) {
+    for (unsigned i = 0; i < sizeof(attrs) / sizeof(attrs[0]); ++i) {
+      unsigned kind = LLVMGetEnumAttributeKindForName(attrs[i], strlen(attrs[i]));
+      LLVMAddAttributeAtIndex(index_errors[k], LLVMAttributeFunctionIndex,
+                              LLVMCreateEnumAttribute(ctx, kind, 0));
+    }
+  }
+}
+
+LLVMTypeRef result_type_of(LLVMContextRef ctx, struct expr *e)
+{
+  return e->vtype == VECT ? llvm_rt_vect_type(ctx, e->elem_vtype) : llvm_type_of(ctx, e);
+}
+
+// a vector result cannot be returned by pointer to its stack slot: copy it
+// in a runtime vector
+static LLVMValueRef build_vect_result( struct expr *expr
+                                     , LLVMValueRef vect
+                                     , LLVMModuleRef module
+                                     , LLVMBuilderRef builder)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  unsigned elem_size = expr->elem_vtype == INTEGER ? 4 : 1;
+
+  LLVMValueRef args[] = {
+    LLVMConstInt(LLVMInt32TypeInContext(ctx), expr->len, 0),
+    LLVMConstInt(LLVMInt32TypeInContext(ctx), elem_size, 0),
+  };
+  LLVMValueRef raw = LLVMBuildCall(builder, LLVMGetNamedFunction(module, "vect_alloc"), args, 2, "");
+  LLVMValueRef result = LLVMBuildBitCast(builder, raw, llvm_rt_vect_type(ctx, expr->elem_vtype), "");
+
+  LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(ctx), 0, 0);
+  LLVMValueRef dst_idxs[] = { zero, LLVMConstInt(LLVMInt32TypeInContext(ctx), 1, 0), zero };
+  LLVMValueRef src_idxs[] = { zero, zero };
+  LLVMValueRef dst = LLVMBuildInBoundsGEP2(builder, LLVMGetElementType(LLVMTypeOf(result)), result, dst_idxs, 3, "");
+  LLVMValueRef src = LLVMBuildInBoundsGEP2(builder, LLVMGetElementType(LLVMTypeOf(vect)), vect, src_idxs, 2, "");
+  LLVMBuildMemCpy(builder, dst, 1, src, 1, LLVMConstInt(LLVMInt32TypeInContext(ctx), expr->len * elem_size, 0));
+
+  return result;
+}
+
+int check_expr(struct expr *expr, struct env *env)
+{
+  // annotate the expression with its type, so that code is generated once
+  if (typecheck_expr(expr, env) == ERROR)
+    return 1;
+  fold_expr(expr);
+  // a vector result is copied out by build_vect_result
+  mark_transient(expr, 1);
+  if (profile_mode != PROFILE_OFF)
+    profile_attach(expr, hash_expr(HASH_SEED, expr));
+  if (bounds_checks)
+    analyse_bounds(expr, env);
+  return 0;
+}
+
+LLVMValueRef compile_expr( struct expr *expr
+                         , struct env *env
+                         , const char *name
+                         , LLVMModuleRef module)
+{
+  if (check_expr(expr, env))
+    return NULL;
+  return codegen_toplevel(expr, env, name, module);
+}
+
+LLVMValueRef codegen_toplevel( struct expr *expr
+                             , struct env *env
+                             , const char *name
+                             , LLVMModuleRef module)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+
+  // LLVM can only emit instructions in basic blocks
+  //   basic blocks are always part of a function
+  //   function are contained in modules
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(ctx);
+
+  // emit expression as function body
+  LLVMTypeRef type = result_type_of(ctx, expr);
+  LLVMTypeRef actual_f_type = LLVMFunctionType(type, NULL, 0, 0);
+  LLVMValueRef f = LLVMAddFunction(module, name, actual_f_type);
+  LLVMBasicBlockRef entry_bb = LLVMAppendBasicBlockInContext(ctx, f, "entry");
+  LLVMPositionBuilderAtEnd(builder, entry_bb);
+  LLVMValueRef ret = codegen_expr(expr, env, module, builder);
+  if (expr->vtype == VECT && expr->len >= 0)
+    ret = build_vect_result(expr, ret, module, builder);
+
+  // booleans are handed over to C as bool, which has to be zero extended
+  if (expr->vtype == BOOLEAN) {
+    unsigned zeroext = LLVMGetEnumAttributeKindForName("zeroext", 7);
+    LLVMAddAttributeAtIndex(f, LLVMAttributeReturnIndex, LLVMCreateEnumAttribute(ctx, zeroext, 0));
+  }
+
+  // return the result and terminate the function
+  if (LLVMGetTypeKind(type) == LLVMVoidTypeKind) {
+    LLVMBuildRetVoid(builder);
+  } else {
+    LLVMBuildRet(builder, ret);
+  }
+
+  LLVMDisposeBuilder(builder);
+  return f;
+}
+
+LLVMValueRef codegen_unit( struct expr *e
+                         , const struct unit_var *vars
+                         , unsigned n_vars
+                         , const char *name
+                         , LLVMModuleRef module)
+{
+  LLVMContextRef ctx = LLVMGetModuleContext(module);
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(ctx);
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+  LLVMTypeRef addr_type = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+  LLVMTypeRef arg_type = LLVMPointerType(addr_type, 0);
+
+  LLVMTypeRef type = result_type_of(ctx, e);
+  LLVMValueRef f = LLVMAddFunction(module, name, LLVMFunctionType(type, &arg_type, 1, 0));
+  LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(ctx, f, "entry"));
+
+  // the vars live in cells of their own while the unit runs, promoted to
+  // registers by the optimiser, and go back to the interpreter at the end
+  struct env *env = env_create();
+  LLVMValueRef *cells = malloc(sizeof(LLVMValueRef) * (n_vars + 1));
+  LLVMValueRef *slots = malloc(sizeof(LLVMValueRef) * (n_vars + 1));
+  for (unsigned k = 0; k < n_vars; ++k) {
+    LLVMValueRef idx = LLVMConstInt(i32, k, 0);
+    LLVMValueRef addr = LLVMBuildLoad(builder, LLVMBuildInBoundsGEP2(builder, addr_type, LLVMGetParam(f, 0), &idx, 1, ""), "");
+    const char *var_name = symbol_name(vars[k].sym);
+    cells[k] = NULL;
+
+    if (vars[k].type->vtype == VECT) {
+      push(env, vars[k].sym, LLVMBuildBitCast(builder, addr, llvm_type_of(ctx, vars[k].type), var_name));
+      continue;
+    }
+
+    slots[k] = LLVMBuildBitCast(builder, addr, LLVMPointerType(i32, 0), "");
+    LLVMValueRef val = LLVMBuildLoad(builder, slots[k], var_name);
+    if (vars[k].type->vtype == BOOLEAN)
+      val = LLVMBuildICmp(builder, LLVMIntNE, val, LLVMConstInt(i32, 0, 0), "");
+    if (vars[k].mutable) {
+      cells[k] = LLVMBuildAlloca(builder, LLVMTypeOf(val), var_name);
+      LLVMBuildStore(builder, val, cells[k]);
+      val = cells[k];
+    }
+    push(env, vars[k].sym, val);
+  }
+
+  LLVMValueRef ret = codegen_expr(e, env, module, builder);
+
+  for (unsigned k = 0; k < n_vars; ++k) {
+    if (cells[k] == NULL)
+      continue;
+    LLVMValueRef val = LLVMBuildLoad(builder, cells[k], "");
+    if (vars[k].type->vtype == BOOLEAN)
+      val = LLVMBuildZExt(builder, val, i32, "");
+    LLVMBuildStore(builder, val, slots[k]);
+  }
+
+  if (e->vtype == BOOLEAN) {
+    unsigned zeroext = LLVMGetEnumAttributeKindForName("zeroext", 7);
+    LLVMAddAttributeAtIndex(f, LLVMAttributeReturnIndex, LLVMCreateEnumAttribute(ctx, zeroext, 0));
+  }
+  if (LLVMGetTypeKind(type) == LLVMVoidTypeKind)
+    LLVMBuildRetVoid(builder);
+  else
+    LLVMBuildRet(builder, ret);
+
+  free(cells);
+  free(slots);
+  env_dispose(env);
+  LLVMDisposeBuilder(builder);
+  return f;
+}
+
+void prepare_module(LLVMModuleRef module, LLVMTargetMachineRef target)
+{
+  LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(target);
+  LLVMSetModuleDataLayout(module, data_layout);
+  LLVMDisposeTargetData(data_layout);
+
+  char *triple = LLVMGetTargetMachineTriple(target);
+  LLVMSetTarget(module, triple);
+  LLVMDisposeMessage(triple);
+}
+
+// fill in the optimisation pipelines for the given -O level
+static void add_passes( int level
+                      , LLVMTargetMachineRef target
+                      , LLVMPassManagerRef function_passes
+                      , LLVMPassManagerRef module_passes)
+{
+  // turn the self recursive tail calls of the functions into loops, at every
+  // level: deep recursions must not depend on -O. The returns are first
+  // folded into the branches of the ifs, where the calls are
+  LLVMAddCFGSimplificationPass(function_passes);
+  LLVMAddTailCallEliminationPass(function_passes);
+
+  if (level == 0)
+    return;
+
+  // let the optimisations use the cost model of the target
+  LLVMAddAnalysisPasses(target, function_passes);
+  LLVMAddAnalysisPasses(target, module_passes);
+
+  if (level == 1) {
+    // promote the var cells to registers
+    LLVMAddPromoteMemoryToRegisterPass(function_passes);
+    // Do simple "peephole" optimizations and bit-twiddling opti.
+    LLVMAddInstructionCombiningPass(function_passes);
+    // Reassociate expressions.
+    LLVMAddReassociatePass(function_passes);
+    // Eliminate Common SubExpressions.
+    LLVMAddGVNPass(function_passes);
+    // Simplify the control flow graph (deleting unreachable blocks, etc).
+    LLVMAddCFGSimplificationPass(function_passes);
+    return;
+  }
+
+  // -O2 and -O3: the standard function and module pipelines (SROA/mem2reg,
+  // instcombine, GVN, LICM, loop unrolling, inlining, ...)
+  LLVMPassManagerBuilderRef builder = LLVMPassManagerBuilderCreate();
+  LLVMPassManagerBuilderSetOptLevel(builder, level);
+  LLVMPassManagerBuilderUseInlinerWithThreshold(builder, level > 2 ? 250 : 225);
+  LLVMPassManagerBuilderPopulateFunctionPassManager(builder, function_passes);
+  LLVMPassManagerBuilderPopulateModulePassManager(builder, module_passes);
+  LLVMPassManagerBuilderDispose(builder);
+
+  // the C API cannot turn the vectorisers on in the builder: run them after
+  // the standard pipeline, followed by the usual clean up
+  LLVMAddLoopVectorizePass(module_passes);
+  LLVMAddSLPVectorizePass(module_passes);
+  LLVMAddInstructionCombiningPass(module_passes);
+  LLVMAddCFGSimplificationPass(module_passes);
+}
+
+void optimise_module(LLVMModuleRef module, int opt_level, LLVMTargetMachineRef target)
+{
+  LLVMPassManagerRef function_passes = LLVMCreateFunctionPassManagerForModule(module);
+  LLVMPassManagerRef module_passes = LLVMCreatePassManager();
+  add_passes(opt_level, target, function_passes, module_passes);
+
+  LLVMInitializeFunctionPassManager(function_passes);
+  for (LLVMValueRef f = LLVMGetFirstFunction(module); f != NULL; f = LLVMGetNextFunction(f)) {
+    if (LLVMCountBasicBlocks(f) > 0)
+      LLVMRunFunctionPassManager(function_passes, f);
+  }
+  LLVMFinalizeFunctionPassManager(function_passes);
+  LLVMRunPassManager(module_passes, module);
+
+  LLVMDisposePassManager(function_passes);
+  LLVMDisposePassManager(module_passes);
+}
@@ -0,0 +1,63 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include "ast.h"
+
+// The steps from a parsed expression to optimised IR, shared by the jit and
+// the ahead-of-time compiler.
+
+// declare the runtime functions the generated code may call
+void declare_runtime(LLVMModuleRef module);
+
+// typecheck e and emit it in module as a function called name, taking no
+// arguments and returning the value of e (vectors as a runtime vector);
+// returns NULL if e is not well typed
+LLVMValueRef compile_expr( struct expr *e
+                         , struct env *env
+                         , const char *name
+                         , LLVMModuleRef module);
+
+// the two halves of compile_expr: check_expr typechecks (and analyses the
+// bounds of) e, returns non zero if it is not well typed; codegen_toplevel
+// emits a checked expression. Only the latter may run on several threads
+// at once, each with its own module, context and env
+int check_expr(struct expr *e, struct env *env);
+LLVMValueRef codegen_toplevel( struct expr *e
+                             , struct env *env
+                             , const char *name
+                             , LLVMModuleRef module);
+
+// --tiered: a variable of the interpreter a unit reads, see codegen_unit
+struct unit_var {
+  int sym;
+  int mutable;          // a var, written back when the unit returns
+  struct expr *type;    // the node annotated with its type: the PARAM, or
+                        // the initial value of the LET or VAR
+};
+
+// emit the checked expression e, a loop or a call the interpreter found
+// hot, as a function called name of one argument: the array of the
+// addresses of the n_vars variables of vars, free in e. Scalars are read
+// from the int at their address, and vars are stored back there on return;
+// a vector is its elements when its length is static, its struct rt_vect
+// otherwise, and must not be assigned by e. Returns the value of e, which
+// is not a vector
+LLVMValueRef codegen_unit( struct expr *e
+                         , const struct unit_var *vars
+                         , unsigned n_vars
+                         , const char *name
+                         , LLVMModuleRef module);
+
+// the LLVM type compile_expr gives to the result of a typed expression
+LLVMTypeRef result_type_of(LLVMContextRef ctx, struct expr *e);
+
+// set up module to be optimised and compiled for target
+void prepare_module(LLVMModuleRef module, LLVMTargetMachineRef target);
+
+// run the -O opt_level pipelines on every function of module, then on the
+// module itself
+void optimise_module(LLVMModuleRef module, int opt_level, LLVMTargetMachineRef target);
+
+#endif
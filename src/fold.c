@@ -0,0 +1,397 @@
+#include "ast.h"
+#include "y.tab.h"
+
+// The nodes belong to the arena of the parser, so fold_expr never allocates:
+// a node is rewritten in place, into a literal or into a copy of one of its
+// children, which carries its own annotations.
+
+static void to_int(struct expr *e, int value)
+{
+  e->type = LITERAL;
+  e->value = value;
+  e->vtype = INTEGER;
+  e->is_const = 1;
+  e->const_value = value;
+}
+
+static void to_bool(struct expr *e, int value)
+{
+  e->type = LIT_BOOL;
+  e->value = value;
+  e->vtype = BOOLEAN;
+  e->is_const = 0;
+}
+
+// replace e by one of its children, unless the child is a vector whose
+// length is known where e is not: its uses expect the type of e
+static void replace(struct expr *e, struct expr *by)
+{
+  if (by->vtype == VECT && by->len != e->len)
+    return;
+  *e = *by;
+}
+
+static int pure(struct expr *e);
+
+static int pure_vect(struct expr_vect *ve)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    if (!pure(ve->curr_expr))
+      return 0;
+  return 1;
+}
+
+// whether dropping e cannot change what the program does: no call (it may
+// print, read or not return), no assignment, no loop (it may not end), and
+// no vector access that may fail at runtime
+static int pure(struct expr *e)
+{
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+  case IDENT:
+  case PARAM:
+    return 1;
+  case LET:
+  case VAR:
+    return pure(e->let.expr) && pure(e->let.body);
+  case IF:
+    return pure(e->if_expr.cond) && pure(e->if_expr.e_true) && pure(e->if_expr.e_false);
+  case UN_OP:
+    return pure(e->unop.expr);
+  case BIN_OP:
+    return pure(e->binop.lhs) && pure(e->binop.rhs);
+  case VECTOR:
+  case SEQ:
+    return pure_vect(e->vect);
+  case VECTOR_ACCESS_OP:
+    return !bounds_checks && pure(e->vect_access.base) && pure(e->vect_access.offset) &&
+           (e->vect_access.col == NULL || pure(e->vect_access.col));
+  case SUGARED_VECTOR_BUILD_OP:
+    return pure_vect(e->vect_build.sample) && pure(e->vect_build.len);
+  default:
+    return 0;
+  }
+}
+
+static int uses(struct expr *e, int sym);
+
+static int uses_vect(struct expr_vect *ve, int sym)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    if (uses(ve->curr_expr, sym))
+      return 1;
+  return 0;
+}
+
+// whether sym occurs in e, shadowed or not
+static int uses(struct expr *e, int sym)
+{
+  switch (e->type) {
+  case IDENT:
+    return e->ident == sym;
+  case ASSIGN:
+    return e->assign.ident == sym || uses(e->assign.expr, sym);
+  case CALL:
+    return uses_vect(e->call.args, sym);
+  case LET:
+  case VAR:
+    return uses(e->let.expr, sym) || uses(e->let.body, sym);
+  case IF:
+    return uses(e->if_expr.cond, sym) || uses(e->if_expr.e_true, sym) ||
+           uses(e->if_expr.e_false, sym);
+  case WHILE:
+    return uses(e->while_expr.cond, sym) || uses(e->while_expr.body, sym);
+  case UN_OP:
+    return uses(e->unop.expr, sym);
+  case BIN_OP:
+    return uses(e->binop.lhs, sym) || uses(e->binop.rhs, sym);
+  case VECTOR:
+  case SEQ:
+    return uses_vect(e->vect, sym);
+  case VECTOR_ACCESS_OP:
+    return uses(e->vect_access.base, sym) || uses(e->vect_access.offset, sym) ||
+           (e->vect_access.col != NULL && uses(e->vect_access.col, sym));
+  case VECTOR_UPDATE_OP:
+    return uses(e->vect_update.base, sym) || uses(e->vect_update.offset, sym) ||
+           (e->vect_update.col != NULL && uses(e->vect_update.col, sym)) ||
+           uses(e->vect_update.rhs, sym);
+  case SUGARED_VECTOR_BUILD_OP:
+    return uses_vect(e->vect_build.sample, sym) || uses(e->vect_build.len, sym);
+  case PARALLEL_FOR:
+    return uses(e->par_for.from, sym) || uses(e->par_for.to, sym) || uses(e->par_for.body, sym);
+  case TILED_FOR:
+    return uses(e->tiled_for.from, sym) || uses(e->tiled_for.to, sym) ||
+           uses(e->tiled_for.col_from, sym) || uses(e->tiled_for.col_to, sym) ||
+           (e->tiled_for.tile != NULL && uses(e->tiled_for.tile, sym)) ||
+           uses(e->tiled_for.body, sym);
+  default:
+    return 0;
+  }
+}
+
+// k if n is 2^k, -1 otherwise
+static int log2_exact(int n)
+{
+  if (n <= 0 || (n & (n - 1)) != 0)
+    return -1;
+  int k = 0;
+  while (n >>= 1)
+    ++k;
+  return k;
+}
+
+static int is_int(struct expr *e, int value)
+{
+  return e->type == LITERAL && e->value == value;
+}
+
+static void fold_comparison(struct expr *e)
+{
+  struct expr *lhs = e->binop.lhs;
+  struct expr *rhs = e->binop.rhs;
+  if (lhs->type != rhs->type || (lhs->type != LITERAL && lhs->type != LIT_BOOL))
+    return;
+
+  int l = lhs->value, r = rhs->value;
+  switch (e->binop.op) {
+  case '<': to_bool(e, l < r); break;
+  case '>': to_bool(e, l > r); break;
+  case LE:  to_bool(e, l <= r); break;
+  case GE:  to_bool(e, l >= r); break;
+  case '=': to_bool(e, l == r); break;
+  case NE:  to_bool(e, l != r); break;
+  }
+}
+
+// && and || (and & and | on bools) with a constant operand: the other
+// operand is kept whenever it is evaluated
+static void fold_logical(struct expr *e)
+{
+  struct expr *lhs = e->binop.lhs;
+  struct expr *rhs = e->binop.rhs;
+  int is_and = e->binop.op == AND_SC || e->binop.op == AND;
+  int short_circuit = e->binop.op == AND_SC || e->binop.op == OR_SC;
+
+  if (lhs->type == LIT_BOOL && rhs->type == LIT_BOOL)
+    to_bool(e, is_and ? lhs->value && rhs->value : lhs->value || rhs->value);
+  else if (lhs->type == LIT_BOOL && lhs->value == is_and)
+    replace(e, rhs);
+  else if (lhs->type == LIT_BOOL && (short_circuit || pure(rhs)))
+    to_bool(e, !is_and);
+  else if (rhs->type == LIT_BOOL && rhs->value == is_and)
+    replace(e, lhs);
+  else if (rhs->type == LIT_BOOL && pure(lhs))
+    to_bool(e, !is_and);
+}
+
+// x + 0, x * 1, ... are x; x * 0 is 0; the multiplications and unsigned
+// remainders by a power of 2 become shifts and masks
+static void strength_reduce(struct expr *e)
+{
+  struct expr *lhs = e->binop.lhs;
+  struct expr *rhs = e->binop.rhs;
+
+  switch (e->binop.op) {
+  case '+':
+    if (is_int(lhs, 0))
+      replace(e, rhs);
+    else if (is_int(rhs, 0))
+      replace(e, lhs);
+    break;
+
+  case '-':
+    if (is_int(rhs, 0))
+      replace(e, lhs);
+    break;
+
+  case '*': {
+    if (lhs->type == LITERAL && rhs->type != LITERAL) {
+      e->binop.lhs = rhs;
+      e->binop.rhs = rhs = lhs;
+      lhs = e->binop.lhs;
+    }
+    if (rhs->type != LITERAL)
+      break;
+    int k = log2_exact(rhs->value);
+    if (rhs->value == 0 && pure(lhs))
+      to_int(e, 0);
+    else if (k == 0)
+      replace(e, lhs);
+    else if (k > 0) {
+      e->binop.op = SHL_OP;
+      to_int(rhs, k);
+    }
+    break;
+  }
+
+  case '/':
+    if (is_int(rhs, 1))
+      replace(e, lhs);
+    break;
+
+  case MOD: {
+    // unsigned, so that x mod 2^k is x & (2^k - 1), whatever the sign of x
+    int k = rhs->type == LITERAL ? log2_exact(rhs->value) : -1;
+    if (k == 0 && pure(lhs))
+      to_int(e, 0);
+    else if (k > 0) {
+      e->binop.op = AND;
+      to_int(rhs, rhs->value - 1);
+    }
+    break;
+  }
+  }
+}
+
+static void fold_binop(struct expr *e)
+{
+  // element-wise operations are left to the vector code
+  if (e->vtype == VECT)
+    return;
+
+  switch (e->binop.op) {
+  case '<': case '>': case LE: case GE: case '=': case NE:
+    fold_comparison(e);
+    break;
+  case AND_SC: case OR_SC:
+    fold_logical(e);
+    break;
+  case AND: case OR:
+    if (e->vtype == BOOLEAN)
+      fold_logical(e);
+    break;
+  case '+': case '-': case '*': case '/': case MOD:
+    strength_reduce(e);
+    break;
+  }
+}
+
+static void fold_vect(struct expr_vect *ve)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    fold_expr(ve->curr_expr);
+}
+
+// the elements of a sequence but the last are only evaluated for their
+// effects: drop the ones without any
+static void fold_seq(struct expr *e)
+{
+  struct expr_vect **p = &e->vect;
+  while ((*p)->next_expr != NULL) {
+    if (pure((*p)->curr_expr))
+      *p = (*p)->next_expr;
+    else
+      p = &(*p)->next_expr;
+  }
+  if (e->vect->next_expr == NULL)
+    replace(e, e->vect->curr_expr);
+}
+
+void fold_expr(struct expr *e)
+{
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+  case PARAM:
+    return;
+
+  case IDENT:
+    // typecheck_expr knows the value of the lets bound to a constant
+    break;
+
+  case CALL:
+    fold_vect(e->call.args);
+    return;
+
+  case LET:
+  case VAR:
+    fold_expr(e->let.expr);
+    fold_expr(e->let.body);
+    // once the constant has been propagated, the binding is often dead
+    if (pure(e->let.expr) && !uses(e->let.body, e->let.ident))
+      replace(e, e->let.body);
+    return;
+
+  case ASSIGN:
+    fold_expr(e->assign.expr);
+    return;
+
+  case IF:
+    fold_expr(e->if_expr.cond);
+    fold_expr(e->if_expr.e_true);
+    fold_expr(e->if_expr.e_false);
+    if (e->if_expr.cond->type == LIT_BOOL)
+      replace(e, e->if_expr.cond->value ? e->if_expr.e_true : e->if_expr.e_false);
+    return;
+
+  case WHILE:
+    fold_expr(e->while_expr.cond);
+    fold_expr(e->while_expr.body);
+    return;
+
+  case UN_OP:
+    fold_expr(e->unop.expr);
+    if (e->unop.expr->type == LIT_BOOL)
+      to_bool(e, !e->unop.expr->value);
+    else if (e->unop.expr->type == LITERAL)
+      to_int(e, ~e->unop.expr->value);
+    return;
+
+  case BIN_OP:
+    fold_expr(e->binop.lhs);
+    fold_expr(e->binop.rhs);
+    if (e->vtype == INTEGER && e->is_const)
+      break;
+    fold_binop(e);
+    return;
+
+  case VECTOR:
+    fold_vect(e->vect);
+    return;
+
+  case VECTOR_ACCESS_OP:
+    fold_expr(e->vect_access.base);
+    fold_expr(e->vect_access.offset);
+    if (e->vect_access.col != NULL)
+      fold_expr(e->vect_access.col);
+    return;
+
+  case VECTOR_UPDATE_OP:
+    fold_expr(e->vect_update.base);
+    fold_expr(e->vect_update.offset);
+    if (e->vect_update.col != NULL)
+      fold_expr(e->vect_update.col);
+    fold_expr(e->vect_update.rhs);
+    return;
+
+  case SEQ:
+    fold_vect(e->vect);
+    fold_seq(e);
+    return;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    fold_vect(e->vect_build.sample);
+    fold_expr(e->vect_build.len);
+    return;
+
+  case PARALLEL_FOR:
+    fold_expr(e->par_for.from);
+    fold_expr(e->par_for.to);
+    fold_expr(e->par_for.body);
+    return;
+
+  case TILED_FOR:
+    fold_expr(e->tiled_for.from);
+    fold_expr(e->tiled_for.to);
+    fold_expr(e->tiled_for.col_from);
+    fold_expr(e->tiled_for.col_to);
+    if (e->tiled_for.tile != NULL)
+      fold_expr(e->tiled_for.tile);
+    fold_expr(e->tiled_for.body);
+    return;
+  }
+
+  if (e->vtype == INTEGER && e->is_const)
+    to_int(e, e->const_value);
+}
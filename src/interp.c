@@ -0,0 +1,645 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interp.h"
+#include "profile.h"
+#include "y.tab.h"
+
+// A variable of the interpreter, bound in the env to its symbol: the slots
+// live in the C frames of the evaluation of their LET, VAR or call
+struct slot {
+  struct expr *type;    // see struct unit_var
+  int mutable;
+  union value val;
+};
+
+// a loop or a call compiled for the interpreter
+struct unit {
+  struct expr *e;
+  uint64_t addr;        // 0 if e cannot be compiled, not to be tried again
+  struct unit_var *vars;
+  unsigned n_vars;
+  int persistent;       // e is part of a function body
+};
+
+static struct unit *units;
+static unsigned n_units, units_cap;
+
+// loops go back to their head this many times in all, the inner loops
+// included: a loop is hot once that many happened during one run of it
+static unsigned long back_edges;
+// the function bodies being evaluated
+static unsigned fun_depth;
+
+static union value eval(struct expr *e, struct env *env, struct tier *tier);
+
+static unsigned elem_size(enum value_type t)
+{
+  return t == INTEGER ? 4 : 1;
+}
+
+static int get_elem(struct rt_vect *v, enum value_type t, int i)
+{
+  return t == INTEGER ? ((int *)v->data)[i] : v->data[i];
+}
+
+static void set_elem(struct rt_vect *v, enum value_type t, int i, int x)
+{
+  if (t == INTEGER)
+    ((int *)v->data)[i] = x;
+  else
+    v->data[i] = x;
+}
+
+// --profile-gen: the branches count their outcomes as in compiled code
+static int count(struct expr *e, int outcome)
+{
+  if (profile_mode == PROFILE_GEN && e->counts != NULL)
+    profile_count(e->counts, outcome);
+  return outcome;
+}
+
+static void check_index(struct expr *e, struct rt_vect *v, int idx)
+{
+  if (bounds_checks && !e->in_bounds && (unsigned)idx >= (unsigned)v->len)
+    vect_index_error(idx, v->len);
+}
+
+// the index in the elements of v of the element row, col of the matrix of
+// rows of cols elements it holds
+static int matrix_index(struct expr *e, struct rt_vect *v, int cols, int row, int col)
+{
+  int rows = v->len / cols;
+  if (bounds_checks && !e->in_bounds && ((unsigned)row >= (unsigned)rows || (unsigned)col >= (unsigned)cols))
+    matrix_index_error(row, col, rows, cols);
+  return row * cols + col;
+}
+
+// as build_tile_end: the end of the tile starting at lo, not past hi
+static int tile_end(int lo, int hi, int tile)
+{
+  return (unsigned)tile < (unsigned)hi - (unsigned)lo ? lo + tile : hi;
+}
+
+// the elements of v, row of a matrix, in the elements of dst from idx on
+static void copy_row(struct rt_vect *dst, int idx, struct rt_vect *v, struct expr *row)
+{
+  unsigned size = elem_size(row->elem_vtype);
+  memcpy(dst->data + (size_t)idx * size, v->data, (size_t)row->len * size);
+}
+
+// as the instructions of build_binop: the arithmetic wraps around, and
+// neither a 0 divisor nor INT_MIN / -1 traps
+static int binop(int op, int l, int r)
+{
+  switch (op) {
+  case '+': return (int)((unsigned)l + (unsigned)r);
+  case '-': return (int)((unsigned)l - (unsigned)r);
+  case '*': return (int)((unsigned)l * (unsigned)r);
+  case '/': return r == 0 ? 0 : r == -1 ? (int)(0u - (unsigned)l) : l / r;
+  case MOD: return r == 0 ? l : (int)((unsigned)l % (unsigned)r);
+  case SHL_OP: return (int)((unsigned)l << (r & 31));
+  case '<': return l < r;
+  case '>': return l > r;
+  case LE : return l <= r;
+  case GE : return l >= r;
+  case '=': return l == r;
+  case NE : return l != r;
+  case AND: return l & r;
+  case OR : return l | r;
+  default: return 0;
+  }
+}
+
+// the reductions, from INT_MAX for min ('<') and INT_MIN for max ('>')
+static int reduce(int op, int acc, int x)
+{
+  if (op == '+')
+    return binop('+', acc, x);
+  return (op == '<' ? x < acc : x > acc) ? x : acc;
+}
+
+// the unit variables of a loop or a call: the variables of the interpreter
+// it reads or assigns
+struct free_vars {
+  struct env *env;
+  struct unit_var *vars;
+  unsigned n_vars, cap;
+  int *bound;           // the bindings of the unit itself, innermost last
+  unsigned n_bound, bound_cap;
+  int eligible;
+};
+
+static void add_var(struct free_vars *fv, int sym, int assigned)
+{
+  for (unsigned k = fv->n_bound; k > 0; --k) {
+    if (fv->bound[k - 1] == sym)
+      return;
+  }
+
+  struct slot *s = resolve(fv->env, sym);
+  // the unit gets a vector by its elements, not by the slot holding it
+  if (assigned && s->type->vtype == VECT)
+    fv->eligible = 0;
+  for (unsigned k = 0; k < fv->n_vars; ++k) {
+    if (fv->vars[k].sym == sym)
+      return;
+  }
+
+  if (fv->n_vars == fv->cap) {
+    fv->cap = fv->cap ? 2 * fv->cap : 8;
+    fv->vars = realloc(fv->vars, sizeof(struct unit_var) * fv->cap);
+  }
+  fv->vars[fv->n_vars++] = (struct unit_var){ sym, s->mutable, s->type };
+}
+
+static void bind(struct free_vars *fv, int sym)
+{
+  if (fv->n_bound == fv->bound_cap) {
+    fv->bound_cap = fv->bound_cap ? 2 * fv->bound_cap : 8;
+    fv->bound = realloc(fv->bound, sizeof(int) * fv->bound_cap);
+  }
+  fv->bound[fv->n_bound++] = sym;
+}
+
+static void collect_list(struct free_vars *fv, struct expr_vect *ve);
+
+static void collect(struct free_vars *fv, struct expr *e)
+{
+  switch (e->type) {
+  case IDENT:
+    add_var(fv, e->ident, 0);
+    return;
+
+  case ASSIGN:
+    collect(fv, e->assign.expr);
+    add_var(fv, e->assign.ident, 1);
+    return;
+
+  case LET:
+  case VAR:
+    collect(fv, e->let.expr);
+    bind(fv, e->let.ident);
+    collect(fv, e->let.body);
+    --fv->n_bound;
+    return;
+
+  case PARALLEL_FOR:
+    collect(fv, e->par_for.from);
+    collect(fv, e->par_for.to);
+    bind(fv, e->par_for.ident);
+    collect(fv, e->par_for.body);
+    --fv->n_bound;
+    return;
+
+  case TILED_FOR:
+    collect(fv, e->tiled_for.from);
+    collect(fv, e->tiled_for.to);
+    collect(fv, e->tiled_for.col_from);
+    collect(fv, e->tiled_for.col_to);
+    if (e->tiled_for.tile != NULL)
+      collect(fv, e->tiled_for.tile);
+    bind(fv, e->tiled_for.row);
+    bind(fv, e->tiled_for.col);
+    collect(fv, e->tiled_for.body);
+    fv->n_bound -= 2;
+    return;
+
+  case IF:
+    collect(fv, e->if_expr.cond);
+    collect(fv, e->if_expr.e_true);
+    collect(fv, e->if_expr.e_false);
+    return;
+
+  case WHILE:
+    collect(fv, e->while_expr.cond);
+    collect(fv, e->while_expr.body);
+    return;
+
+  case CALL:
+    collect_list(fv, e->call.args);
+    return;
+
+  case UN_OP:
+    collect(fv, e->unop.expr);
+    return;
+
+  case BIN_OP:
+    collect(fv, e->binop.lhs);
+    collect(fv, e->binop.rhs);
+    return;
+
+  case VECTOR:
+  case SEQ:
+    collect_list(fv, e->vect);
+    return;
+
+  case VECTOR_ACCESS_OP:
+    collect(fv, e->vect_access.base);
+    collect(fv, e->vect_access.offset);
+    if (e->vect_access.col != NULL)
+      collect(fv, e->vect_access.col);
+    return;
+
+  case VECTOR_UPDATE_OP:
+    collect(fv, e->vect_update.base);
+    collect(fv, e->vect_update.offset);
+    if (e->vect_update.col != NULL)
+      collect(fv, e->vect_update.col);
+    collect(fv, e->vect_update.rhs);
+    return;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    collect_list(fv, e->vect_build.sample);
+    collect(fv, e->vect_build.len);
+    return;
+
+  default:
+    return;
+  }
+}
+
+static void collect_list(struct free_vars *fv, struct expr_vect *ve)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    collect(fv, ve->curr_expr);
+}
+
+static struct unit *find_unit(struct expr *e)
+{
+  for (unsigned k = 0; k < n_units; ++k) {
+    if (units[k].e == e)
+      return &units[k];
+  }
+  return NULL;
+}
+
+static struct unit *add_unit(struct expr *e, struct env *env, struct tier *tier)
+{
+  struct free_vars fv = { env, NULL, 0, 0, NULL, 0, 0, 1 };
+  collect(&fv, e);
+  free(fv.bound);
+
+  if (n_units == units_cap) {
+    units_cap = units_cap ? 2 * units_cap : 16;
+    units = realloc(units, sizeof(struct unit) * units_cap);
+  }
+  struct unit *u = &units[n_units++];
+  u->e = e;
+  u->vars = fv.vars;
+  u->n_vars = fv.n_vars;
+  u->persistent = fun_depth > 0;
+  u->addr = fv.eligible ? tier->compile(tier->arg, e, fv.vars, fv.n_vars) : 0;
+  return u;
+}
+
+// run e natively from here on, with the variables of env: returns 0 if it
+// cannot be compiled and is left to the interpreter
+static int enter_unit( struct expr *e
+                     , struct env *env
+                     , struct tier *tier
+                     , union value *result)
+{
+  if (tier == NULL)
+    return 0;
+  struct unit *u = find_unit(e);
+  if (u == NULL)
+    u = add_unit(e, env, tier);
+  if (u->addr == 0)
+    return 0;
+
+  void *args[u->n_vars + 1];
+  for (unsigned k = 0; k < u->n_vars; ++k) {
+    struct slot *s = resolve(env, u->vars[k].sym);
+    if (u->vars[k].type->vtype != VECT)
+      args[k] = &s->val.i;
+    else if (u->vars[k].type->len >= 0)
+      args[k] = s->val.v->data;
+    else
+      args[k] = s->val.v;
+  }
+
+  switch (e->vtype) {
+  case INTEGER:
+    result->i = ((int (*)(void **))u->addr)(args);
+    break;
+  case BOOLEAN:
+    result->i = ((bool (*)(void **))u->addr)(args);
+    break;
+  default:
+    ((void (*)(void **))u->addr)(args);
+    result->i = 0;
+    break;
+  }
+  return 1;
+}
+
+static union value eval_call(struct expr *e, struct env *env, struct tier *tier)
+{
+  union value result;
+  struct fun_def *f = lookup_function(e->call.ident);
+  if (f != NULL) {
+    if (f->calls >= TIER_CALL_THRESHOLD && enter_unit(e, env, tier, &result))
+      return result;
+    ++f->calls;
+
+    // the arguments are evaluated where the call is, then bound to the
+    // parameters
+    unsigned n = vect_len(f->params);
+    struct slot params[n + 1];
+    struct expr_vect *a = e->call.args, *p = f->params;
+    for (unsigned k = 0; k < n; ++k, a = a->next_expr, p = p->next_expr)
+      params[k] = (struct slot){ p->curr_expr, 0, eval(a->curr_expr, env, tier) };
+    p = f->params;
+    for (unsigned k = 0; k < n; ++k, p = p->next_expr)
+      push(env, p->curr_expr->param.ident, &params[k]);
+
+    ++fun_depth;
+    result = eval(f->body, env, tier);
+    --fun_depth;
+    for (unsigned k = 0; k < n; ++k)
+      pop(env);
+    return result;
+  }
+
+  const char *name = symbol_name(e->call.ident);
+  struct expr *arg = e->call.args->curr_expr;
+  union value x = eval(arg, env, tier);
+  result.i = 0;
+  if (strcmp(name, "print_i32") == 0) {
+    print_i32(x.i);
+  } else if (strcmp(name, "read_i32") == 0) {
+    result.i = read_i32(x.i);
+  } else if (strcmp(name, "read_vec") == 0) {
+    result.v = read_vec(x.i);
+  } else if (strcmp(name, "print_vec") == 0) {
+    print_vec((int *)x.v->data, x.v->len);
+  } else {
+    // the reductions, from their identity
+    int op = strcmp(name, "sum") == 0 ? '+' : strcmp(name, "min") == 0 ? '<' : '>';
+    result.i = op == '+' ? 0 : op == '<' ? INT_MAX : INT_MIN;
+    for (int i = 0; i < x.v->len; ++i)
+      result.i = reduce(op, result.i, get_elem(x.v, arg->elem_vtype, i));
+  }
+  return result;
+}
+
+// an element-wise operation: the operands are evaluated left to right, and
+// only the elements of the shortest vector are gone through
+static union value eval_elementwise(struct expr *e, struct env *env, struct tier *tier)
+{
+  struct expr *lhs = e->binop.lhs, *rhs = e->binop.rhs;
+  union value l = eval(lhs, env, tier);
+  union value r = eval(rhs, env, tier);
+
+  int n = e->len;
+  if (n < 0) {
+    n = INT_MAX;
+    if (lhs->vtype == VECT && l.v->len < n)
+      n = l.v->len;
+    if (rhs->vtype == VECT && r.v->len < n)
+      n = r.v->len;
+  }
+
+  union value result = { .v = vect_alloc(n, elem_size(e->elem_vtype)) };
+  for (int i = 0; i < n; ++i) {
+    int a = lhs->vtype == VECT ? get_elem(l.v, lhs->elem_vtype, i) : l.i;
+    int b = rhs->vtype == VECT ? get_elem(r.v, rhs->elem_vtype, i) : r.i;
+    set_elem(result.v, e->elem_vtype, i, binop(e->binop.op, a, b));
+  }
+  return result;
+}
+
+static union value eval_binop(struct expr *e, struct env *env, struct tier *tier)
+{
+  union value result;
+
+  switch (e->binop.op) {
+  case AND_SC:
+    result = eval(e->binop.lhs, env, tier);
+    return count(e, result.i) ? eval(e->binop.rhs, env, tier) : result;
+
+  case OR_SC:
+    result = eval(e->binop.lhs, env, tier);
+    return count(e, result.i) ? result : eval(e->binop.rhs, env, tier);
+
+  case CONCAT_KW: {
+    union value l = eval(e->binop.lhs, env, tier);
+    union value r = eval(e->binop.rhs, env, tier);
+    unsigned size = elem_size(e->elem_vtype);
+    result.v = vect_alloc(l.v->len + r.v->len, size);
+    memcpy(result.v->data, l.v->data, (size_t)l.v->len * size);
+    memcpy(result.v->data + (size_t)l.v->len * size, r.v->data, (size_t)r.v->len * size);
+    return result;
+  }
+
+  default:
+    if (e->vtype == VECT)
+      return eval_elementwise(e, env, tier);
+    result = eval(e->binop.lhs, env, tier);
+    result.i = binop(e->binop.op, result.i, eval(e->binop.rhs, env, tier).i);
+    return result;
+  }
+}
+
+static union value eval(struct expr *e, struct env *env, struct tier *tier)
+{
+  union value result = { .i = 0 };
+
+  switch (e->type) {
+  case LITERAL:
+  case LIT_BOOL:
+    result.i = e->value;
+    return result;
+
+  case IDENT:
+    return ((struct slot *)resolve(env, e->ident))->val;
+
+  case LET:
+  case VAR: {
+    struct slot s = { e->let.expr, e->type == VAR, eval(e->let.expr, env, tier) };
+    push(env, e->let.ident, &s);
+    result = eval(e->let.body, env, tier);
+    pop(env);
+    return result;
+  }
+
+  case ASSIGN: {
+    union value val = eval(e->assign.expr, env, tier);
+    ((struct slot *)resolve(env, e->assign.ident))->val = val;
+    return result;
+  }
+
+  case IF:
+    return count(e, eval(e->if_expr.cond, env, tier).i) ? eval(e->if_expr.e_true, env, tier)
+                                              : eval(e->if_expr.e_false, env, tier);
+
+  case WHILE: {
+    unsigned long start = back_edges;
+    while (count(e, eval(e->while_expr.cond, env, tier).i)) {
+      eval(e->while_expr.body, env, tier);
+      // on-stack replacement: the loop goes on natively from its head
+      if (++back_edges - start >= TIER_LOOP_THRESHOLD) {
+        if (enter_unit(e, env, tier, &result))
+          break;
+        start = back_edges;
+      }
+    }
+    result.i = 0;
+    return result;
+  }
+
+  case CALL:
+    return eval_call(e, env, tier);
+
+  case PARALLEL_FOR: {
+    // worth running on the threads of the runtime from the start
+    if (enter_unit(e, env, tier, &result))
+      return result;
+
+    int op = e->par_for.op;
+    int from = eval(e->par_for.from, env, tier).i;
+    int to = eval(e->par_for.to, env, tier).i;
+    struct slot index = { e->par_for.from, 0, { .i = from } };
+    result.i = op == '<' ? INT_MAX : op == '>' ? INT_MIN : 0;
+    push(env, e->par_for.ident, &index);
+    for (; index.val.i < to; ++index.val.i) {
+      union value x = eval(e->par_for.body, env, tier);
+      if (op != 0)
+        result.i = reduce(op, result.i, x.i);
+    }
+    pop(env);
+    return result;
+  }
+
+  case TILED_FOR: {
+    // a matrix kernel: compiled from the start
+    if (enter_unit(e, env, tier, &result))
+      return result;
+
+    int from = eval(e->tiled_for.from, env, tier).i;
+    int to = eval(e->tiled_for.to, env, tier).i;
+    int col_from = eval(e->tiled_for.col_from, env, tier).i;
+    int col_to = eval(e->tiled_for.col_to, env, tier).i;
+    int tile = e->tiled_for.tile != NULL ? eval(e->tiled_for.tile, env, tier).i : INT_MAX;
+    if (tile < 1)
+      tile = 1;
+    struct slot row = { e->tiled_for.from, 0, { .i = 0 } };
+    struct slot col = { e->tiled_for.from, 0, { .i = 0 } };
+    push(env, e->tiled_for.row, &row);
+    push(env, e->tiled_for.col, &col);
+    for (int r = from, row_end; r < to; r = row_end) {
+      row_end = tile_end(r, to, tile);
+      for (int c = col_from, col_end; c < col_to; c = col_end) {
+        col_end = tile_end(c, col_to, tile);
+        for (row.val.i = r; row.val.i < row_end; ++row.val.i) {
+          for (col.val.i = c; col.val.i < col_end; ++col.val.i, ++back_edges)
+            eval(e->tiled_for.body, env, tier);
+        }
+      }
+    }
+    pop(env);
+    pop(env);
+    result.i = 0;
+    return result;
+  }
+
+  case UN_OP:
+    result = eval(e->unop.expr, env, tier);
+    result.i = e->vtype == BOOLEAN ? !result.i : ~result.i;
+    return result;
+
+  case BIN_OP:
+    return eval_binop(e, env, tier);
+
+  case VECTOR: {
+    int n = vect_len(e->vect);
+    result.v = vect_alloc(e->len, elem_size(e->elem_vtype));
+    struct expr_vect *ve = e->vect;
+    for (int i = 0; i < n; ++i, ve = ve->next_expr) {
+      union value x = eval(ve->curr_expr, env, tier);
+      if (e->cols > 0)
+        copy_row(result.v, i * e->cols, x.v, ve->curr_expr);
+      else
+        set_elem(result.v, e->elem_vtype, i, x.i);
+    }
+    return result;
+  }
+
+  case VECTOR_ACCESS_OP: {
+    struct expr *base = e->vect_access.base;
+    struct rt_vect *v = eval(base, env, tier).v;
+    int idx = eval(e->vect_access.offset, env, tier).i;
+    if (e->vect_access.col != NULL)
+      idx = matrix_index(e, v, base->cols, idx, eval(e->vect_access.col, env, tier).i);
+    else
+      check_index(e, v, idx);
+    result.i = get_elem(v, base->elem_vtype, idx);
+    return result;
+  }
+
+  case VECTOR_UPDATE_OP: {
+    struct expr *base = e->vect_update.base;
+    struct rt_vect *v = eval(base, env, tier).v;
+    int idx = eval(e->vect_update.offset, env, tier).i;
+    int col = e->vect_update.col != NULL ? eval(e->vect_update.col, env, tier).i : 0;
+    int x = eval(e->vect_update.rhs, env, tier).i;
+    if (e->vect_update.col != NULL)
+      idx = matrix_index(e, v, base->cols, idx, col);
+    else
+      check_index(e, v, idx);
+    set_elem(v, base->elem_vtype, idx, x);
+    return result;
+  }
+
+  case SEQ:
+    for (struct expr_vect *ve = e->vect; ve != NULL; ve = ve->next_expr)
+      result = eval(ve->curr_expr, env, tier);
+    return result;
+
+  case SUGARED_VECTOR_BUILD_OP: {
+    // the sample is evaluated once per round
+    int width = e->cols > 0 ? e->cols : 1;
+    int sample_len = vect_len(e->vect_build.sample);
+    int times = eval(e->vect_build.len, env, tier).i;
+    long long n = (long long)times * sample_len * width;
+    if (n > INT_MAX)
+      vect_length_error(n);
+    result.v = vect_alloc(n, elem_size(e->elem_vtype));
+    for (int r = 0; r < times; ++r) {
+      struct expr_vect *ve = e->vect_build.sample;
+      for (int k = 0; k < sample_len; ++k, ve = ve->next_expr) {
+        union value x = eval(ve->curr_expr, env, tier);
+        if (e->cols > 0)
+          copy_row(result.v, (r * sample_len + k) * width, x.v, ve->curr_expr);
+        else
+          set_elem(result.v, e->elem_vtype, r * sample_len + k, x.i);
+      }
+    }
+    return result;
+  }
+
+  default:
+    return result;
+  }
+}
+
+union value interp_expr(struct expr *e, struct env *env, struct tier *tier)
+{
+  return eval(e, env, tier);
+}
+
+void interp_reset(void)
+{
+  unsigned kept = 0;
+  for (unsigned k = 0; k < n_units; ++k) {
+    if (units[k].persistent)
+      units[kept++] = units[k];
+    else
+      free(units[k].vars);
+  }
+  n_units = kept;
+  fun_depth = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdint.h>
+#include "compile.h"
+#include "runtime.h"
+
+// --tiered: expressions start running right away in an interpreter walking
+// their typed AST, and only the code that turns out to be hot is compiled.
+// A loop going round TIER_LOOP_THRESHOLD times is compiled and re-entered
+// natively at its head, with the variables of the interpreter; so is a call
+// once its function has been interpreted TIER_CALL_THRESHOLD times.
+#define TIER_LOOP_THRESHOLD 10000
+#define TIER_CALL_THRESHOLD 1000
+
+// ints and bools alike are held in i
+union value {
+  int i;
+  struct rt_vect *v;
+};
+
+struct tier {
+  // compile e as a unit of its free variables vars, see codegen_unit;
+  // returns the address of its function, 0 if it cannot be compiled
+  uint64_t (*compile)( void *arg
+                     , struct expr *e
+                     , const struct unit_var *vars
+                     , unsigned n_vars);
+  void *arg;
+};
+
+// evaluate the checked expression e in env, where the interpreter binds its
+// variables. The vectors are allocated by the runtime, and a failed bounds
+// check goes through vect_index_error, as in compiled code
+union value interp_expr(struct expr *e, struct env *env, struct tier *tier);
+
+// forget the units compiled for the nodes of the expression just evaluated,
+// which do not outlive it; the ones of the function bodies are kept
+void interp_reset(void);
+
+#endif
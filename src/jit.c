@@ -0,0 +1,626 @@
+#include <llvm/Config/llvm-config.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/ExecutionEngine.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "compile.h"
+#include "interp.h"
+#include "jit.h"
+#include "parallel.h"
+#include "pool.h"
+#include "profile.h"
+#include "runtime.h"
+#include "stream.h"
+
+// the engine needs a module to be created with: start from an empty one,
+// every expression will then be added as a module of its own
+static int create_engine( LLVMContextRef ctx
+                        , int opt_level
+                        , LLVMExecutionEngineRef *engine
+                        , struct code_memory **mem)
+{
+  LLVMModuleRef module = LLVMModuleCreateWithNameInContext("session", ctx);
+
+  struct LLVMMCJITCompilerOptions options;
+  LLVMInitializeMCJITCompilerOptions(&options, sizeof(options));
+  options.OptLevel = opt_level;
+  options.MCJMM = code_memory_create(mem);
+
+  char *error;
+  if (LLVMCreateMCJITCompilerForModule(engine, module, &options, sizeof(options), &error)) {
+    fprintf(stderr, "%s\n", error);
+    LLVMDisposeMessage(error);
+    return 1;
+  }
+  return 0;
+}
+
+struct jit_session *jit_session_create(const struct jit_options *opts)
+{
+  struct jit_session *session = malloc(sizeof(struct jit_session));
+  session->opts = *opts;
+  bounds_checks = opts->checked;
+  if (opts->threads > 0)
+    par_set_threads(opts->threads);
+  if (opts->profile_use != NULL) {
+    if (profile_load(opts->profile_use)) {
+      free(session);
+      return NULL;
+    }
+    profile_mode = PROFILE_USE;
+  } else if (opts->profile_gen != NULL) {
+    profile_mode = PROFILE_GEN;
+  }
+
+  LLVMInitializeNativeTarget();
+  LLVMInitializeNativeAsmPrinter();
+  LLVMInitializeNativeAsmParser();
+  LLVMLinkInMCJIT();
+
+  session->stats = NULL;
+  if (opts->stats_path != NULL) {
+    session->stats = strcmp(opts->stats_path, "-") == 0 ? stderr : fopen(opts->stats_path, "w");
+    if (session->stats == NULL) {
+      perror(opts->stats_path);
+      free(session);
+      return NULL;
+    }
+  }
+
+  if (create_engine(LLVMGetGlobalContext(), opts->opt_level, &session->engine, &session->code_memory)) {
+    if (session->stats != NULL && session->stats != stderr)
+      fclose(session->stats);
+    free(session);
+    return NULL;
+  }
+
+  // the modules are optimised before being handed to the engine: they need
+  // to know the target to let the optimisations use its cost model
+  session->target = LLVMGetExecutionEngineTargetMachine(session->engine);
+
+  // the instrumented code of --profile-gen counts in this process only
+  session->cache = NULL;
+  if (opts->cache_dir != NULL && profile_mode != PROFILE_GEN) {
+    session->cache = cache_open(opts->cache_dir, opts->cache_bytes);
+
+    // besides the expression itself, the compiled code depends on the
+    // optimisation level, the version of LLVM and the target
+    char *triple = LLVMGetTargetMachineTriple(session->target);
+    char *cpu = LLVMGetTargetMachineCPU(session->target);
+    char level[] = { 'O', '0' + opts->opt_level, '\0' };
+    session->cache_salt = hash_string(HASH_SEED, LLVM_VERSION_STRING);
+    session->cache_salt = hash_string(session->cache_salt, triple);
+    session->cache_salt = hash_string(session->cache_salt, cpu);
+    session->cache_salt = hash_string(session->cache_salt, level);
+    session->cache_salt = hash_string(session->cache_salt, opts->checked ? "checked" : "unchecked");
+    if (profile_mode == PROFILE_USE) {
+      char profile[32];
+      snprintf(profile, sizeof(profile), "profile %016" PRIx64, profile_hash());
+      session->cache_salt = hash_string(session->cache_salt, profile);
+    }
+    LLVMDisposeMessage(triple);
+    LLVMDisposeMessage(cpu);
+  }
+
+  session->env = env_create();
+  session->n_exprs = 0;
+  session->batch = NULL;
+  session->n_batch = 0;
+  session->batch_cap = 0;
+
+  return session;
+}
+
+void jit_session_dispose(struct jit_session *session)
+{
+  if (session->opts.profile_gen != NULL)
+    profile_save(session->opts.profile_gen);
+  LLVMDisposeExecutionEngine(session->engine);
+  if (session->cache != NULL)
+    cache_close(session->cache);
+  env_dispose(session->env);
+  if (session->stats != NULL && session->stats != stderr)
+    fclose(session->stats);
+  free(session->batch);
+  free(session);
+}
+
+// call the compiled expression natively, through a function pointer of the
+// type matching its result, and print the result
+static void run_native( struct jit_session *session
+                      , struct expr *expr
+                      , uint64_t addr
+                      , struct expr_stats *stats)
+{
+  unsigned repeat = session->opts.repeat;
+  double start = time_ms();
+
+  // a failed bounds check abandons the expression, the session goes on
+  jmp_buf error;
+  if (setjmp(error)) {
+    rt_error_handler = NULL;
+    vect_reset();
+    stats->run_ms = time_ms() - start;
+    stats->vect_bytes = vect_take_peak();
+    return;
+  }
+  rt_error_handler = &error;
+
+  switch (expr->vtype) {
+  case INTEGER: {
+    int (*fn)(void) = (int (*)(void))addr;
+    int result = 0;
+    for (unsigned i = 0; i < repeat; ++i)
+      result = fn();
+    stats->run_ms = (time_ms() - start) / repeat;
+    print_result_i32(result);
+    break;
+  }
+
+  case BOOLEAN: {
+    bool (*fn)(void) = (bool (*)(void))addr;
+    bool result = false;
+    for (unsigned i = 0; i < repeat; ++i)
+      result = fn();
+    stats->run_ms = (time_ms() - start) / repeat;
+    print_result_i32(result);
+    break;
+  }
+
+  case VECT: {
+    struct rt_vect *(*fn)(void) = (struct rt_vect *(*)(void))addr;
+    struct rt_vect *result = fn();
+    for (unsigned i = 1; i < repeat; ++i) {
+      vect_reset();
+      result = fn();
+    }
+    stats->run_ms = (time_ms() - start) / repeat;
+    print_result_vect(result, expr->elem_vtype == INTEGER ? 4 : 1, expr->cols);
+    break;
+  }
+
+  default: {
+    void (*fn)(void) = (void (*)(void))addr;
+    for (unsigned i = 0; i < repeat; ++i)
+      fn();
+    stats->run_ms = (time_ms() - start) / repeat;
+    print_result_unit();
+    break;
+  }
+  }
+  rt_error_handler = NULL;
+  // the vectors the expression built are not reachable anymore
+  vect_reset();
+  stats->vect_bytes = vect_take_peak();
+  rt_flush();
+}
+
+// the function of a module loaded from the cache, renamed after the
+// expression it now stands for
+static LLVMValueRef cached_function(LLVMModuleRef module, const char *name)
+{
+  for (LLVMValueRef f = LLVMGetFirstFunction(module); f != NULL; f = LLVMGetNextFunction(f)) {
+    if (LLVMCountBasicBlocks(f) > 0) {
+      LLVMSetValueName(f, name);
+      return f;
+    }
+  }
+  return NULL;
+}
+
+// verify and optimise the module of f, just generated, timing every step
+static void finish_module( struct jit_session *session
+                         , LLVMTargetMachineRef target
+                         , LLVMModuleRef module
+                         , LLVMValueRef f
+                         , struct expr_stats *stats)
+{
+  // the dumps of the threads of a batch would be mixed up
+  int dump_ir = session->opts.dump_ir && session->opts.jobs == 0;
+  if (dump_ir) {
+    fprintf(stderr, "\ngenerating code...\n");
+    LLVMDumpValue(f);
+  }
+
+  double start = time_ms();
+  char *error;
+  LLVMVerifyModule(module, LLVMAbortProcessAction, &error);
+  LLVMDisposeMessage(error);
+  stats->verify_ms = time_ms() - start;
+
+  if (session->stats != NULL)
+    stats->ir_insts = count_instructions(module);
+  start = time_ms();
+  optimise_module(module, session->opts.opt_level, target);
+  stats->optimise_ms = time_ms() - start;
+  if (session->stats != NULL)
+    stats->opt_insts = count_instructions(module);
+
+  if (dump_ir) {
+    fprintf(stderr, "\ngenerating optimised code...\n");
+    LLVMDumpValue(f);
+  }
+}
+
+// codegen, verify and optimise a checked expression in a module of its own
+static LLVMModuleRef build_module( struct jit_session *session
+                                 , LLVMContextRef ctx
+                                 , LLVMTargetMachineRef target
+                                 , struct env *env
+                                 , struct expr *expr
+                                 , const char *name
+                                 , struct expr_stats *stats)
+{
+  double start = time_ms();
+  LLVMModuleRef module = LLVMModuleCreateWithNameInContext(name, ctx);
+  prepare_module(module, target);
+  declare_runtime(module);
+  LLVMValueRef f = codegen_toplevel(expr, env, name, module);
+  stats->codegen_ms = time_ms() - start;
+
+  finish_module(session, target, module, f, stats);
+  return module;
+}
+
+// hand the module over to the engine and force the emission of machine code
+// now, so that it is accounted to the compilation and not to the run
+static uint64_t emit( LLVMExecutionEngineRef engine
+                    , struct code_memory *mem
+                    , LLVMModuleRef module
+                    , const char *name
+                    , struct expr_stats *stats)
+{
+  unsigned long long code_bytes = mem->code_bytes;
+  unsigned long long data_bytes = mem->data_bytes;
+  double start = time_ms();
+
+  LLVMAddModule(engine, module);
+  uint64_t addr = LLVMGetFunctionAddress(engine, name);
+
+  stats->emit_ms = time_ms() - start;
+  stats->code_bytes = mem->code_bytes - code_bytes;
+  stats->data_bytes = mem->data_bytes - data_bytes;
+  return addr;
+}
+
+// the stats of an expression ready to be compiled, parsed just now
+static void start_stats(struct expr_stats *stats)
+{
+  *stats = (struct expr_stats){
+    .parse_ms = stream_parse_ms(),
+    .ast_bytes = stream_ast_bytes(),
+  };
+}
+
+// --tiered: the expression being interpreted, for which loops and calls
+// are compiled on the way
+struct tier_state {
+  struct jit_session *session;
+  unsigned index;             // of the expression
+  unsigned n_units;
+  double compile_ms;          // spent compiling its units
+  struct expr_stats *stats;   // the units add up to the compilation
+};
+
+static uint64_t compile_unit( void *arg
+                            , struct expr *e
+                            , const struct unit_var *vars
+                            , unsigned n_vars)
+{
+  struct tier_state *t = arg;
+  struct jit_session *session = t->session;
+  char name[48];
+  snprintf(name, sizeof(name), "expr_%u.unit_%u", t->index, t->n_units++);
+
+  struct expr_stats u = { 0 };
+  double start = time_ms();
+  LLVMModuleRef module = LLVMModuleCreateWithNameInContext(name, LLVMGetGlobalContext());
+  prepare_module(module, session->target);
+  declare_runtime(module);
+  LLVMValueRef f = codegen_unit(e, vars, n_vars, name, module);
+  u.codegen_ms = time_ms() - start;
+  finish_module(session, session->target, module, f, &u);
+  uint64_t addr = emit(session->engine, session->code_memory, module, name, &u);
+
+  // the machine code stays where the engine emitted it
+  char *error;
+  LLVMModuleRef removed;
+  if (!LLVMRemoveModule(session->engine, module, &removed, &error))
+    LLVMDisposeModule(removed);
+
+  t->compile_ms += time_ms() - start;
+  t->stats->codegen_ms += u.codegen_ms;
+  t->stats->verify_ms += u.verify_ms;
+  t->stats->optimise_ms += u.optimise_ms;
+  t->stats->emit_ms += u.emit_ms;
+  t->stats->ir_insts += u.ir_insts;
+  t->stats->opt_insts += u.opt_insts;
+  t->stats->code_bytes += u.code_bytes;
+  t->stats->data_bytes += u.data_bytes;
+  return addr;
+}
+
+// --tiered: interpret the expression and print its result, as run_native;
+// the time spent compiling units is left out of the run and returned
+static double run_tiered( struct jit_session *session
+                        , struct expr *expr
+                        , unsigned index
+                        , struct expr_stats *stats)
+{
+  struct tier_state state = { session, index, 0, 0, stats };
+  struct tier tier = { compile_unit, &state };
+  unsigned depth = session->env->depth;
+  unsigned repeat = session->opts.repeat;
+  double start = time_ms();
+
+  jmp_buf error;
+  if (setjmp(error)) {
+    rt_error_handler = NULL;
+    // the bindings of the evaluation abandoned half-way
+    while (session->env->depth > depth)
+      pop(session->env);
+    interp_reset();
+    vect_reset();
+    stats->run_ms = time_ms() - start - state.compile_ms;
+    stats->vect_bytes = vect_take_peak();
+    return state.compile_ms;
+  }
+  rt_error_handler = &error;
+
+  union value result = interp_expr(expr, session->env, &tier);
+  for (unsigned i = 1; i < repeat; ++i) {
+    vect_reset();
+    result = interp_expr(expr, session->env, &tier);
+  }
+  stats->run_ms = (time_ms() - start - state.compile_ms) / repeat;
+
+  switch (expr->vtype) {
+  case INTEGER:
+  case BOOLEAN:
+    print_result_i32(result.i);
+    break;
+  case VECT:
+    print_result_vect(result.v, expr->elem_vtype == INTEGER ? 4 : 1, expr->cols);
+    break;
+  default:
+    print_result_unit();
+    break;
+  }
+  rt_error_handler = NULL;
+  interp_reset();
+  vect_reset();
+  stats->vect_bytes = vect_take_peak();
+  rt_flush();
+  return state.compile_ms;
+}
+
+void jit_eval(struct jit_session *session, struct expr *expr)
+{
+  struct expr_stats stats;
+  start_stats(&stats);
+
+  if (session->opts.jobs > 0) {
+    // typechecked in order, since it depends on the functions defined so far
+    double start = time_ms();
+    if (check_expr(expr, session->env)) {
+      fprintf(stderr, "expression discarded\n");
+      return;
+    }
+    stats.check_ms = time_ms() - start;
+
+    if (session->n_batch == session->batch_cap) {
+      session->batch_cap = session->batch_cap ? session->batch_cap * 2 : 64;
+      session->batch = realloc(session->batch, session->batch_cap * sizeof(struct batch_entry));
+    }
+    session->batch[session->n_batch++] = (struct batch_entry){ expr, stats };
+    return;
+  }
+
+  double compile_start = time_ms();
+
+  // every expression gets a fresh module and a function with a unique name,
+  // so that it does not clash with the ones already living in the engine
+  unsigned index = session->n_exprs++;
+  char name[32];
+  snprintf(name, sizeof(name), "expr_%u", index);
+
+  if (session->opts.tiered) {
+    if (check_expr(expr, session->env)) {
+      fprintf(stderr, "expression discarded\n");
+      return;
+    }
+    stats.check_ms = time_ms() - compile_start;
+
+    fprintf(stderr, "\nrunning...\n");
+    double units_ms = run_tiered(session, expr, index, &stats);
+    fprintf(stderr, "compile: %.3f ms, run: %.3f ms\n", stats.check_ms + units_ms, stats.run_ms);
+    if (session->stats != NULL)
+      stats_write(session->stats, index, &stats);
+    return;
+  }
+
+  LLVMModuleRef module = NULL;
+  uint64_t key = 0;
+
+  if (session->cache != NULL) {
+    double start = time_ms();
+    key = hash_expr(session->cache_salt, expr);
+    module = cache_lookup(session->cache, key, LLVMGetGlobalContext());
+    stats.codegen_ms = time_ms() - start;
+  }
+
+  double start = time_ms();
+  if (module != NULL) {
+    // codegen and optimisation are skipped, but the type of the result is
+    // still needed to call the compiled code
+    stats.cached = 1;
+    if (typecheck_expr(expr, session->env) == ERROR || cached_function(module, name) == NULL) {
+      fprintf(stderr, "expression discarded\n");
+      LLVMDisposeModule(module);
+      return;
+    }
+    stats.check_ms = time_ms() - start;
+    fprintf(stderr, "\nusing cached code...\n");
+  } else {
+    if (check_expr(expr, session->env)) {
+      fprintf(stderr, "expression discarded\n");
+      return;
+    }
+    stats.check_ms = time_ms() - start;
+
+    module = build_module(session, LLVMGetGlobalContext(), session->target, session->env, expr, name, &stats);
+    if (session->cache != NULL)
+      cache_store(session->cache, key, module);
+  }
+
+  uint64_t addr = emit(session->engine, session->code_memory, module, name, &stats);
+  double compile_ms = time_ms() - compile_start;
+
+  // EXECUTE LLVM GENERATED CODE  
+  fprintf(stderr, "\nrunning...\n");
+  run_native(session, expr, addr, &stats);
+  fprintf(stderr, "compile: %.3f ms, run: %.3f ms\n", compile_ms, stats.run_ms);
+  if (session->stats != NULL)
+    stats_write(session->stats, index, &stats);
+
+  // the expression will never be called again: drop its IR from the engine
+  char *error;
+  LLVMModuleRef removed;
+  if (!LLVMRemoveModule(session->engine, module, &removed, &error)) {
+    LLVMDisposeModule(removed);
+  }
+}
+
+// a thread compiling expressions of the batch: everything LLVM it touches
+// is its own, down to the context
+struct batch_worker {
+  LLVMContextRef ctx;
+  LLVMExecutionEngineRef engine;
+  struct code_memory *code_memory;
+  LLVMTargetMachineRef target;
+  struct env *env;
+};
+
+struct batch_result {
+  uint64_t addr;
+  double compile_ms;
+};
+
+struct batch {
+  struct jit_session *session;
+  struct batch_result *results;
+};
+
+static void *batch_worker_init(void *arg)
+{
+  struct batch *batch = arg;
+  struct batch_worker *w = malloc(sizeof(struct batch_worker));
+  w->ctx = LLVMContextCreate();
+  w->engine = NULL;
+  w->target = NULL;
+  if (create_engine(w->ctx, batch->session->opts.opt_level, &w->engine, &w->code_memory) == 0)
+    w->target = LLVMGetExecutionEngineTargetMachine(w->engine);
+  w->env = env_create();
+  return w;
+}
+
+static void batch_worker_fini(void *state)
+{
+  struct batch_worker *w = state;
+  if (w->engine != NULL)
+    LLVMDisposeExecutionEngine(w->engine);
+  LLVMContextDispose(w->ctx);
+  env_dispose(w->env);
+  free(w);
+}
+
+// codegen, optimise and compile to machine code the expression task of the
+// batch
+static void batch_compile(void *state, unsigned task, void *arg)
+{
+  struct batch_worker *w = state;
+  struct batch *batch = arg;
+  struct jit_session *session = batch->session;
+  struct expr *expr = session->batch[task].expr;
+  struct expr_stats *stats = &session->batch[task].stats;
+  double start = time_ms();
+
+  batch->results[task].addr = 0;
+  if (w->engine == NULL)
+    return;
+
+  char name[32];
+  snprintf(name, sizeof(name), "expr_%u", session->n_exprs + task);
+
+  LLVMModuleRef module = NULL;
+  uint64_t key = 0;
+  if (session->cache != NULL) {
+    key = hash_expr(session->cache_salt, expr);
+    module = cache_lookup(session->cache, key, w->ctx);
+    if (module != NULL && cached_function(module, name) == NULL) {
+      LLVMDisposeModule(module);
+      module = NULL;
+    }
+    stats->cached = module != NULL;
+    stats->codegen_ms = time_ms() - start;
+  }
+
+  if (module == NULL) {
+    module = build_module(session, w->ctx, w->target, w->env, expr, name, stats);
+    if (session->cache != NULL)
+      cache_store(session->cache, key, module);
+  }
+
+  // the module stays in the engine of the thread, along with its code,
+  // until the end of the batch
+  batch->results[task].addr = emit(w->engine, w->code_memory, module, name, stats);
+  batch->results[task].compile_ms = time_ms() - start;
+}
+
+static const struct pool_ops batch_ops = {
+  .init = batch_worker_init,
+  .run = batch_compile,
+  .fini = batch_worker_fini,
+};
+
+void jit_run_batch(struct jit_session *session)
+{
+  if (session->n_batch == 0)
+    return;
+  double start = time_ms();
+
+  struct batch batch = {
+    .session = session,
+    .results = malloc(session->n_batch * sizeof(struct batch_result)),
+  };
+  struct pool *pool = pool_start(session->opts.jobs, session->n_batch, &batch_ops, &batch);
+
+  // the expressions run on this thread, in source order, as soon as they
+  // are compiled: the output is the one of the serial mode
+  for (unsigned i = 0; i < session->n_batch; ++i) {
+    pool_wait(pool, i);
+    if (batch.results[i].addr == 0) {
+      fprintf(stderr, "expression discarded\n");
+      continue;
+    }
+    struct batch_entry *entry = &session->batch[i];
+    run_native(session, entry->expr, batch.results[i].addr, &entry->stats);
+    fprintf(stderr, "compile: %.3f ms, run: %.3f ms\n", batch.results[i].compile_ms, entry->stats.run_ms);
+    if (session->stats != NULL)
+      stats_write(session->stats, session->n_exprs + i, &entry->stats);
+  }
+  unsigned long n_steals = pool_finish(pool);
+
+  fprintf(stderr, "batch: %u expressions, %u threads, %lu steals, %.3f ms\n",
+          session->n_batch, session->opts.jobs, n_steals, time_ms() - start);
+  session->n_exprs += session->n_batch;
+  session->n_batch = 0;
+  free(batch.results);
+}
@@ -0,0 +1,68 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/TargetMachine.h>
+#include "ast.h"
+#include "codemem.h"
+#include "stats.h"
+
+struct jit_options {
+  int opt_level;      // 0 to 3, as in -O0 .. -O3
+  unsigned repeat;    // times every expression is run, for benchmarking
+  int checked;        // check the indices of vector accesses
+  unsigned jobs;      // --batch: threads compiling the expressions, 0 to
+                      // compile and run every expression as it is parsed
+  int tiered;         // interpret the expressions, compiling their hot loops
+                      // and calls only, see interp.h
+  unsigned threads;   // threads running the parallel for loops, 0 for the
+                      // default of the runtime, see parallel.h
+  int dump_ir;        // print the IR of every expression, before and after
+                      // optimisation, on stderr
+  const char *stats_path;          // --stats output, NULL if disabled
+  const char *profile_gen;         // profile written by the run, or NULL
+  const char *profile_use;         // profile the code is compiled with, or NULL
+
+  const char *cache_dir;           // compiled code cache, NULL if disabled
+  unsigned long long cache_bytes;  // bound on the size of the cache
+};
+
+// A jit session lives as long as the program: the native target is
+// initialised once and every top-level expression is compiled into its own
+// module, which is then added to the one long-lived MCJIT engine.
+struct jit_session {
+  struct jit_options opts;
+
+  LLVMExecutionEngineRef engine;
+  struct code_memory *code_memory;   // of the engine
+  LLVMTargetMachineRef target;
+  struct env *env;    // scratch environment for typecheck and codegen
+  FILE *stats;        // --stats, NULL if disabled
+
+  struct code_cache *cache;
+  uint64_t cache_salt;      // hash of the settings the compiled code depends on
+
+  unsigned n_exprs;   // number of expressions evaluated so far
+
+  // --batch: the checked expressions waiting to be compiled, in order
+  struct batch_entry *batch;
+  unsigned n_batch, batch_cap;
+};
+
+struct batch_entry {
+  struct expr *expr;
+  struct expr_stats stats;
+};
+
+struct jit_session *jit_session_create(const struct jit_options *opts);
+void jit_session_dispose(struct jit_session *session);
+
+// compile and run e; with --batch, e is only typechecked, and compiled
+// and run by jit_run_batch
+void jit_eval(struct jit_session *session, struct expr *e);
+
+// compile the expressions of the batch in parallel, each thread with its
+// own LLVM context and engine, and run them in order as they are ready
+void jit_run_batch(struct jit_session *session);
+
+#endif
@@ -0,0 +1,222 @@
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "runtime.h"
+
+// the chunks of a thread still to be run, from front to back
+struct deque {
+  pthread_mutex_t lock;
+  unsigned front, back;
+};
+
+// a loop being run
+struct job {
+  par_body body;
+  void *ctx;
+  int op;
+  long long from, to;
+  long long chunk;          // indices per chunk
+  unsigned n_threads;
+  int failed;               // a chunk failed a bounds check
+  char error[RT_ERROR_MAX]; // the message of the first one
+  int result;               // the values of the threads done so far
+};
+
+static struct deque deques[PAR_MAX_THREADS];
+static pthread_once_t deques_once = PTHREAD_ONCE_INIT;
+
+static void init_deques(void)
+{
+  for (unsigned i = 0; i < PAR_MAX_THREADS; ++i)
+    pthread_mutex_init(&deques[i].lock, NULL);
+}
+
+// the workers wait for the next job. The calling thread is thread 0, the
+// worker id takes part in the jobs of more than id threads
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct job *job;
+static unsigned job_threads;      // of job, read without touching job: it
+                                  // lives in the frame of run, which only
+                                  // waits for the threads taking part
+static unsigned long generation;  // of the jobs started so far
+static unsigned running;          // workers still on the current job
+static unsigned n_workers;        // started so far, never stopped
+
+static unsigned n_threads;        // 0 until known
+
+// the thread is running chunks: a loop in their body runs on it
+static __thread int in_chunk;
+
+void par_set_threads(unsigned n)
+{
+  n_threads = n < PAR_MAX_THREADS ? n : PAR_MAX_THREADS;
+}
+
+static unsigned threads(void)
+{
+  if (n_threads == 0) {
+    const char *s = getenv("LCI_THREADS");
+    long n = s != NULL ? atol(s) : 0;
+    if (n <= 0)
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+    par_set_threads(n > 0 ? n : 1);
+  }
+  return n_threads;
+}
+
+static int combine(int op, int acc, int x)
+{
+  switch (op) {
+  case '+': return (int)((unsigned)acc + (unsigned)x);
+  case '<': return x < acc ? x : acc;
+  case '>': return x > acc ? x : acc;
+  default: return 0;
+  }
+}
+
+static int identity(int op)
+{
+  return op == '+' ? 0 : op == '<' ? INT_MAX : INT_MIN;
+}
+
+// the next chunk of thread id: its own first, then the last one of another
+// deque; 0 once there is none left anywhere
+static int take(struct job *j, unsigned id, unsigned *chunk)
+{
+  for (unsigned k = 0; k < j->n_threads; ++k) {
+    struct deque *d = &deques[(id + k) % j->n_threads];
+    pthread_mutex_lock(&d->lock);
+    int found = d->front < d->back;
+    if (found && k == 0)
+      *chunk = d->front++;
+    else if (found)
+      *chunk = --d->back;
+    pthread_mutex_unlock(&d->lock);
+    if (found)
+      return 1;
+  }
+  return 0;
+}
+
+// the part of thread id in j: the combination of the chunks it ran
+static int run_chunks(struct job *j, unsigned id)
+{
+  volatile int acc = identity(j->op);
+  jmp_buf *saved = rt_error_handler;
+  char *saved_sink = rt_error_sink;
+  jmp_buf error;
+  char message[RT_ERROR_MAX];
+  in_chunk = 1;
+
+  if (setjmp(error) == 0) {
+    rt_error_handler = &error;
+    rt_error_sink = message;
+    unsigned chunk;
+    while (!__atomic_load_n(&j->failed, __ATOMIC_RELAXED) && take(j, id, &chunk)) {
+      long long lo = j->from + chunk * j->chunk;
+      long long hi = lo + j->chunk < j->to ? lo + j->chunk : j->to;
+      acc = combine(j->op, acc, j->body(j->ctx, lo, hi));
+    }
+  } else {
+    // the first thread to fail gives the message
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&j->failed, &expected, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      memcpy(j->error, message, RT_ERROR_MAX);
+  }
+
+  in_chunk = 0;
+  rt_error_handler = saved;
+  rt_error_sink = saved_sink;
+  return acc;
+}
+
+static void *work(void *arg)
+{
+  unsigned id = (uintptr_t)arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    while (generation == seen)
+      pthread_cond_wait(&job_cond, &pool_lock);
+    seen = generation;
+    if (id >= job_threads)
+      continue;
+    struct job *j = job;
+    pthread_mutex_unlock(&pool_lock);
+
+    int acc = run_chunks(j, id);
+
+    pthread_mutex_lock(&pool_lock);
+    j->result = combine(j->op, j->result, acc);
+    if (--running == 0)
+      pthread_cond_signal(&done_cond);
+  }
+  return NULL;
+}
+
+static int run(par_body body, void *ctx, int from, int to, int op)
+{
+  if (from >= to)
+    return identity(op);
+  long long n = (long long)to - from;
+  unsigned t = threads();
+  if (in_chunk || t == 1 || n == 1)
+    return body(ctx, from, to);
+
+  // no more threads than chunks, with at least one index each
+  long long n_chunks = n < (long long)t * PAR_CHUNKS_PER_THREAD ? n : (long long)t * PAR_CHUNKS_PER_THREAD;
+  struct job j = { body, ctx, op, from, to, (n + n_chunks - 1) / n_chunks, 0, 0, "", identity(op) };
+  n_chunks = (n + j.chunk - 1) / j.chunk;
+  j.n_threads = n_chunks < t ? n_chunks : t;
+
+  // every thread is dealt a run of consecutive chunks
+  pthread_once(&deques_once, init_deques);
+  for (unsigned i = 0; i < j.n_threads; ++i) {
+    deques[i].front = n_chunks * i / j.n_threads;
+    deques[i].back = n_chunks * (i + 1) / j.n_threads;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  for (; n_workers + 1 < j.n_threads; ++n_workers) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, work, (void *)(uintptr_t)(n_workers + 1));
+    pthread_detach(thread);
+  }
+  job = &j;
+  job_threads = j.n_threads;
+  running = j.n_threads - 1;
+  ++generation;
+  pthread_cond_broadcast(&job_cond);
+  pthread_mutex_unlock(&pool_lock);
+
+  int acc = run_chunks(&j, 0);
+
+  pthread_mutex_lock(&pool_lock);
+  while (running > 0)
+    pthread_cond_wait(&done_cond, &pool_lock);
+  pthread_mutex_unlock(&pool_lock);
+
+  // the workers are done: only this thread writes the output
+  if (j.failed)
+    rt_error(j.error);
+  return combine(op, j.result, acc);
+}
+
+void par_for(par_body body, void *ctx, int from, int to)
+{
+  run(body, ctx, from, to, 0);
+}
+
+int par_reduce(par_body body, void *ctx, int from, int to, int op)
+{
+  return run(body, ctx, from, to, op);
+}
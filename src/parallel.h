@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// The parallel for loops of the compiled code run on a pool of threads of
+// the runtime, started at the first loop and kept for the next ones. Like
+// runtime.c, it is linked as parallel.o into the executables compiled
+// ahead of time, and must not depend on LLVM.
+//
+// The indices of a loop are cut into PAR_CHUNKS_PER_THREAD chunks per
+// thread, and every thread, the calling one included, is dealt a run of
+// consecutive chunks in a deque. It goes through its own from the front;
+// once it runs out, it steals from the back of the deque of another thread.
+
+#define PAR_CHUNKS_PER_THREAD 8
+#define PAR_MAX_THREADS 256
+
+// the body of a loop, outlined by codegen_expr: runs the indices lo .. hi - 1
+// with the variables captured in ctx, and returns the reduction of their
+// values (0 without a reduction)
+typedef int (*par_body)(void *ctx, int lo, int hi);
+
+// run body on the indices from .. to - 1, on the threads of the pool
+void par_for(par_body body, void *ctx, int from, int to);
+// the same, returning the values of the chunks combined by op: '+', '<' for
+// min or '>' for max; those of an empty loop are 0, INT_MAX and INT_MIN
+int par_reduce(par_body body, void *ctx, int from, int to, int op);
+
+// A loop nested in the body of another runs on the thread of its chunk. A
+// failed bounds check in a chunk stops the loop: the threads finish the
+// chunks they are running, and the calling thread reports the error of the
+// first chunk that failed, see rt_error_sink, before control goes back to its
+// rt_error_handler, as if the check had failed there.
+
+// the number of threads running a loop, the calling one included: n from
+// now on; otherwise LCI_THREADS, or one per core
+void par_set_threads(unsigned n);
+
+#endif
@@ -1,141 +1,452 @@
-%{
-  #include <stdio.h>
-  #include "ast.h"
-
-  int yylex(void);
-  void yyerror(const char *s) {
-    fprintf(stderr, "%s\n", s);
-  }
-%}
-
-%union {
-  int lit_value;
-  char *ident;
-  struct expr* e;
-  struct expr_vect* e_ve;
-}
-
-// DEFINE ALLOWED TOKENS
-// LEAVES
-%token <lit_value> VAL
-%token <ident> IDENTIFIER
-%token LIT_TRUE LIT_FALSE
-// ENVIRONMENT
-%token LET_KW IN_KW VAR_KW
-// BRANCH
-%token IF_KW THEN_KW ELSE_KW
-// LOOP
-%token WHILE_KW DO_KW
-// BOOLEAN BINOP
-%token AND_SC AND OR_SC OR
-// EXPRESSION SEQUENCING
-%token SEQ_KW
-// SUGARED VECTOR CONSTRUCTION
-%token TIMES_KW
-// VECT OPs
-%token CONCAT_KW
-// OTHER OPS
-%token MOD
-
-// DEFINE TOKEN TYPES
-%type <e> expr
-%type <e_ve> vect_elem
-%type <e_ve> vect_elem_continuation
-%type <e_ve> expr_sequence
-%type <e_ve> expr_seq_cont
-
-
-// PRECEDENCES
-%right DO_KW
-%right ELSE_KW
-%right IN_KW
-
-%nonassoc ASSIGN_OP
-%nonassoc IDENTIFIER
-%left CONCAT_KW MOD
-%left AND_SC AND OR_SC OR
-%nonassoc '<' '>' LE GE '=' NE TIMES_KW
-%left '+' '-'
-%left '*' '/'
-%nonassoc '!'
-
-
-%%
-
-program: program expr '\n' 
-         {
-           jit_eval($2); //expr
-           free_expr($2);
-         }
-       | %empty
-       ;
-
-expr: VAL         { $$ = make_val($1); }
-    | LIT_TRUE    { $$ = make_bool(1); }
-    | LIT_FALSE   { $$ = make_bool(0); }
-    | IDENTIFIER  { $$ = make_identifier($1); }
-    
-    | LET_KW IDENTIFIER '=' expr IN_KW expr    { $$ = make_let($2, $4, $6); }
-    | VAR_KW IDENTIFIER '=' expr IN_KW expr    { $$ = make_var($2, $4, $6); }
-    | IDENTIFIER ASSIGN_OP expr                { $$ = make_assign($1, $3); }
-    
-    | IDENTIFIER '(' expr ')'    { $$ = make_call($1, $3); }
-    
-    | IF_KW expr THEN_KW expr ELSE_KW expr    { $$ = make_if($2, $4, $6); }
-
-    | WHILE_KW expr DO_KW expr                { $$ = make_while($2, $4); }
-
-    | '!' expr          { $$ = make_un_op('!', $2); }
-    | expr '+' expr     { $$ = make_bin_op($1, '+', $3); }
-    | expr '*' expr     { $$ = make_bin_op($1, '*', $3); }
-    | expr '-' expr     { $$ = make_bin_op($1, '-', $3); }
-    | expr '/' expr     { $$ = make_bin_op($1, '/', $3); }
-    | expr MOD expr     { $$ = make_bin_op($1, MOD, $3); }
-
-    | expr '<' expr     { $$ = make_bin_op($1, '<', $3); }
-    | expr '>' expr     { $$ = make_bin_op($1, '>', $3); }
-    | expr LE  expr     { $$ = make_bin_op($1, LE, $3); }
-    | expr GE  expr     { $$ = make_bin_op($1, GE, $3); }
-    | expr '=' expr     { $$ = make_bin_op($1, '=', $3); }
-    | expr NE  expr     { $$ = make_bin_op($1, NE, $3); }
-
-    | expr AND_SC expr    { $$ = make_bin_op($1, AND_SC, $3); }
-    | expr AND expr       { $$ = make_bin_op($1, AND   , $3); }
-    | expr OR_SC expr     { $$ = make_bin_op($1, OR_SC , $3); }
-    | expr OR expr        { $$ = make_bin_op($1, OR    , $3); }
-
-    | '[' vect_elem ']'                     { $$ = make_vect($2); }
-    | '[' vect_elem ']' TIMES_KW expr       { $$ = make_vect_sugared($2, $5); }        
-
-    | expr '[' expr ']'                   { $$ = make_vect_access_op($1, $3); }
-    | expr '[' expr ']' ASSIGN_OP expr    { $$ = make_vect_update_op($1, $3, $6); }
-
-    | expr CONCAT_KW expr                 { $$ = make_bin_op($1, CONCAT_KW, $3); }
-
-    | SEQ_KW expr_sequence                { $$ = make_seq($2); }
-
-    | '(' expr ')'    { $$ = $2; }
-    | '\n' expr       { $$ = $2; }
-
-
-
-vect_elem: expr vect_elem_continuation    { $$ = make_expr_vect($1, $2); }
-         | %empty                         { $$ = NULL; }
-
-vect_elem_continuation: ',' expr vect_elem_continuation    { $$ = make_expr_vect($2, $3); }
-                      | %empty                             { $$ = NULL; }
-
-expr_sequence : expr expr_seq_cont        { $$ = make_expr_vect($1, $2); }
-
-expr_seq_cont : ';' expr expr_seq_cont    { $$ = make_expr_vect($2, $3); }
-              | '.'                       { $$ = NULL; }
-              
-
-%%
-
-int main(void) 
-{
-  yyparse();
-
-  return 0;
-}
+%{
+  #include <errno.h>
+  #include <getopt.h>
+  #include <limits.h>
+  #include <stdint.h>
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <unistd.h>
+  #include "aot.h"
+  #include "ast.h"
+  #include "astfile.h"
+  #include "jit.h"
+  #include "stream.h"
+
+  int yylex(void);
+  void yyerror(const char *s) {
+    fprintf(stderr, "%s\n", s);
+  }
+
+  static struct jit_session *session;
+  static struct aot_compiler *aot;
+
+  // hand a top-level expression to the jit, or to the ahead-of-time
+  // compiler when an output file has been asked for
+  static void eval_toplevel(struct expr *e)
+  {
+    if (aot != NULL)
+      aot_add(aot, e);
+    else
+      jit_eval(session, e);
+  }
+
+  // parallel for ... reduce min or max, -1 for any other name, reported by
+  // typecheck_expr
+  static int reduce_op(int ident)
+  {
+    const char *name = symbol_name(ident);
+    return strcmp(name, "min") == 0 ? '<' : strcmp(name, "max") == 0 ? '>' : -1;
+  }
+%}
+
+%union {
+  int lit_value;
+  int ident;
+  struct expr* e;
+  struct expr_vect* e_ve;
+  struct fun_def* fn;
+}
+
+// DEFINE ALLOWED TOKENS
+// LEAVES
+%token <lit_value> VAL
+%token <ident> IDENTIFIER
+%token LIT_TRUE LIT_FALSE
+// ENVIRONMENT
+%token LET_KW IN_KW VAR_KW
+// BRANCH
+%token IF_KW THEN_KW ELSE_KW
+// LOOP
+%token WHILE_KW DO_KW
+// PARALLEL LOOP
+%token PARALLEL_KW FOR_KW REDUCE_KW
+// TILED LOOP
+%token TILE_KW
+// BOOLEAN BINOP
+%token AND_SC AND OR_SC OR
+// FUNCTIONS
+%token FUN_KW
+// EXPRESSION SEQUENCING
+%token SEQ_KW
+// SUGARED VECTOR CONSTRUCTION
+%token TIMES_KW
+// VECT OPs
+%token CONCAT_KW
+// OTHER OPS
+%token MOD
+
+// DEFINE TOKEN TYPES
+%type <e> expr
+%type <e_ve> vect_elem
+%type <e_ve> vect_elem_continuation
+%type <e_ve> expr_sequence
+%type <e_ve> expr_seq_cont
+%type <fn> fun_def
+%type <e_ve> params
+%type <e_ve> params_continuation
+%type <lit_value> reduce_op
+
+
+// PRECEDENCES
+%right DO_KW
+%right ELSE_KW
+%right IN_KW
+
+%nonassoc ASSIGN_OP
+%nonassoc IDENTIFIER
+%left CONCAT_KW MOD
+%left AND_SC AND OR_SC OR
+%nonassoc '<' '>' LE GE '=' NE TIMES_KW
+%left '+' '-'
+%left '*' '/'
+%nonassoc '!'
+
+
+%%
+
+program: program expr '\n' 
+         {
+           stream_put_expr($2); //expr
+         }
+       | program fun_def '\n'    { stream_put_fun($2); }
+       | %empty
+       ;
+
+expr: VAL         { $$ = make_val($1); }
+    | LIT_TRUE    { $$ = make_bool(1); }
+    | LIT_FALSE   { $$ = make_bool(0); }
+    | IDENTIFIER  { $$ = make_identifier($1); }
+    
+    | LET_KW IDENTIFIER '=' expr IN_KW expr    { $$ = make_let($2, $4, $6); }
+    | VAR_KW IDENTIFIER '=' expr IN_KW expr    { $$ = make_var($2, $4, $6); }
+    | IDENTIFIER ASSIGN_OP expr                { $$ = make_assign($1, $3); }
+    
+    | IDENTIFIER '(' vect_elem ')'    { $$ = make_call($1, $3); }
+    
+    | IF_KW expr THEN_KW expr ELSE_KW expr    { $$ = make_if($2, $4, $6); }
+
+    | WHILE_KW expr DO_KW expr                { $$ = make_while($2, $4); }
+
+    | PARALLEL_KW FOR_KW IDENTIFIER IN_KW expr '.' '.' expr DO_KW expr
+                                              { $$ = make_parallel_for($3, $5, $8, 0, $10); }
+    | PARALLEL_KW FOR_KW IDENTIFIER IN_KW expr '.' '.' expr REDUCE_KW reduce_op DO_KW expr
+                                              { $$ = make_parallel_for($3, $5, $8, $10, $12); }
+
+    | FOR_KW IDENTIFIER IN_KW expr '.' '.' expr ',' IDENTIFIER IN_KW expr '.' '.' expr DO_KW expr
+                                              { $$ = make_tiled_for($2, $4, $7, $9, $11, $14, NULL, $16); }
+    | FOR_KW IDENTIFIER IN_KW expr '.' '.' expr ',' IDENTIFIER IN_KW expr '.' '.' expr TILE_KW expr DO_KW expr
+                                              { $$ = make_tiled_for($2, $4, $7, $9, $11, $14, $16, $18); }
+
+    | '!' expr          { $$ = make_un_op('!', $2); }
+    | expr '+' expr     { $$ = make_bin_op($1, '+', $3); }
+    | expr '*' expr     { $$ = make_bin_op($1, '*', $3); }
+    | expr '-' expr     { $$ = make_bin_op($1, '-', $3); }
+    | expr '/' expr     { $$ = make_bin_op($1, '/', $3); }
+    | expr MOD expr     { $$ = make_bin_op($1, MOD, $3); }
+
+    | expr '<' expr     { $$ = make_bin_op($1, '<', $3); }
+    | expr '>' expr     { $$ = make_bin_op($1, '>', $3); }
+    | expr LE  expr     { $$ = make_bin_op($1, LE, $3); }
+    | expr GE  expr     { $$ = make_bin_op($1, GE, $3); }
+    | expr '=' expr     { $$ = make_bin_op($1, '=', $3); }
+    | expr NE  expr     { $$ = make_bin_op($1, NE, $3); }
+
+    | expr AND_SC expr    { $$ = make_bin_op($1, AND_SC, $3); }
+    | expr AND expr       { $$ = make_bin_op($1, AND   , $3); }
+    | expr OR_SC expr     { $$ = make_bin_op($1, OR_SC , $3); }
+    | expr OR expr        { $$ = make_bin_op($1, OR    , $3); }
+
+    | '[' vect_elem ']'                     { $$ = make_vect($2); }
+    | '[' vect_elem ']' TIMES_KW expr       { $$ = make_vect_sugared($2, $5); }        
+
+    | expr '[' expr ']'                   { $$ = make_vect_access_op($1, $3); }
+    | expr '[' expr ']' ASSIGN_OP expr    { $$ = make_vect_update_op($1, $3, $6); }
+
+    | expr CONCAT_KW expr                 { $$ = make_bin_op($1, CONCAT_KW, $3); }
+
+    | SEQ_KW expr_sequence                { $$ = make_seq($2); }
+
+    | '(' expr ')'    { $$ = $2; }
+    | '\n' expr       { $$ = $2; }
+
+
+
+reduce_op: '+'           { $$ = '+'; }
+         | IDENTIFIER    { $$ = reduce_op($1); }
+
+fun_def: FUN_KW IDENTIFIER '(' params ')' ':' IDENTIFIER '=' expr    { $$ = make_fun_def($2, $4, $7, $9); }
+
+params: IDENTIFIER ':' IDENTIFIER params_continuation    { $$ = make_expr_vect(make_param($1, $3), $4); }
+      | %empty                                          { $$ = NULL; }
+
+params_continuation: ',' IDENTIFIER ':' IDENTIFIER params_continuation    { $$ = make_expr_vect(make_param($2, $4), $5); }
+                   | %empty                                              { $$ = NULL; }
+
+vect_elem: expr vect_elem_continuation    { $$ = make_expr_vect($1, $2); }
+         | %empty                         { $$ = NULL; }
+
+vect_elem_continuation: ',' expr vect_elem_continuation    { $$ = make_expr_vect($2, $3); }
+                      | %empty                             { $$ = NULL; }
+
+expr_sequence : expr expr_seq_cont        { $$ = make_expr_vect($1, $2); }
+
+expr_seq_cont : ';' expr expr_seq_cont    { $$ = make_expr_vect($2, $3); }
+              | '.'                       { $$ = NULL; }
+              
+
+%%
+
+extern FILE *yyin;
+int scan_file(const char *path);
+
+// the count given to an option, a whole number from 1 on; returns non zero
+// if arg is anything else
+static int parse_count(const char *arg, unsigned *count)
+{
+  char *end;
+  errno = 0;
+  long n = strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || n < 1 || n > INT_MAX)
+    return 1;
+  *count = n;
+  return 0;
+}
+
+// a size in megabytes, returned in bytes; strtoull would take a sign itself
+static int parse_megabytes(const char *arg, unsigned long long *bytes)
+{
+  char *end;
+  if (*arg < '0' || *arg > '9')
+    return 1;
+  errno = 0;
+  unsigned long long n = strtoull(arg, &end, 10);
+  if (errno != 0 || *end != '\0' || n > SIZE_MAX >> 20)
+    return 1;
+  *bytes = n << 20;
+  return 0;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options] [file]\n"
+          "  -O0 .. -O3          optimisation level (default -O2)\n"
+          "  -r N                run every expression N times, for benchmarking\n"
+          "  -o output           compile ahead of time into an executable\n"
+          "  -c                  with -o, only write the object file\n"
+          "  --checked           check the indices of vector accesses at runtime\n"
+          "  --batch             parse the whole input, then compile the expressions\n"
+          "                      in parallel and run them in order\n"
+          "  -j N                threads compiling with --batch (default: one per core)\n"
+          "  --cache DIR         cache the compiled code in DIR\n"
+          "  --cache-size MB     bound on the size of the cache (default 64)\n"
+          "  --tiered            interpret the expressions, compiling only their hot\n"
+          "                      loops and calls (not with --batch)\n"
+          "  --profile-gen FILE  count how the branches of the program go, into FILE\n"
+          "                      (not with -o)\n"
+          "  --profile-use FILE  optimise with the counts of an earlier --profile-gen\n"
+          "  --threads N         threads running the parallel for loops (default:\n"
+          "                      LCI_THREADS, or one per core)\n"
+          "  --dump-ir           print the IR of every expression on stderr\n"
+          "  --stats FILE        write the time and memory every expression took\n"
+          "                      to FILE (- for stderr), as JSON lines\n"
+          "  --emit-ast FILE     write the parsed program to FILE, and run nothing\n"
+          "                      (not with -o)\n"
+          "  --load-ast FILE     read the program from a file of --emit-ast instead\n"
+          "                      of parsing it\n",
+          argv0);
+}
+
+enum { OPT_CACHE = 256, OPT_CACHE_SIZE, OPT_CHECKED, OPT_BATCH, OPT_DUMP_IR, OPT_STATS, OPT_TIERED,
+       OPT_PROFILE_GEN, OPT_PROFILE_USE, OPT_THREADS, OPT_EMIT_AST, OPT_LOAD_AST };
+
+static const struct option long_options[] = {
+  { "checked",    no_argument,       NULL, OPT_CHECKED },
+  { "batch",      no_argument,       NULL, OPT_BATCH },
+  { "cache",      required_argument, NULL, OPT_CACHE },
+  { "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+  { "tiered",     no_argument,       NULL, OPT_TIERED },
+  { "dump-ir",    no_argument,       NULL, OPT_DUMP_IR },
+  { "profile-gen", required_argument, NULL, OPT_PROFILE_GEN },
+  { "profile-use", required_argument, NULL, OPT_PROFILE_USE },
+  { "stats",      required_argument, NULL, OPT_STATS },
+  { "threads",    required_argument, NULL, OPT_THREADS },
+  { "emit-ast",   required_argument, NULL, OPT_EMIT_AST },
+  { "load-ast",   required_argument, NULL, OPT_LOAD_AST },
+  { "help",       no_argument,       NULL, 'h' },
+  { NULL, 0, NULL, 0 },
+};
+
+int main(int argc, char **argv)
+{
+  struct jit_options opts = {
+    .opt_level = 2,
+    .repeat = 1,
+    .checked = 0,
+    .jobs = 0,
+    .tiered = 0,
+    .threads = 0,
+    .dump_ir = 0,
+    .stats_path = NULL,
+    .profile_gen = NULL,
+    .profile_use = NULL,
+    .cache_dir = NULL,
+    .cache_bytes = 64ULL << 20,
+  };
+  const char *output = NULL;
+  int object_only = 0;
+  int batch = 0;
+  const char *emit_ast = NULL;
+  const char *load_ast = NULL;
+  unsigned jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "O:r:co:j:h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'O':
+      if (optarg[0] < '0' || optarg[0] > '3' || optarg[1] != '\0') {
+        usage(argv[0]);
+        return 1;
+      }
+      opts.opt_level = optarg[0] - '0';
+      break;
+    case 'r':
+      if (parse_count(optarg, &opts.repeat)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'c':
+      object_only = 1;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'j':
+      if (parse_count(optarg, &jobs)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_CHECKED:
+      opts.checked = 1;
+      break;
+    case OPT_BATCH:
+      batch = 1;
+      break;
+    case OPT_CACHE:
+      opts.cache_dir = optarg;
+      break;
+    case OPT_CACHE_SIZE:
+      if (parse_megabytes(optarg, &opts.cache_bytes)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_TIERED:
+      opts.tiered = 1;
+      break;
+    case OPT_DUMP_IR:
+      opts.dump_ir = 1;
+      break;
+    case OPT_STATS:
+      opts.stats_path = optarg;
+      break;
+    case OPT_PROFILE_GEN:
+      opts.profile_gen = optarg;
+      break;
+    case OPT_PROFILE_USE:
+      opts.profile_use = optarg;
+      break;
+    case OPT_THREADS:
+      if (parse_count(optarg, &opts.threads)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_EMIT_AST:
+      emit_ast = optarg;
+      break;
+    case OPT_LOAD_AST:
+      load_ast = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt != 'h';
+    }
+  }
+
+  // a pre-parsed program replaces the source
+  if (load_ast != NULL && optind < argc) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load_ast != NULL) {
+    if (ast_load_file(load_ast))
+      return 1;
+  } else if (optind < argc) {
+    if (scan_file(argv[optind])) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  int (*parse)(void) = load_ast != NULL ? ast_parse : yyparse;
+
+  if ((object_only && output == NULL) || (emit_ast != NULL && output != NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // the expressions of --tiered are interpreted one after the other
+  if (opts.tiered && batch) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // the counters of --profile-gen are read back by the jit
+  if (opts.profile_gen != NULL && (output != NULL || opts.profile_use != NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // the items are written as they are parsed, none is checked nor run
+  if (emit_ast != NULL) {
+    if (ast_emit_open(emit_ast))
+      return 1;
+    int failed = stream_run(parse, ast_emit_expr, ast_emit_fun, 0, 1);
+    failed = ast_emit_close() || failed;
+    if (failed)
+      remove(emit_ast);
+    stream_release();
+    return failed;
+  }
+
+  // the ahead-of-time compiler builds a single module: --batch is the jit's
+  if (batch && output == NULL)
+    opts.jobs = jobs;
+
+  if (output != NULL)
+    aot = aot_create(&opts);
+  else
+    session = jit_session_create(&opts);
+  if (aot == NULL && session == NULL)
+    return 1;
+
+  // the expressions are compiled on this thread while the next ones are
+  // being parsed. The expressions of a program on stdin are run as they are
+  // parsed, so that the parser does not read their input before them
+  int from_stdin = load_ast == NULL && optind >= argc;
+  int ahead = !from_stdin || output != NULL || opts.jobs > 0;
+  int failed = stream_run(parse, eval_toplevel, define_function, opts.jobs > 0, ahead);
+
+  if (aot != NULL) {
+    failed = failed || aot_finish(aot, output, object_only);
+    aot_dispose(aot);
+  } else {
+    jit_run_batch(session);
+    jit_session_dispose(session);
+  }
+  stream_release();
+  return failed;
+}
@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+// the tasks of a thread still to be run, from front to back
+struct deque {
+  pthread_mutex_t lock;
+  unsigned *tasks;
+  unsigned front, back;
+};
+
+struct worker {
+  struct pool *pool;
+  unsigned id;
+  pthread_t thread;
+  void *state;
+};
+
+struct pool {
+  const struct pool_ops *ops;
+  void *arg;
+
+  unsigned n_threads;
+  struct worker *workers;
+  struct deque *deques;
+  unsigned long n_steals;
+
+  pthread_mutex_t done_lock;
+  pthread_cond_t done_cond;
+  unsigned char *done;
+};
+
+// the next task of the worker: its own first, then the last one of another
+// deque; 0 once there is none left anywhere
+static int take(struct worker *w, unsigned *task)
+{
+  struct pool *pool = w->pool;
+  for (unsigned k = 0; k < pool->n_threads; ++k) {
+    struct deque *d = &pool->deques[(w->id + k) % pool->n_threads];
+    pthread_mutex_lock(&d->lock);
+    int found = d->front < d->back;
+    if (found && k == 0)
+      *task = d->tasks[d->front++];
+    else if (found)
+      *task = d->tasks[--d->back];
+    pthread_mutex_unlock(&d->lock);
+
+    if (found) {
+      if (k > 0)
+        __atomic_add_fetch(&pool->n_steals, 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *work(void *arg)
+{
+  struct worker *w = arg;
+  struct pool *pool = w->pool;
+  w->state = pool->ops->init(pool->arg);
+
+  unsigned task;
+  while (take(w, &task)) {
+    pool->ops->run(w->state, task, pool->arg);
+
+    pthread_mutex_lock(&pool->done_lock);
+    pool->done[task] = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+  }
+  return NULL;
+}
+
+struct pool *pool_start( unsigned n_threads
+                       , unsigned n_tasks
+                       , const struct pool_ops *ops
+                       , void *arg)
+{
+  struct pool *pool = malloc(sizeof(struct pool));
+  pool->ops = ops;
+  pool->arg = arg;
+  pool->n_threads = n_threads;
+  pool->n_steals = 0;
+  pthread_mutex_init(&pool->done_lock, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->done = calloc(n_tasks ? n_tasks : 1, 1);
+
+  // the tasks are dealt round robin, so that every thread starts with the
+  // earliest ones
+  pool->deques = malloc(n_threads * sizeof(struct deque));
+  for (unsigned i = 0; i < n_threads; ++i) {
+    struct deque *d = &pool->deques[i];
+    pthread_mutex_init(&d->lock, NULL);
+    d->tasks = malloc((n_tasks / n_threads + 1) * sizeof(unsigned));
+    d->front = d->back = 0;
+  }
+  for (unsigned task = 0; task < n_tasks; ++task) {
+    struct deque *d = &pool->deques[task % n_threads];
+    d->tasks[d->back++] = task;
+  }
+
+  pool->workers = malloc(n_threads * sizeof(struct worker));
+  for (unsigned i = 0; i < n_threads; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+    pthread_create(&pool->workers[i].thread, NULL, work, &pool->workers[i]);
+  }
+  return pool;
+}
+
+void pool_wait(struct pool *pool, unsigned task)
+{
+  pthread_mutex_lock(&pool->done_lock);
+  while (!pool->done[task])
+    pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+  pthread_mutex_unlock(&pool->done_lock);
+}
+
+unsigned long pool_finish(struct pool *pool)
+{
+  for (unsigned i = 0; i < pool->n_threads; ++i)
+    pthread_join(pool->workers[i].thread, NULL);
+  for (unsigned i = 0; i < pool->n_threads; ++i) {
+    pool->ops->fini(pool->workers[i].state);
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  unsigned long n_steals = pool->n_steals;
+
+  pthread_mutex_destroy(&pool->done_lock);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool->done);
+  free(pool->deques);
+  free(pool->workers);
+  free(pool);
+  return n_steals;
+}
@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+// A pool of threads working through the tasks 0 .. n_tasks - 1, all known
+// from the start. Every thread is dealt its share of the tasks in a deque,
+// which it goes through from the front, in increasing order; once it runs
+// out, it steals from the back of the deque of another thread. The tasks
+// of the front are done first, so that their results can be consumed in
+// order while the others are being worked on.
+struct pool;
+
+struct pool_ops {
+  // the state of a thread, created on the thread itself
+  void *(*init)(void *arg);
+  void (*run)(void *state, unsigned task, void *arg);
+  // called by pool_finish, once every thread is done
+  void (*fini)(void *state);
+};
+
+struct pool *pool_start( unsigned n_threads
+                       , unsigned n_tasks
+                       , const struct pool_ops *ops
+                       , void *arg);
+
+// wait until task has been run
+void pool_wait(struct pool *pool, unsigned task);
+
+// wait for the threads and release the pool; returns the number of tasks
+// that were stolen
+unsigned long pool_finish(struct pool *pool);
+
+#endif
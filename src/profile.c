@@ -0,0 +1,209 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "profile.h"
+#include "y.tab.h"
+
+enum profile_mode profile_mode;
+
+#define PROFILE_BUCKETS 4096
+
+struct profile_entry {
+  struct profile_entry *next;
+  uint64_t item;
+  unsigned rank;
+  struct branch_counts counts;
+};
+
+// the counts do not move once created: the generated code points at them
+static struct profile_entry *buckets[PROFILE_BUCKETS];
+
+static struct profile_entry **bucket(uint64_t item, unsigned rank)
+{
+  return &buckets[(item ^ (item >> 32) ^ rank * 2654435761u) % PROFILE_BUCKETS];
+}
+
+static struct profile_entry *lookup(uint64_t item, unsigned rank, int create)
+{
+  struct profile_entry **b = bucket(item, rank);
+  for (struct profile_entry *p = *b; p != NULL; p = p->next) {
+    if (p->item == item && p->rank == rank)
+      return p;
+  }
+  if (!create)
+    return NULL;
+
+  struct profile_entry *p = calloc(1, sizeof(struct profile_entry));
+  p->item = item;
+  p->rank = rank;
+  p->next = *b;
+  *b = p;
+  return p;
+}
+
+int profile_load(const char *path)
+{
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  // one branch per line: item rank n_true n_false flips
+  uint64_t item, n_true, n_false, flips;
+  unsigned rank;
+  int n;
+  while ((n = fscanf(in, "%" SCNx64 " %u %" SCNu64 " %" SCNu64 " %" SCNu64,
+                     &item, &rank, &n_true, &n_false, &flips)) == 5) {
+    struct profile_entry *p = lookup(item, rank, 1);
+    p->counts.n_true += n_true;
+    p->counts.n_false += n_false;
+    p->counts.flips += flips;
+  }
+  fclose(in);
+
+  if (n != EOF) {
+    fprintf(stderr, "%s: not a profile\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+uint64_t profile_hash(void)
+{
+  // independent of the order of the entries in the buckets
+  uint64_t h = 0;
+  for (unsigned k = 0; k < PROFILE_BUCKETS; ++k) {
+    for (struct profile_entry *p = buckets[k]; p != NULL; p = p->next) {
+      char line[96];
+      snprintf(line, sizeof(line), "%" PRIx64 " %u %" PRIu64 " %" PRIu64 " %" PRIu64,
+               p->item, p->rank, p->counts.n_true, p->counts.n_false, p->counts.flips);
+      h += hash_string(HASH_SEED, line);
+    }
+  }
+  return h;
+}
+
+int profile_save(const char *path)
+{
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return 1;
+  }
+  for (unsigned k = 0; k < PROFILE_BUCKETS; ++k) {
+    for (struct profile_entry *p = buckets[k]; p != NULL; p = p->next) {
+      fprintf(out, "%016" PRIx64 " %u %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+              p->item, p->rank, p->counts.n_true, p->counts.n_false, p->counts.flips);
+    }
+  }
+  if (fclose(out) != 0) {
+    perror(path);
+    return 1;
+  }
+  return 0;
+}
+
+static void attach_vect(struct expr_vect *ve, uint64_t item, unsigned *rank);
+
+static void attach(struct expr *e, uint64_t item, unsigned *rank)
+{
+  switch (e->type) {
+  case LET:
+  case VAR:
+    attach(e->let.expr, item, rank);
+    attach(e->let.body, item, rank);
+    return;
+
+  case ASSIGN:
+    attach(e->assign.expr, item, rank);
+    return;
+
+  case IF:
+  case WHILE:
+  case BIN_OP: {
+    int branch = e->type != BIN_OP || e->binop.op == AND_SC || e->binop.op == OR_SC;
+    if (branch) {
+      struct profile_entry *p = lookup(item, (*rank)++, profile_mode == PROFILE_GEN);
+      e->counts = p != NULL ? &p->counts : NULL;
+    }
+    if (e->type == IF) {
+      attach(e->if_expr.cond, item, rank);
+      attach(e->if_expr.e_true, item, rank);
+      attach(e->if_expr.e_false, item, rank);
+    } else if (e->type == WHILE) {
+      attach(e->while_expr.cond, item, rank);
+      attach(e->while_expr.body, item, rank);
+    } else {
+      attach(e->binop.lhs, item, rank);
+      attach(e->binop.rhs, item, rank);
+    }
+    return;
+  }
+
+  case CALL:
+    attach_vect(e->call.args, item, rank);
+    return;
+
+  case UN_OP:
+    attach(e->unop.expr, item, rank);
+    return;
+
+  case VECTOR:
+  case SEQ:
+    attach_vect(e->vect, item, rank);
+    return;
+
+  case VECTOR_ACCESS_OP:
+    attach(e->vect_access.base, item, rank);
+    attach(e->vect_access.offset, item, rank);
+    if (e->vect_access.col != NULL)
+      attach(e->vect_access.col, item, rank);
+    return;
+
+  case VECTOR_UPDATE_OP:
+    attach(e->vect_update.base, item, rank);
+    attach(e->vect_update.offset, item, rank);
+    if (e->vect_update.col != NULL)
+      attach(e->vect_update.col, item, rank);
+    attach(e->vect_update.rhs, item, rank);
+    return;
+
+  case SUGARED_VECTOR_BUILD_OP:
+    attach_vect(e->vect_build.sample, item, rank);
+    attach(e->vect_build.len, item, rank);
+    return;
+
+  case PARALLEL_FOR:
+    attach(e->par_for.from, item, rank);
+    attach(e->par_for.to, item, rank);
+    attach(e->par_for.body, item, rank);
+    return;
+
+  case TILED_FOR:
+    attach(e->tiled_for.from, item, rank);
+    attach(e->tiled_for.to, item, rank);
+    attach(e->tiled_for.col_from, item, rank);
+    attach(e->tiled_for.col_to, item, rank);
+    if (e->tiled_for.tile != NULL)
+      attach(e->tiled_for.tile, item, rank);
+    attach(e->tiled_for.body, item, rank);
+    return;
+
+  default:
+    return;
+  }
+}
+
+static void attach_vect(struct expr_vect *ve, uint64_t item, unsigned *rank)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    attach(ve->curr_expr, item, rank);
+}
+
+void profile_attach(struct expr *e, uint64_t item)
+{
+  unsigned rank = 0;
+  attach(e, item, &rank);
+}
@@ -0,0 +1,60 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "ast.h"
+
+// Profile-guided optimisation. With --profile-gen the branches of the
+// program (IF, WHILE, AND_SC and OR_SC nodes) count the outcomes of their
+// condition as it runs, compiled or interpreted, and the counts are saved
+// to a file at the end. With --profile-use a later compile of the same
+// program reads them back: the branches get their weights, the loops that
+// go round only a few times are not unrolled nor vectorised, and the short
+// ifs whose condition keeps changing become selects.
+//
+// A branch is known by the hash of the top-level expression or function it
+// is part of, and by its rank among the branches there, in pre-order: the
+// profile only applies to the same program, once folded.
+enum profile_mode { PROFILE_OFF, PROFILE_GEN, PROFILE_USE };
+extern enum profile_mode profile_mode;
+
+struct branch_counts {
+  uint64_t n_true;      // the condition held: the then arm, the loop body,
+                        // the rhs of AND_SC, the rhs skipped by OR_SC
+  uint64_t n_false;
+  uint64_t flips;       // the outcome differed from the one before
+  uint64_t last;        // the outcome before, 0 or 1
+};
+
+// loops going round fewer times than this per run are short
+#define PROFILE_SHORT_TRIPS 4
+// an if whose outcome changes at least once in that many runs is
+// unpredictable; it is lowered to a select when both its arms have at most
+// PROFILE_SELECT_NODES nodes
+#define PROFILE_FLIP_RATIO 8
+#define PROFILE_SELECT_NODES 5
+
+// --profile-use: read the profile written by an earlier --profile-gen,
+// returns non zero on failure
+int profile_load(const char *path);
+// a hash of the counts loaded, for the compiled code cache
+uint64_t profile_hash(void);
+// --profile-gen: write the counts of every branch seen, returns non zero on
+// failure
+int profile_save(const char *path);
+
+// point the counts of every branch of the checked expression e, from the
+// item hashed as item, at the profile: with --profile-gen they are created,
+// with --profile-use those missing from the profile are left NULL
+void profile_attach(struct expr *e, uint64_t item);
+
+// --profile-gen: one more run of the branch of c, which went the outcome
+// way; the code generated for the branches does the same
+static inline void profile_count(struct branch_counts *c, int outcome)
+{
+  ++*(outcome ? &c->n_true : &c->n_false);
+  c->flips += c->last != (uint64_t)outcome;
+  c->last = outcome;
+}
+
+#endif
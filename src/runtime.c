@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+// stdin and stdout go through buffers of their own, with the integers
+// parsed and formatted by hand: a scanf or a printf per integer spends most
+// of its time locking the stream and interpreting the format
+#define IO_BUF_SIZE (64 * 1024)
+
+static char out_buf[IO_BUF_SIZE];
+static size_t out_len;
+
+static char in_buf[IO_BUF_SIZE];
+static size_t in_pos, in_len;
+
+void rt_flush(void)
+{
+  fwrite(out_buf, 1, out_len, stdout);
+  out_len = 0;
+  fflush(stdout);
+}
+
+// room for n more bytes in the output buffer
+static void out_reserve(size_t n)
+{
+  if (IO_BUF_SIZE - out_len < n)
+    rt_flush();
+}
+
+static void out_str(const char *s)
+{
+  size_t n = strlen(s);
+  out_reserve(n);
+  memcpy(out_buf + out_len, s, n);
+  out_len += n;
+}
+
+static void out_i32(int x)
+{
+  out_reserve(11);
+  char digits[10];
+  unsigned u = x < 0 ? 0u - (unsigned)x : (unsigned)x;
+  int n = 0;
+  do {
+    digits[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+
+  if (x < 0)
+    out_buf[out_len++] = '-';
+  while (n > 0)
+    out_buf[out_len++] = digits[--n];
+}
+
+// refill the input buffer, read only returns what is available so that
+// interactive input is not waited for; the next byte, or EOF
+static int in_fill(void)
+{
+  ssize_t n;
+  do {
+    n = read(STDIN_FILENO, in_buf, IO_BUF_SIZE);
+  } while (n < 0 && errno == EINTR);
+  in_pos = 0;
+  in_len = n > 0 ? n : 0;
+  return in_len > 0 ? (unsigned char)in_buf[0] : EOF;
+}
+
+// the next input byte, without consuming it
+static inline int in_peek(void)
+{
+  return in_pos < in_len ? (unsigned char)in_buf[in_pos] : in_fill();
+}
+
+void print_i32(int x)
+{
+  out_i32(x);
+  out_str("\n");
+}
+
+// the next integer on stdin, or defaultValue at the end of the input or
+// when something else than an integer comes next
+int read_i32(int defaultValue)
+{
+  int c = in_peek();
+  while (c == ' ' || (c >= '\t' && c <= '\r')) {
+    ++in_pos;
+    c = in_peek();
+  }
+
+  int negative = c == '-';
+  if (c == '-' || c == '+') {
+    ++in_pos;
+    c = in_peek();
+  }
+  if (c < '0' || c > '9')
+    return defaultValue;
+
+  // out of range values wrap, like the arithmetic of the language
+  unsigned x = 0;
+  while (c >= '0' && c <= '9') {
+    x = x * 10 + (c - '0');
+    ++in_pos;
+    c = in_peek();
+  }
+  return negative ? (int)(0u - x) : (int)x;
+}
+
+// vectors are bump allocated in a list of chunks, all released at once by
+// vect_reset once the result of the expression has been printed. The body
+// of a parallel for allocates the vectors it binds from its threads
+#define VECT_CHUNK_SIZE (64 * 1024)
+
+struct vect_chunk {
+  struct vect_chunk *next;
+  size_t size, used;
+  _Alignas(16) unsigned char data[];
+};
+
+static struct vect_chunk *vect_chunks;
+
+// bytes handed out since the last vect_reset, and the most there were since
+// the last vect_take_peak
+static size_t vect_bytes, vect_peak;
+static pthread_mutex_t vect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct rt_vect *vect_alloc(int len, int elem_size)
+{
+  if (len < 0)
+    len = 0;
+  size_t size = (sizeof(struct rt_vect) + (size_t)len * elem_size + 15) & ~(size_t)15;
+
+  pthread_mutex_lock(&vect_lock);
+  struct vect_chunk *c = vect_chunks;
+  if (c == NULL || c->size - c->used < size) {
+    size_t chunk_size = size > VECT_CHUNK_SIZE ? size : VECT_CHUNK_SIZE;
+    c = malloc(sizeof(struct vect_chunk) + chunk_size);
+    if (c == NULL) {
+      fprintf(stderr, "Out of memory allocating a vector of %d elements\n", len);
+      exit(1);
+    }
+    c->size = chunk_size;
+    c->used = 0;
+    c->next = vect_chunks;
+    vect_chunks = c;
+  }
+
+  struct rt_vect *v = (struct rt_vect *)(c->data + c->used);
+  c->used += size;
+  vect_bytes += size;
+  if (vect_bytes > vect_peak)
+    vect_peak = vect_bytes;
+  pthread_mutex_unlock(&vect_lock);
+  v->len = len;
+  return v;
+}
+
+void vect_reset(void)
+{
+  while (vect_chunks != NULL) {
+    struct vect_chunk *next = vect_chunks->next;
+    free(vect_chunks);
+    vect_chunks = next;
+  }
+  vect_bytes = 0;
+}
+
+size_t vect_take_peak(void)
+{
+  size_t peak = vect_peak;
+  vect_peak = vect_bytes;
+  return peak;
+}
+
+struct rt_vect *read_vec(int len)
+{
+  struct rt_vect *v = vect_alloc(len, sizeof(int));
+  int *data = (int *)v->data;
+  for (int i = 0; i < v->len; ++i)
+    data[i] = read_i32(0);
+  return v;
+}
+
+void print_vec(const int *data, int len)
+{
+  for (int i = 0; i < len; ++i) {
+    out_i32(data[i]);
+    out_str("\n");
+  }
+}
+
+__thread jmp_buf *rt_error_handler;
+__thread char *rt_error_sink;
+
+void rt_abandon(void)
+{
+  if (rt_error_handler != NULL)
+    longjmp(*rt_error_handler, 1);
+  exit(1);
+}
+
+void rt_error(const char *message)
+{
+  if (rt_error_sink != NULL) {
+    snprintf(rt_error_sink, RT_ERROR_MAX, "%s", message);
+  } else {
+    rt_flush();
+    fputs(message, stderr);
+  }
+  rt_abandon();
+}
+
+void vect_index_error(int idx, int len)
+{
+  char message[RT_ERROR_MAX];
+  snprintf(message, sizeof(message), "Runtime error: index %d out of bounds for a vector of length %d\n", idx, len);
+  rt_error(message);
+}
+
+void matrix_index_error(int row, int col, int rows, int cols)
+{
+  char message[RT_ERROR_MAX];
+  snprintf(message, sizeof(message), "Runtime error: index [%d][%d] out of bounds for a %dx%d matrix\n",
+           row, col, rows, cols);
+  rt_error(message);
+}
+
+void vect_length_error(long long len)
+{
+  char message[RT_ERROR_MAX];
+  snprintf(message, sizeof(message), "Runtime error: a vector of %lld elements is too long\n", len);
+  rt_error(message);
+}
+
+void print_result_i32(int x)
+{
+  out_str("-> ");
+  out_i32(x);
+  out_str("\n");
+}
+
+void print_result_unit(void)
+{
+  out_str("-> done\n");
+}
+
+void print_result_vect(struct rt_vect *v, int elem_size, int cols)
+{
+  out_str("-> [");
+  for (int i = 0; i < v->len; ++i) {
+    int x = elem_size == sizeof(int) ? ((int *)v->data)[i] : v->data[i];
+    if (i > 0)
+      out_str(cols > 0 && i % cols == 0 ? "], " : ", ");
+    if (cols > 0 && i % cols == 0)
+      out_str("[");
+    out_i32(x);
+  }
+  out_str(cols > 0 && v->len > 0 ? "]]\n" : "]\n");
+}
@@ -0,0 +1,61 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <setjmp.h>
+#include <stddef.h>
+
+// The runtime the compiled code calls into. It is part of jit_eval, and it
+// is linked as runtime.o into the executables compiled ahead of time, so it
+// must not depend on LLVM.
+
+// Vectors handed over between compiled code and the runtime: the layout of
+// the LLVM type { i32, [0 x T] }, with the elements stored right after
+// the length.
+struct rt_vect {
+  int len;
+  unsigned char data[];
+};
+
+// stdout is buffered by the runtime: rt_flush writes out what the compiled
+// code and the print_result functions printed so far
+void print_i32(int x);
+int read_i32(int defaultValue);
+void rt_flush(void);
+// vectors built at runtime live until the next vect_reset
+struct rt_vect *vect_alloc(int len, int elem_size);
+void vect_reset(void);
+// the most bytes of vectors alive at once since the last call
+size_t vect_take_peak(void);
+
+// whole vectors at once, one integer per line: read_vec fills the missing
+// elements with 0
+struct rt_vect *read_vec(int len);
+void print_vec(const int *data, int len);
+
+// the failed bounds checks of --checked end up here: the error is reported
+// and control goes back to rt_error_handler when it is set, as the jit does
+// around the evaluation of each expression, otherwise the program exits.
+// Every thread has its own handler, see parallel.h
+extern __thread jmp_buf *rt_error_handler;
+void vect_index_error(int idx, int len);
+void matrix_index_error(int row, int col, int rows, int cols);
+// a times vector of runtime length whose len elements do not fit in an int
+void vect_length_error(long long len);
+// the second half of the index errors, once the error has been reported
+void rt_abandon(void);
+// report message, then abandon. A thread running the chunks of a parallel
+// for only copies it to rt_error_sink, RT_ERROR_MAX bytes, for the calling
+// thread to report once the loop is over: the output is not flushed from two
+// threads at once
+#define RT_ERROR_MAX 128
+extern __thread char *rt_error_sink;
+void rt_error(const char *message);
+
+// print the result of a top-level expression
+void print_result_i32(int x);
+void print_result_unit(void);
+// elem_size tells int (4) from bool (1) elements; the elements of a matrix
+// are printed row by row, cols at a time (0 for a plain vector)
+void print_result_vect(struct rt_vect *v, int elem_size, int cols);
+
+#endif
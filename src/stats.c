@@ -0,0 +1,34 @@
+#include <sys/resource.h>
+
+#include "codemem.h"
+#include "stats.h"
+
+unsigned count_instructions(LLVMModuleRef module)
+{
+  unsigned n = 0;
+  for (LLVMValueRef f = LLVMGetFirstFunction(module); f != NULL; f = LLVMGetNextFunction(f))
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(f); bb != NULL; bb = LLVMGetNextBasicBlock(bb))
+      for (LLVMValueRef i = LLVMGetFirstInstruction(bb); i != NULL; i = LLVMGetNextInstruction(i))
+        ++n;
+  return n;
+}
+
+void stats_write(FILE *out, unsigned index, const struct expr_stats *s)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  fprintf(out,
+          "{\"expr\":%u,\"cached\":%s,"
+          "\"parse_ms\":%.4f,\"check_ms\":%.4f,\"codegen_ms\":%.4f,\"verify_ms\":%.4f,"
+          "\"optimise_ms\":%.4f,\"emit_ms\":%.4f,\"run_ms\":%.4f,"
+          "\"ir_insts\":%u,\"opt_insts\":%u,\"ast_bytes\":%lu,"
+          "\"code_bytes\":%llu,\"data_bytes\":%llu,\"vect_bytes\":%llu,"
+          "\"jit_mapped_bytes\":%llu,\"max_rss_kb\":%ld}\n",
+          index, s->cached ? "true" : "false",
+          s->parse_ms, s->check_ms, s->codegen_ms, s->verify_ms,
+          s->optimise_ms, s->emit_ms, s->run_ms,
+          s->ir_insts, s->opt_insts, s->ast_bytes,
+          s->code_bytes, s->data_bytes, s->vect_bytes,
+          code_memory_mapped(), usage.ru_maxrss);
+}
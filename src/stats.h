@@ -0,0 +1,35 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <llvm-c/Core.h>
+
+// --stats: where the compilation and the run of a top-level expression went,
+// written as one JSON object per line
+struct expr_stats {
+  // milliseconds spent in each phase
+  double parse_ms;      // on the parser thread
+  double check_ms;      // typecheck, folding and bounds analysis
+  double codegen_ms;
+  double verify_ms;
+  double optimise_ms;
+  double emit_ms;       // machine code emission by MCJIT
+  double run_ms;
+
+  int cached;           // the IR was loaded from the cache, in codegen_ms,
+                        // and neither verified nor optimised
+  unsigned ir_insts;    // IR instructions generated
+  unsigned opt_insts;   // left once optimised
+  unsigned long ast_bytes;          // nodes allocated by the parser
+  unsigned long long code_bytes;    // machine code emitted
+  unsigned long long data_bytes;    // data sections emitted
+  unsigned long long vect_bytes;    // high-water mark of the runtime vectors
+};
+
+unsigned count_instructions(LLVMModuleRef module);
+
+// the line of the index-th expression, along with the high-water marks of
+// the whole process: its resident memory and the jit memory mapped so far
+void stats_write(FILE *out, unsigned index, const struct expr_stats *s);
+
+#endif
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "stream.h"
+
+// how far ahead of the compiler the parser can get
+#define QUEUE_SIZE 64
+
+enum item_kind { ITEM_EXPR, ITEM_FUN, ITEM_END };
+
+struct item {
+  enum item_kind kind;
+  union {
+    struct expr *expr;
+    struct fun_def *fun;
+    int failed;       // the result of parse, for ITEM_END
+  };
+  struct arena arena;
+  double parse_ms;
+  unsigned long ast_bytes;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+
+static struct item queue[QUEUE_SIZE];
+static unsigned head, tail;     // tail - head items are waiting
+
+// the arenas of the evaluated expressions, reset, for the parser to reuse
+// without going through malloc again
+static struct arena *free_arenas;
+static unsigned n_free, free_cap;
+
+// the arenas of the definitions, and of the expressions put aside, alive
+// until the end
+static struct arena *kept_arenas;
+static unsigned n_kept, kept_cap;
+
+static int (*parse_fn)(void);
+static void (*eval_fn)(struct expr *);
+static int (*define_fn)(struct fun_def *);
+static int keep;
+
+// the parser runs on a thread of its own; otherwise every item is handed
+// over by put, before the parser reads any further
+static int parse_ahead;
+
+// parser thread: when the current item was started, and the bytes its arena
+// had handed out by then
+static double item_start;
+static unsigned long item_start_bytes;
+
+// the item being evaluated
+static struct item current;
+
+static void hand_over(struct item *item);
+
+static void put(struct item *item)
+{
+  item->parse_ms = time_ms() - item_start;
+  item->ast_bytes = ast_arena.n_bytes - item_start_bytes;
+  int queued = parse_ahead || item->kind == ITEM_END;
+
+  pthread_mutex_lock(&lock);
+  while (queued && tail - head == QUEUE_SIZE)
+    pthread_cond_wait(&not_full, &lock);
+
+  item->arena = ast_arena;
+  if (n_free > 0)
+    ast_arena = free_arenas[--n_free];
+  else
+    ast_arena = (struct arena){ 0 };
+
+  if (queued) {
+    queue[tail++ % QUEUE_SIZE] = *item;
+    pthread_cond_signal(&not_empty);
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (!queued)
+    hand_over(item);
+
+  item_start = time_ms();
+  item_start_bytes = ast_arena.n_bytes;
+}
+
+static void get(struct item *item)
+{
+  pthread_mutex_lock(&lock);
+  while (tail == head)
+    pthread_cond_wait(&not_empty, &lock);
+  *item = queue[head++ % QUEUE_SIZE];
+  pthread_cond_signal(&not_full);
+  pthread_mutex_unlock(&lock);
+}
+
+static void append(struct arena **arenas, unsigned *n, unsigned *cap, struct arena *a)
+{
+  if (*n == *cap) {
+    *cap = *cap ? *cap * 2 : 16;
+    *arenas = realloc(*arenas, *cap * sizeof(struct arena));
+  }
+  (*arenas)[(*n)++] = *a;
+}
+
+static void recycle(struct arena *a)
+{
+  arena_reset(a);
+  pthread_mutex_lock(&lock);
+  append(&free_arenas, &n_free, &free_cap, a);
+  pthread_mutex_unlock(&lock);
+}
+
+void stream_put_expr(struct expr *e)
+{
+  struct item item = { .kind = ITEM_EXPR, .expr = e };
+  put(&item);
+}
+
+void stream_put_fun(struct fun_def *f)
+{
+  struct item item = { .kind = ITEM_FUN, .fun = f };
+  put(&item);
+}
+
+static void *parser_thread(void *arg)
+{
+  item_start = time_ms();
+  item_start_bytes = ast_arena.n_bytes;
+  struct item item = { .kind = ITEM_END, .failed = parse_fn() };
+  put(&item);
+  return NULL;
+}
+
+// the counters of a, added to the ones of total; a is released
+static void release(struct arena *total, struct arena *a)
+{
+  total->n_allocs += a->n_allocs;
+  total->n_bytes += a->n_bytes;
+  total->n_chunks += a->n_chunks;
+  total->n_resets += a->n_resets;
+  arena_release(a);
+}
+
+// evaluate or define the item, on the calling thread of stream_run
+static void hand_over(struct item *item)
+{
+  current = *item;
+  if (item->kind == ITEM_EXPR) {
+    eval_fn(item->expr);
+    if (keep)
+      append(&kept_arenas, &n_kept, &kept_cap, &item->arena);
+    else
+      recycle(&item->arena);
+  } else if (define_fn(item->fun) == 0) {
+    append(&kept_arenas, &n_kept, &kept_cap, &item->arena);
+  } else {
+    recycle(&item->arena);
+  }
+}
+
+int stream_run( int (*parse)(void)
+              , void (*eval)(struct expr *)
+              , int (*define)(struct fun_def *)
+              , int keep_exprs
+              , int ahead)
+{
+  parse_fn = parse;
+  eval_fn = eval;
+  define_fn = define;
+  keep = keep_exprs;
+  parse_ahead = ahead;
+
+  pthread_t thread;
+  if (!ahead)
+    parser_thread(NULL);
+  else if (pthread_create(&thread, NULL, parser_thread, NULL) != 0) {
+    fprintf(stderr, "cannot start the parser thread\n");
+    return 1;
+  }
+
+  struct item item;
+  for (get(&item); item.kind != ITEM_END; get(&item))
+    hand_over(&item);
+  if (ahead)
+    pthread_join(thread, NULL);
+
+  recycle(&item.arena);
+  return item.failed;
+}
+
+double stream_parse_ms(void)
+{
+  return current.parse_ms;
+}
+
+unsigned long stream_ast_bytes(void)
+{
+  return current.ast_bytes;
+}
+
+void stream_release(void)
+{
+  struct arena total = { 0 };
+  release(&total, &ast_arena);
+  for (unsigned i = 0; i < n_free; ++i)
+    release(&total, &free_arenas[i]);
+  for (unsigned i = 0; i < n_kept; ++i)
+    release(&total, &kept_arenas[i]);
+  free(free_arenas);
+  free(kept_arenas);
+  arena_print_stats("ast", &total);
+}
@@ -0,0 +1,37 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "ast.h"
+
+// Top-level definitions and expressions are compiled as soon as they are
+// parsed, while the parser goes on with the rest of the input: the parser
+// runs on a thread of its own and hands every item over through a bounded
+// queue, together with the arena its nodes were allocated in.
+
+// parser side, called by the actions of the grammar: the nodes allocated in
+// ast_arena so far go with the item, the parser continues in a fresh arena
+void stream_put_expr(struct expr *e);
+void stream_put_fun(struct fun_def *f);
+
+// run parse on the parser thread and hand the items to eval and define on
+// the calling thread, in order; the arenas of the definitions are kept, the
+// ones of the expressions reused unless keep_exprs is set, when eval only
+// puts the expressions aside. Without ahead, parse runs on the calling
+// thread and every item is handed over as soon as it is parsed: a program
+// read from stdin is followed by the input it reads itself, which the parser
+// must not take first. Returns the result of parse
+int stream_run( int (*parse)(void)
+              , void (*eval)(struct expr *)
+              , int (*define)(struct fun_def *)
+              , int keep_exprs
+              , int ahead);
+
+// how long the parser took over the item eval or define is being handed,
+// its waits on a full queue left out, and the bytes of nodes it allocated
+double stream_parse_ms(void);
+unsigned long stream_ast_bytes(void);
+
+// release the arenas, the nodes of every item included
+void stream_release(void);
+
+#endif
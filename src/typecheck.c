@@ -0,0 +1,821 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "profile.h"
+#include "y.tab.h"
+
+// signatures of the functions provided by the runtime
+struct builtin {
+  const char *name;
+  enum value_type arg;
+  enum value_type ret;
+};
+
+static const struct builtin builtins[] = {
+  { "print_i32", INTEGER, UNIT    },
+  { "read_i32",  INTEGER, INTEGER },
+  // int vectors in and out in one call: read_vec(n) reads n integers
+  { "read_vec",  INTEGER, VECT    },
+  { "print_vec", VECT,    UNIT    },
+  // reductions of int vectors, generated inline
+  { "sum",       VECT,    INTEGER },
+  { "min",       VECT,    INTEGER },
+  { "max",       VECT,    INTEGER },
+};
+
+static const struct builtin *lookup_builtin(const char *name)
+{
+  for (unsigned i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+    if (strcmp(builtins[i].name, name) == 0)
+      return &builtins[i];
+  }
+  return NULL;
+}
+
+static enum value_type type_error(struct expr *e, const char *msg)
+{
+  fprintf(stderr, "Type error: %s\n", msg);
+  e->vtype = ERROR;
+  return ERROR;
+}
+
+// typechecks child and reports msg if its type is not t; errors that have
+// already been reported for child are not repeated
+static int expect(struct expr *child, struct env *env, enum value_type t, const char *msg)
+{
+  enum value_type child_t = typecheck_expr(child, env);
+  if (child_t == t)
+    return 1;
+  if (child_t != ERROR)
+    fprintf(stderr, "Type error: %s\n", msg);
+  return 0;
+}
+
+// copy the type annotations of src on e
+static enum value_type same_type(struct expr *e, struct expr *src)
+{
+  e->vtype = src->vtype;
+  e->elem_vtype = src->elem_vtype;
+  e->len = src->len;
+  e->cols = src->cols;
+  return e->vtype;
+}
+
+// two typed expressions can be used in place of each other (same type and,
+// for vectors, same element type, length and rows)
+static int compatible(struct expr *a, struct expr *b)
+{
+  if (a->vtype != b->vtype)
+    return 0;
+  if (a->vtype == VECT)
+    return a->elem_vtype == b->elem_vtype && a->len == b->len && a->cols == b->cols;
+  return 1;
+}
+
+static enum value_type scalar(struct expr *e, enum value_type t)
+{
+  e->vtype = t;
+  return t;
+}
+
+// the elements of a vector literal must all have the same scalar type, or
+// all be vectors of the same type and length, known at compile time: the
+// rows of a matrix, whose length goes in cols (0 for scalar elements).
+// Returns the type of the scalars
+static enum value_type typecheck_elems(struct expr_vect *ve, struct env *env, int *cols)
+{
+  if (ve == NULL)
+    return ERROR;
+
+  struct expr *first = ve->curr_expr;
+  enum value_type t = typecheck_expr(first, env);
+  for (ve = ve->next_expr; ve != NULL; ve = ve->next_expr) {
+    if (typecheck_expr(ve->curr_expr, env) != t || (t == VECT && !compatible(ve->curr_expr, first)))
+      return ERROR;
+  }
+
+  *cols = 0;
+  if (t != VECT)
+    return t;
+  if (first->len <= 0 || first->cols != 0)
+    return ERROR;
+  *cols = first->len;
+  return first->elem_vtype;
+}
+
+// a matrix is indexed by row and column (col), a plain vector by one index
+static int expect_shape(struct expr *base, struct expr *col, struct env *env)
+{
+  if (col == NULL && base->cols != 0)
+    fprintf(stderr, "Type error: a matrix is indexed by row and column\n");
+  else if (col != NULL && base->cols == 0)
+    fprintf(stderr, "Type error: only matrices are indexed by row and column\n");
+  else
+    return col == NULL || expect(col, env, INTEGER, "matrix index must be int");
+  return 0;
+}
+
+// arithmetic and comparisons element by element, between two int vectors
+// or between an int vector and an int applied to each of its elements
+static enum value_type typecheck_elementwise(struct expr *e)
+{
+  struct expr *lhs = e->binop.lhs;
+  struct expr *rhs = e->binop.rhs;
+
+  if ((lhs->vtype == VECT ? lhs->elem_vtype : lhs->vtype) != INTEGER ||
+      (rhs->vtype == VECT ? rhs->elem_vtype : rhs->vtype) != INTEGER)
+    return type_error(e, "element-wise operands must be int vectors or int");
+
+  e->vtype = VECT;
+  e->elem_vtype = INTEGER;
+  e->cols = lhs->vtype == VECT ? lhs->cols : rhs->cols;
+  switch (e->binop.op) {
+  case '<': case '>': case LE: case GE: case '=': case NE:
+    e->elem_vtype = BOOLEAN;
+    break;
+  }
+
+  if (lhs->vtype != VECT || rhs->vtype != VECT)
+    e->len = lhs->vtype == VECT ? lhs->len : rhs->len;
+  else if (lhs->cols != rhs->cols)
+    return type_error(e, "element-wise operands must have rows of the same length");
+  else if (lhs->len >= 0 && rhs->len >= 0 && lhs->len != rhs->len)
+    return type_error(e, "element-wise operands must have the same length");
+  else
+    e->len = lhs->len < 0 || rhs->len < 0 ? -1 : lhs->len;
+  return VECT;
+}
+
+static enum value_type typecheck_binop(struct expr *e, struct env *env)
+{
+  struct expr *lhs = e->binop.lhs;
+  struct expr *rhs = e->binop.rhs;
+
+  if (typecheck_expr(lhs, env) == ERROR || typecheck_expr(rhs, env) == ERROR)
+    return scalar(e, ERROR);
+
+  switch (e->binop.op) {
+  case '+': case '-': case '*': case '/': case MOD:
+  case '<': case '>': case LE: case GE: case '=': case NE:
+    if (lhs->vtype == VECT || rhs->vtype == VECT)
+      return typecheck_elementwise(e);
+    break;
+  }
+
+  switch (e->binop.op) {
+  case '+': case '-': case '*': case '/': case MOD:
+    if (lhs->vtype != INTEGER || rhs->vtype != INTEGER)
+      return type_error(e, "arithmetic operands must be int");
+    scalar(e, INTEGER);
+    // keep track of the values known at compile time (e.g. vector lengths),
+    // wrapping around in unsigned arithmetic like the generated code; the
+    // divisions that trap at runtime, by 0 and of INT_MIN by -1, are left
+    // to it
+    if (lhs->is_const && rhs->is_const) {
+      int l = lhs->const_value, r = rhs->const_value;
+      int traps = r == 0 || (l == INT_MIN && r == -1);
+      switch (e->binop.op) {
+      case '+': e->is_const = 1; e->const_value = (int)((unsigned)l + (unsigned)r); break;
+      case '-': e->is_const = 1; e->const_value = (int)((unsigned)l - (unsigned)r); break;
+      case '*': e->is_const = 1; e->const_value = (int)((unsigned)l * (unsigned)r); break;
+      case '/': e->is_const = !traps; e->const_value = traps ? 0 : l / r; break;
+      case MOD: e->is_const = !traps; e->const_value = traps ? 0 : (int)((unsigned)l % (unsigned)r); break;
+      }
+    }
+    return INTEGER;
+
+  case '<': case '>': case LE: case GE:
+    if (lhs->vtype != INTEGER || rhs->vtype != INTEGER)
+      return type_error(e, "comparison operands must be int");
+    return scalar(e, BOOLEAN);
+
+  case '=': case NE:
+    if (lhs->vtype != rhs->vtype || (lhs->vtype != INTEGER && lhs->vtype != BOOLEAN))
+      return type_error(e, "equality operands must be both int or both bool");
+    return scalar(e, BOOLEAN);
+
+  case AND_SC: case OR_SC:
+    if (lhs->vtype != BOOLEAN || rhs->vtype != BOOLEAN)
+      return type_error(e, "short-circuit operands must be bool");
+    return scalar(e, BOOLEAN);
+
+  case AND: case OR:
+    if (lhs->vtype != rhs->vtype || (lhs->vtype != INTEGER && lhs->vtype != BOOLEAN))
+      return type_error(e, "logical operands must be both int or both bool");
+    return scalar(e, lhs->vtype);
+
+  case CONCAT_KW:
+    // matrices are put one above the other
+    if (lhs->vtype != VECT || rhs->vtype != VECT || lhs->elem_vtype != rhs->elem_vtype ||
+        lhs->cols != rhs->cols)
+      return type_error(e, "++ operands must be vectors of the same type");
+    e->vtype = VECT;
+    e->elem_vtype = lhs->elem_vtype;
+    e->cols = lhs->cols;
+    e->len = lhs->len < 0 || rhs->len < 0 ? -1 : lhs->len + rhs->len;
+    return VECT;
+
+  default:
+    return type_error(e, "unknown binary operator");
+  }
+}
+
+// the user functions, in order of definition
+static struct fun_def **functions;
+static unsigned n_functions, functions_cap;
+
+struct fun_def *lookup_function(int ident)
+{
+  for (unsigned i = 0; i < n_functions; ++i) {
+    if (functions[i]->ident == ident)
+      return functions[i];
+  }
+  return NULL;
+}
+
+static enum value_type typecheck_call(struct expr *e, struct fun_def *f, struct env *env)
+{
+  struct expr_vect *arg = e->call.args;
+  struct expr_vect *param = f->params;
+  for (; arg != NULL && param != NULL; arg = arg->next_expr, param = param->next_expr) {
+    if (typecheck_expr(arg->curr_expr, env) == ERROR)
+      return scalar(e, ERROR);
+    if (arg->curr_expr->vtype != param->curr_expr->vtype)
+      return type_error(e, "wrong argument type in function call");
+  }
+  if (arg != NULL || param != NULL)
+    return type_error(e, "wrong number of arguments in function call");
+  return scalar(e, f->ret);
+}
+
+// A parallel for body runs on several threads at once. It cannot assign
+// the variables bound outside of it, nor use the I/O buffers or the
+// vector allocator of the runtime, which are not thread safe, even through
+// the functions it calls. The bindings from parallel_base on, in the env,
+// are those of the innermost parallel for body being checked
+static unsigned parallel_base;
+
+static const char *parallel_hazard(struct expr *e);
+
+static const char *parallel_hazard_vect(struct expr_vect *ve)
+{
+  const char *hazard = NULL;
+  for (; ve != NULL && hazard == NULL; ve = ve->next_expr)
+    hazard = parallel_hazard(ve->curr_expr);
+  return hazard;
+}
+
+// the element-wise operations a reduction goes through are fused in its
+// loop, without building vectors: only their operands are evaluated
+static const char *reduced_hazard(struct expr *e)
+{
+  if (e->type != BIN_OP || e->vtype != VECT || e->binop.op == CONCAT_KW)
+    return parallel_hazard(e);
+  const char *hazard = reduced_hazard(e->binop.lhs);
+  return hazard != NULL ? hazard : reduced_hazard(e->binop.rhs);
+}
+
+// why the typed e cannot run on several threads at once, NULL if it can
+static const char *parallel_hazard(struct expr *e)
+{
+  const char *hazard = NULL;
+
+  switch (e->type) {
+  case CALL: {
+    struct fun_def *f = lookup_function(e->call.ident);
+    if (f != NULL)
+      return f->parallel_safe ? parallel_hazard_vect(e->call.args)
+        : "a parallel for body cannot call a function doing I/O or building vectors of runtime length";
+    // the builtins but the reductions do I/O
+    const char *name = symbol_name(e->call.ident);
+    if (strcmp(name, "sum") == 0 || strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+      return reduced_hazard(e->call.args->curr_expr);
+    return "a parallel for body cannot do I/O";
+  }
+
+  case LET:
+  case VAR:
+    hazard = parallel_hazard(e->let.expr);
+    return hazard != NULL ? hazard : parallel_hazard(e->let.body);
+
+  case ASSIGN:
+    return parallel_hazard(e->assign.expr);
+
+  case IF:
+    hazard = parallel_hazard(e->if_expr.cond);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->if_expr.e_true);
+    return hazard != NULL ? hazard : parallel_hazard(e->if_expr.e_false);
+
+  case WHILE:
+    hazard = parallel_hazard(e->while_expr.cond);
+    return hazard != NULL ? hazard : parallel_hazard(e->while_expr.body);
+
+  case PARALLEL_FOR:
+    hazard = parallel_hazard(e->par_for.from);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->par_for.to);
+    return hazard != NULL ? hazard : parallel_hazard(e->par_for.body);
+
+  case UN_OP:
+    return parallel_hazard(e->unop.expr);
+
+  case BIN_OP:
+    if (e->vtype == VECT && e->len < 0)
+      return "a parallel for body cannot build vectors of runtime length";
+    hazard = parallel_hazard(e->binop.lhs);
+    return hazard != NULL ? hazard : parallel_hazard(e->binop.rhs);
+
+  case VECTOR:
+  case SEQ:
+    return parallel_hazard_vect(e->vect);
+
+  case TILED_FOR:
+    hazard = parallel_hazard(e->tiled_for.from);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->tiled_for.to);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->tiled_for.col_from);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->tiled_for.col_to);
+    if (hazard == NULL && e->tiled_for.tile != NULL)
+      hazard = parallel_hazard(e->tiled_for.tile);
+    return hazard != NULL ? hazard : parallel_hazard(e->tiled_for.body);
+
+  case VECTOR_ACCESS_OP:
+    hazard = parallel_hazard(e->vect_access.base);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->vect_access.offset);
+    if (hazard == NULL && e->vect_access.col != NULL)
+      hazard = parallel_hazard(e->vect_access.col);
+    return hazard;
+
+  case VECTOR_UPDATE_OP:
+    hazard = parallel_hazard(e->vect_update.base);
+    hazard = hazard != NULL ? hazard : parallel_hazard(e->vect_update.offset);
+    if (hazard == NULL && e->vect_update.col != NULL)
+      hazard = parallel_hazard(e->vect_update.col);
+    return hazard != NULL ? hazard : parallel_hazard(e->vect_update.rhs);
+
+  case SUGARED_VECTOR_BUILD_OP:
+    if (e->len < 0)
+      return "a parallel for body cannot build vectors of runtime length";
+    hazard = parallel_hazard_vect(e->vect_build.sample);
+    return hazard != NULL ? hazard : parallel_hazard(e->vect_build.len);
+
+  default:
+    return NULL;
+  }
+}
+
+static enum value_type typecheck_parallel_for(struct expr *e, struct env *env)
+{
+  if (!expect(e->par_for.from, env, INTEGER, "parallel for bounds must be int") ||
+      !expect(e->par_for.to, env, INTEGER, "parallel for bounds must be int"))
+    return scalar(e, ERROR);
+  if (e->par_for.op < 0)
+    return type_error(e, "parallel for reduces with +, min or max");
+
+  unsigned saved_base = parallel_base;
+  parallel_base = env->depth;
+  push(env, e->par_for.ident, e);
+  enum value_type t = typecheck_expr(e->par_for.body, env);
+  pop(env);
+  parallel_base = saved_base;
+
+  if (t == ERROR)
+    return scalar(e, ERROR);
+  if (e->par_for.op != 0 && t != INTEGER)
+    return type_error(e, "the body of a reducing parallel for must be int");
+  const char *hazard = parallel_hazard(e->par_for.body);
+  if (hazard != NULL)
+    return type_error(e, hazard);
+  return scalar(e, e->par_for.op != 0 ? INTEGER : UNIT);
+}
+
+// for row in from..to, col in col_from..col_to tile size do body: the
+// bounds and the tile size are evaluated once, before the loop
+static enum value_type typecheck_tiled_for(struct expr *e, struct env *env)
+{
+  struct expr *tile = e->tiled_for.tile;
+  if (!expect(e->tiled_for.from, env, INTEGER, "for bounds must be int") ||
+      !expect(e->tiled_for.to, env, INTEGER, "for bounds must be int") ||
+      !expect(e->tiled_for.col_from, env, INTEGER, "for bounds must be int") ||
+      !expect(e->tiled_for.col_to, env, INTEGER, "for bounds must be int") ||
+      (tile != NULL && !expect(tile, env, INTEGER, "tile size must be int")))
+    return scalar(e, ERROR);
+  if (tile != NULL && tile->is_const && tile->const_value <= 0)
+    return type_error(e, "tile size must be positive");
+
+  push(env, e->tiled_for.row, e);
+  push(env, e->tiled_for.col, e);
+  enum value_type t = typecheck_expr(e->tiled_for.body, env);
+  pop(env);
+  pop(env);
+  return scalar(e, t == ERROR ? ERROR : UNIT);
+}
+
+// int, bool, and unit for results only
+static enum value_type named_type(int ident, int result)
+{
+  const char *name = symbol_name(ident);
+  if (strcmp(name, "int") == 0)
+    return INTEGER;
+  if (strcmp(name, "bool") == 0)
+    return BOOLEAN;
+  if (result && strcmp(name, "unit") == 0)
+    return UNIT;
+  fprintf(stderr, "Type error: unknown type %s\n", name);
+  return ERROR;
+}
+
+// the calls whose value is the value of the function
+static void mark_tail_calls(struct expr *e)
+{
+  switch (e->type) {
+  case CALL:
+    e->call.tail = 1;
+    break;
+  case LET:
+  case VAR:
+    mark_tail_calls(e->let.body);
+    break;
+  case IF:
+    mark_tail_calls(e->if_expr.e_true);
+    mark_tail_calls(e->if_expr.e_false);
+    break;
+  case SEQ: {
+    struct expr_vect *ve = e->vect;
+    while (ve->next_expr != NULL)
+      ve = ve->next_expr;
+    mark_tail_calls(ve->curr_expr);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+static void mark_transient_vect(struct expr_vect *ve)
+{
+  for (; ve != NULL; ve = ve->next_expr)
+    mark_transient(ve->curr_expr, 1);
+}
+
+void mark_transient(struct expr *e, int transient)
+{
+  e->transient = transient;
+  switch (e->type) {
+  case LET:
+  case VAR:
+    mark_transient(e->let.expr, 0);
+    mark_transient(e->let.body, transient);
+    break;
+  case ASSIGN:
+    mark_transient(e->assign.expr, 0);
+    break;
+  case IF:
+    mark_transient(e->if_expr.cond, 1);
+    mark_transient(e->if_expr.e_true, transient);
+    mark_transient(e->if_expr.e_false, transient);
+    break;
+  case CALL:
+    mark_transient_vect(e->call.args);
+    break;
+  case WHILE:
+    mark_transient(e->while_expr.cond, 1);
+    mark_transient(e->while_expr.body, 1);
+    break;
+  case UN_OP:
+    mark_transient(e->unop.expr, 1);
+    break;
+  case BIN_OP:
+    mark_transient(e->binop.lhs, 1);
+    mark_transient(e->binop.rhs, 1);
+    break;
+  // the rows of a matrix are copied
+  case VECTOR:
+    mark_transient_vect(e->vect);
+    break;
+  case VECTOR_ACCESS_OP:
+    mark_transient(e->vect_access.base, 1);
+    mark_transient(e->vect_access.offset, 1);
+    if (e->vect_access.col != NULL)
+      mark_transient(e->vect_access.col, 1);
+    break;
+  case VECTOR_UPDATE_OP:
+    mark_transient(e->vect_update.base, 1);
+    mark_transient(e->vect_update.offset, 1);
+    if (e->vect_update.col != NULL)
+      mark_transient(e->vect_update.col, 1);
+    mark_transient(e->vect_update.rhs, 1);
+    break;
+  case SEQ: {
+    // only the last element gives the value of the sequence
+    struct expr_vect *ve = e->vect;
+    for (; ve->next_expr != NULL; ve = ve->next_expr)
+      mark_transient(ve->curr_expr, 1);
+    mark_transient(ve->curr_expr, transient);
+    break;
+  }
+  case SUGARED_VECTOR_BUILD_OP:
+    mark_transient_vect(e->vect_build.sample);
+    mark_transient(e->vect_build.len, 1);
+    break;
+  case PARALLEL_FOR:
+    mark_transient(e->par_for.from, 1);
+    mark_transient(e->par_for.to, 1);
+    mark_transient(e->par_for.body, 1);
+    break;
+  case TILED_FOR:
+    mark_transient(e->tiled_for.from, 1);
+    mark_transient(e->tiled_for.to, 1);
+    mark_transient(e->tiled_for.col_from, 1);
+    mark_transient(e->tiled_for.col_to, 1);
+    if (e->tiled_for.tile != NULL)
+      mark_transient(e->tiled_for.tile, 1);
+    mark_transient(e->tiled_for.body, 1);
+    break;
+  default:
+    break;
+  }
+}
+
+int define_function(struct fun_def *f)
+{
+  const char *name = symbol_name(f->ident);
+  if (lookup_builtin(name) != NULL || lookup_function(f->ident) != NULL) {
+    fprintf(stderr, "Type error: function %s is already defined\n", name);
+    return 1;
+  }
+
+  int failed = 0;
+  for (struct expr_vect *p = f->params; p != NULL; p = p->next_expr) {
+    struct expr *param = p->curr_expr;
+    param->is_const = 0;
+    param->len = 0;
+    failed |= scalar(param, named_type(param->param.type_ident, 0)) == ERROR;
+  }
+  failed |= (f->ret = named_type(f->ret_type_ident, 1)) == ERROR;
+  if (failed)
+    return 1;
+
+  // hashed before it is defined: the recursive calls are hashed by name
+  f->hash = hash_fun_def(HASH_SEED, f);
+
+  // defined before its body is typechecked, for the recursive calls
+  f->parallel_safe = 0;
+  if (n_functions == functions_cap) {
+    functions_cap = functions_cap ? 2 * functions_cap : 16;
+    functions = realloc(functions, sizeof(struct fun_def *) * functions_cap);
+  }
+  functions[n_functions++] = f;
+
+  struct env *env = env_create();
+  for (struct expr_vect *p = f->params; p != NULL; p = p->next_expr)
+    push(env, p->curr_expr->param.ident, p->curr_expr);
+  enum value_type t = typecheck_expr(f->body, env);
+  if (t != ERROR && t != f->ret) {
+    fprintf(stderr, "Type error: the body of %s does not match its result type\n", name);
+    t = ERROR;
+  }
+  for (struct expr_vect *p = f->params; p != NULL; p = p->next_expr)
+    pop(env);
+
+  if (t == ERROR) {
+    --n_functions;
+    env_dispose(env);
+    return 1;
+  }
+
+  // the recursive calls are as safe as the rest of the body; those of the
+  // parallel for loops of the body have been rejected
+  f->parallel_safe = 1;
+  f->parallel_safe = parallel_hazard(f->body) == NULL;
+
+  fold_expr(f->body);
+  mark_tail_calls(f->body);
+  // the result of a function is never a vector
+  mark_transient(f->body, 1);
+  if (profile_mode != PROFILE_OFF)
+    profile_attach(f->body, f->hash);
+  // the parameters are not bound to any fact
+  if (bounds_checks)
+    analyse_bounds(f->body, env);
+  env_dispose(env);
+  return 0;
+}
+
+enum value_type typecheck_expr(struct expr *e, struct env *env)
+{
+  e->is_const = 0;
+
+  switch (e->type) {
+  case LITERAL:
+    e->is_const = 1;
+    e->const_value = e->value;
+    return scalar(e, INTEGER);
+
+  case LIT_BOOL:
+    return scalar(e, BOOLEAN);
+
+  case IDENT: {
+    struct expr *binding = resolve(env, e->ident);
+    if (binding == NULL) {
+      fprintf(stderr, "Undefined variable: %s\n", symbol_name(e->ident));
+      return scalar(e, ERROR);
+    }
+    if (binding->type == PARAM)
+      return same_type(e, binding);
+    if (binding->type == PARALLEL_FOR || binding->type == TILED_FOR)
+      return scalar(e, INTEGER);
+    // only immutable bindings can carry a compile time value
+    struct expr *init = binding->type == LET ? binding->let.expr : binding->var.expr;
+    e->is_const = binding->type == LET && init->is_const;
+    e->const_value = init->const_value;
+    return same_type(e, init);
+  }
+
+  case CALL: {
+    struct fun_def *f = lookup_function(e->call.ident);
+    if (f != NULL)
+      return typecheck_call(e, f, env);
+
+    const struct builtin *fn = lookup_builtin(symbol_name(e->call.ident));
+    if (fn == NULL) {
+      fprintf(stderr, "Undefined function: %s\n", symbol_name(e->call.ident));
+      return scalar(e, ERROR);
+    }
+    if (vect_len(e->call.args) != 1)
+      return type_error(e, "wrong number of arguments in function call");
+    struct expr *arg = e->call.args->curr_expr;
+    if (typecheck_expr(arg, env) == ERROR)
+      return scalar(e, ERROR);
+    if (arg->vtype != fn->arg || (fn->arg == VECT && arg->elem_vtype != INTEGER))
+      return type_error(e, "wrong argument type in function call");
+    if (fn->ret == VECT) {
+      e->elem_vtype = INTEGER;
+      e->len = -1;
+      e->cols = 0;
+    }
+    return scalar(e, fn->ret);
+  }
+
+  case LET:
+  case VAR: {
+    if (typecheck_expr(e->let.expr, env) == ERROR)
+      return scalar(e, ERROR);
+    if (e->let.expr->vtype == UNIT)
+      return type_error(e, "cannot bind a unit value");
+    push(env, e->let.ident, e);
+    typecheck_expr(e->let.body, env);
+    pop(env);
+    return same_type(e, e->let.body);
+  }
+
+  case ASSIGN: {
+    struct expr *binding = resolve(env, e->assign.ident);
+    if (binding == NULL) {
+      fprintf(stderr, "Undefined variable: %s\n", symbol_name(e->assign.ident));
+      return scalar(e, ERROR);
+    }
+    if (binding->type != VAR)
+      return type_error(e, "only var bindings can be assigned");
+    if (env->innermost[e->assign.ident] < (int)parallel_base)
+      return type_error(e, "a parallel for body cannot assign the variables bound outside of it");
+    if (typecheck_expr(e->assign.expr, env) == ERROR)
+      return scalar(e, ERROR);
+    if (!compatible(binding->var.expr, e->assign.expr))
+      return type_error(e, "assigned value does not match the type of the variable");
+    return scalar(e, UNIT);
+  }
+
+  case IF: {
+    if (!expect(e->if_expr.cond, env, BOOLEAN, "if condition must be bool"))
+      return scalar(e, ERROR);
+    if (typecheck_expr(e->if_expr.e_true, env) == ERROR ||
+        typecheck_expr(e->if_expr.e_false, env) == ERROR)
+      return scalar(e, ERROR);
+    if (!compatible(e->if_expr.e_true, e->if_expr.e_false))
+      return type_error(e, "if branches have different types");
+    return same_type(e, e->if_expr.e_true);
+  }
+
+  case WHILE:
+    if (!expect(e->while_expr.cond, env, BOOLEAN, "while condition must be bool"))
+      return scalar(e, ERROR);
+    if (typecheck_expr(e->while_expr.body, env) == ERROR)
+      return scalar(e, ERROR);
+    return scalar(e, UNIT);
+
+  case UN_OP: {
+    enum value_type t = typecheck_expr(e->unop.expr, env);
+    if (t == ERROR)
+      return scalar(e, ERROR);
+    if (t != BOOLEAN && t != INTEGER)
+      return type_error(e, "! operand must be bool or int");
+    return scalar(e, t);
+  }
+
+  case BIN_OP:
+    return typecheck_binop(e, env);
+
+  case VECTOR: {
+    int cols;
+    enum value_type t = typecheck_elems(e->vect, env, &cols);
+    if (t != INTEGER && t != BOOLEAN)
+      return type_error(e, "vector elements must be all int, all bool or all rows of the same length");
+    e->vtype = VECT;
+    e->elem_vtype = t;
+    e->cols = cols;
+    e->len = vect_len(e->vect) * (cols > 0 ? cols : 1);
+    return VECT;
+  }
+
+  case SUGARED_VECTOR_BUILD_OP: {
+    int cols;
+    enum value_type t = typecheck_elems(e->vect_build.sample, env, &cols);
+    if (t != INTEGER && t != BOOLEAN)
+      return type_error(e, "vector elements must be all int, all bool or all rows of the same length");
+    struct expr *len = e->vect_build.len;
+    if (!expect(len, env, INTEGER, "vector length must be int"))
+      return scalar(e, ERROR);
+    if (len->is_const && len->const_value < 0)
+      return type_error(e, "vector length must be non-negative");
+    e->vtype = VECT;
+    e->elem_vtype = t;
+    e->cols = cols;
+    // a length only known at runtime makes a runtime vector, one known at
+    // compile time has to fit in an int
+    e->len = -1;
+    if (len->is_const) {
+      long long sample_len = (long long)vect_len(e->vect_build.sample) * (cols > 0 ? cols : 1);
+      if (sample_len > 0 && len->const_value > INT_MAX / sample_len)
+        return type_error(e, "vector length must fit in an int");
+      e->len = (int)(sample_len * len->const_value);
+    }
+    return VECT;
+  }
+
+  case VECTOR_ACCESS_OP:
+    if (!expect(e->vect_access.base, env, VECT, "only vectors can be indexed") ||
+        !expect(e->vect_access.offset, env, INTEGER, "vector index must be int") ||
+        !expect_shape(e->vect_access.base, e->vect_access.col, env))
+      return scalar(e, ERROR);
+    return scalar(e, e->vect_access.base->elem_vtype);
+
+  case VECTOR_UPDATE_OP:
+    if (!expect(e->vect_update.base, env, VECT, "only vectors can be indexed") ||
+        !expect(e->vect_update.offset, env, INTEGER, "vector index must be int") ||
+        !expect_shape(e->vect_update.base, e->vect_update.col, env) ||
+        !expect(e->vect_update.rhs, env, e->vect_update.base->elem_vtype,
+                "updated value does not match the vector elements"))
+      return scalar(e, ERROR);
+    return scalar(e, UNIT);
+
+  case PARALLEL_FOR:
+    return typecheck_parallel_for(e, env);
+
+  case TILED_FOR:
+    return typecheck_tiled_for(e, env);
+
+  case SEQ: {
+    struct expr_vect *ve = e->vect;
+    for (; ve->next_expr != NULL; ve = ve->next_expr) {
+      if (typecheck_expr(ve->curr_expr, env) == ERROR)
+        return scalar(e, ERROR);
+    }
+    typecheck_expr(ve->curr_expr, env);
+    return same_type(e, ve->curr_expr);
+  }
+
+  default:
+    return type_error(e, "unknown expression");
+  }
+}
+
+LLVMTypeRef llvm_scalar_type(LLVMContextRef ctx, enum value_type t)
+{
+  switch (t) {
+  case INTEGER: return LLVMInt32TypeInContext(ctx);
+  case BOOLEAN: return LLVMInt1TypeInContext(ctx);
+  default:      return LLVMVoidTypeInContext(ctx);
+  }
+}
+
+// the LLVM type of the value codegen_expr produces for a typed expression:
+// vectors are handled through a pointer to their array, or to the runtime
+// vector when their length is only known at runtime
+LLVMTypeRef llvm_type_of(LLVMContextRef ctx, struct expr *e)
+{
+  if (e->vtype == VECT && e->len < 0)
+    return llvm_rt_vect_type(ctx, e->elem_vtype);
+  if (e->vtype == VECT)
+    return LLVMPointerType(LLVMArrayType(llvm_scalar_type(ctx, e->elem_vtype), e->len), 0);
+  return llvm_scalar_type(ctx, e->vtype);
+}
+
+// the type of a vector living in the runtime: a pointer to its length
+// followed by the elements, see struct rt_vect
+LLVMTypeRef llvm_rt_vect_type(LLVMContextRef ctx, enum value_type elem_vtype)
+{
+  LLVMTypeRef fields[] = { LLVMInt32TypeInContext(ctx), LLVMArrayType(llvm_scalar_type(ctx, elem_vtype), 0) };
+  return LLVMPointerType(LLVMStructTypeInContext(ctx, fields, 2, 0), 0);
+}
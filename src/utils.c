@@ -1,47 +1,182 @@
-#include "utils.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-void print_i32(int x)
-{
-  printf("%d\n", x);
-}
-
-int read_i32(int defaultValue) {
-  int x;
-  if (scanf("%d", &x)) {
-    return x;
-  } else {
-    return defaultValue;
-  }
-}
-
-LLVMValueRef resolve(struct env *env, char *name) {
-  if (env == NULL) {
-    return NULL;
-  } else if (strcmp(env->name, name) == 0) {
-    return env->value;
-  } else {
-    return resolve(env->prev, name);
-  }
-}
-
-struct env *push(struct env *env, char *name, LLVMValueRef value)
-{
-  struct env *r = malloc(sizeof(struct env));
-
-  r->name = name;
-  r->prev = env;
-  r->value = value;
-
-  return r;
-}
-
-// assumes that env is NOT NULL
-struct env *pop(struct env *env)
-{
-  struct env *r = env->prev;
-  free(env);
-  return r;
-}
+#include "utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// open addressing hash table from names to symbols; the scanner interns on
+// the parser thread while the compiler looks names up on the main thread
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **names;
+static unsigned n_names, names_cap;
+
+// the names are copied once, one after the other into big blocks, rather
+// than with a malloc each
+#define NAME_BLOCK_SIZE (64 * 1024)
+static char *name_block;
+static size_t name_block_left;
+
+static int *table;          // symbol + 1, 0 for empty slots
+static unsigned table_cap;  // always a power of two
+
+static unsigned hash_name(const char *name, size_t len)
+{
+  // FNV-1a
+  unsigned h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int *lookup_slot(const char *name, size_t len)
+{
+  unsigned i = hash_name(name, len) & (table_cap - 1);
+  while (table[i] != 0) {
+    const char *other = names[table[i] - 1];
+    if (strncmp(other, name, len) == 0 && other[len] == '\0')
+      break;
+    i = (i + 1) & (table_cap - 1);
+  }
+  return &table[i];
+}
+
+static void grow_table(void)
+{
+  int *old = table;
+  unsigned old_cap = table_cap;
+
+  table_cap = old_cap ? old_cap * 2 : 256;
+  table = calloc(table_cap, sizeof(int));
+  for (unsigned i = 0; i < old_cap; ++i) {
+    if (old[i] != 0) {
+      const char *name = names[old[i] - 1];
+      *lookup_slot(name, strlen(name)) = old[i];
+    }
+  }
+  free(old);
+}
+
+static char *copy_name(const char *name, size_t len)
+{
+  if (name_block_left < len + 1) {
+    size_t size = len + 1 > NAME_BLOCK_SIZE ? len + 1 : NAME_BLOCK_SIZE;
+    name_block = malloc(size);
+    name_block_left = size;
+  }
+  char *copy = name_block;
+  memcpy(copy, name, len);
+  copy[len] = '\0';
+  name_block += len + 1;
+  name_block_left -= len + 1;
+  return copy;
+}
+
+int intern(const char *name, size_t len)
+{
+  pthread_mutex_lock(&names_lock);
+
+  // keep the load factor under 1/2
+  if (2 * (n_names + 1) > table_cap)
+    grow_table();
+
+  int *slot = lookup_slot(name, len);
+  if (*slot == 0) {
+    if (n_names == names_cap) {
+      names_cap = names_cap ? names_cap * 2 : 256;
+      names = realloc(names, names_cap * sizeof(char *));
+    }
+    names[n_names] = copy_name(name, len);
+    *slot = ++n_names;
+  }
+  int sym = *slot - 1;
+
+  pthread_mutex_unlock(&names_lock);
+  return sym;
+}
+
+const char *symbol_name(int sym)
+{
+  pthread_mutex_lock(&names_lock);
+  const char *name = names[sym];
+  pthread_mutex_unlock(&names_lock);
+  return name;
+}
+
+int symbol_count(void)
+{
+  pthread_mutex_lock(&names_lock);
+  int n = n_names;
+  pthread_mutex_unlock(&names_lock);
+  return n;
+}
+
+// -----------------------------------------------------------
+
+struct env *env_create(void)
+{
+  struct env *env = malloc(sizeof(struct env));
+
+  env->bindings = NULL;
+  env->depth = 0;
+  env->cap = 0;
+  env->innermost = NULL;
+  env->n_syms = 0;
+
+  return env;
+}
+
+void env_dispose(struct env *env)
+{
+  free(env->bindings);
+  free(env->innermost);
+  free(env);
+}
+
+void *resolve(struct env *env, int sym) {
+  if (sym >= env->n_syms || env->innermost[sym] < 0) {
+    return NULL;
+  } else {
+    return env->bindings[env->innermost[sym]].value;
+  }
+}
+
+void push(struct env *env, int sym, void *value)
+{
+  // symbols are interned while parsing, the table may have to catch up
+  if (sym >= env->n_syms) {
+    unsigned n = env->n_syms ? env->n_syms : 64;
+    while (n <= sym)
+      n *= 2;
+    env->innermost = realloc(env->innermost, n * sizeof(int));
+    for (unsigned i = env->n_syms; i < n; ++i)
+      env->innermost[i] = -1;
+    env->n_syms = n;
+  }
+  if (env->depth == env->cap) {
+    env->cap = env->cap ? env->cap * 2 : 64;
+    env->bindings = realloc(env->bindings, env->cap * sizeof(struct binding));
+  }
+
+  struct binding *b = &env->bindings[env->depth];
+  b->sym = sym;
+  b->shadowed = env->innermost[sym];
+  b->value = value;
+  env->innermost[sym] = env->depth++;
+}
+
+// assumes that env is NOT empty
+void pop(struct env *env)
+{
+  struct binding *b = &env->bindings[--env->depth];
+  env->innermost[b->sym] = b->shadowed;
+}
+
+double time_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
@@ -1,12 +1,47 @@
-#include <llvm-c/Core.h>
-
-struct env {
-  struct env *prev;
-
-  char *name;
-  LLVMValueRef value;
-};
-
-LLVMValueRef resolve(struct env *env, char *name);
-struct env *push(struct env *env, char *name, LLVMValueRef value);
-struct env *pop(struct env *env);
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stddef.h>
+#include <llvm-c/Core.h>
+
+// Identifiers are interned by the scanner: every distinct name is mapped
+// once to a small integer, its symbol, and the rest of the compiler only
+// deals with symbols. Interning is thread safe.
+int intern(const char *name, size_t len);
+const char *symbol_name(int sym);
+int symbol_count(void);
+
+// A binding of the environment. Bindings live on a stack in the order they
+// are pushed; the ones hidden by a more recent binding of the same symbol
+// are chained through shadowed.
+struct binding {
+  int sym;
+  int shadowed;   // index of the binding of sym this one hides, or -1
+
+  // an LLVMValueRef during code generation, the binding struct expr
+  // (LET or VAR) during type checking
+  void *value;
+};
+
+// Scoped environment: resolve is a single array lookup, push and pop bump
+// the top of the binding stack.
+struct env {
+  struct binding *bindings;
+  unsigned depth;
+  unsigned cap;
+
+  int *innermost;   // for every symbol, index of its visible binding or -1
+  unsigned n_syms;
+};
+
+struct env *env_create(void);
+void env_dispose(struct env *env);
+
+void *resolve(struct env *env, int sym);
+void push(struct env *env, int sym, void *value);
+void pop(struct env *env);
+
+// monotonic wall clock in milliseconds, used for timing the jit phases
+double time_ms(void);
+
+#endif